@@ -199,6 +199,9 @@ static const char *DEVICECODE = ""
 #ifdef USE_EDC
 			"EDC "
 #endif
+#ifdef USE_CPU
+			"CPU "
+#endif
 #ifdef USE_SPONDOOLIES
 			"SPN "
 #endif
@@ -2472,8 +2475,8 @@ static void poolstatus(struct io_data *io_data, __maybe_unused SOCKETTYPE c, __m
 {
 	struct api_data *root = NULL;
 	bool io_open = false;
-	char *status, *lp;
-	int i;
+	char *status, *lp, buf[32];
+	int i, j;
 
 	if (total_pools == 0) {
 		message(io_data, MSG_NOPOOL, 0, NULL, isjson);
@@ -2556,6 +2559,20 @@ static void poolstatus(struct io_data *io_data, __maybe_unused SOCKETTYPE c, __m
 		double stalep = (pool->diff_accepted + pool->diff_rejected + pool->diff_stale) ?
 				(double)(pool->diff_stale) / (double)(pool->diff_accepted + pool->diff_rejected + pool->diff_stale) : 0;
 		root = api_add_percent(root, "Pool Stale%", &stalep, false);
+		double lat50, lat90, lat99;
+		pool_submit_latency(pool, &lat50, &lat90, &lat99);
+		root = api_add_double(root, "Submit Latency P50", &lat50, true);
+		root = api_add_double(root, "Submit Latency P90", &lat90, true);
+		root = api_add_double(root, "Submit Latency P99", &lat99, true);
+		uint64_t rtt[SSHARE_RTT_BUCKETS];
+		pool_share_rtt(pool, rtt);
+		for (j = 0; j < SSHARE_RTT_BUCKETS; j++) {
+			if (j < SSHARE_RTT_BUCKETS - 1)
+				snprintf(buf, sizeof(buf), "Share RTT <%dms", sshare_rtt_bounds[j]);
+			else
+				snprintf(buf, sizeof(buf), "Share RTT %dms+", sshare_rtt_bounds[j - 1]);
+			root = api_add_uint64(root, buf, &rtt[j], true);
+		}
 
 		root = print_data(io_data, root, isjson, isjson && (i > 0));
 	}
@@ -2622,6 +2639,31 @@ static void summary(struct io_data *io_data, __maybe_unused SOCKETTYPE c, __mayb
 
 	mutex_unlock(&hash_lock);
 
+	// hold times of the lock every staged work goes through, in microseconds
+	uint64_t stgd_locks;
+	double stgd_hold_avg, stgd_hold_max;
+	stgd_lock_stats(&stgd_locks, &stgd_hold_avg, &stgd_hold_max);
+	root = api_add_uint64(root, "Staged Locks", &stgd_locks, true);
+	root = api_add_double(root, "Staged Lock Hold Avg", &stgd_hold_avg, true);
+	root = api_add_double(root, "Staged Lock Hold Max", &stgd_hold_max, true);
+
+	// work structs that came from the heap, and from the work pool
+	uint64_t work_allocs, work_reuses;
+	work_pool_stats(&work_allocs, &work_reuses);
+	root = api_add_uint64(root, "Work Allocated", &work_allocs, true);
+	root = api_add_uint64(root, "Work Reused", &work_reuses, true);
+
+	// batches of stratum work, and the works generated per second of generating
+	uint64_t gen_batches, gen_discarded;
+	double gen_avg, gen_rate;
+	int gen_max;
+	gen_batch_stats(&gen_batches, &gen_avg, &gen_max, &gen_discarded, &gen_rate);
+	root = api_add_uint64(root, "Gen Batches", &gen_batches, true);
+	root = api_add_double(root, "Gen Batch Avg", &gen_avg, true);
+	root = api_add_int(root, "Gen Batch Max", &gen_max, true);
+	root = api_add_uint64(root, "Gen Discarded", &gen_discarded, true);
+	root = api_add_double(root, "Gen Works/s", &gen_rate, true);
+
 	root = print_data(io_data, root, isjson, false);
 	if (isjson && io_open)
 		io_close(io_data);
@@ -3211,6 +3253,16 @@ static int itemstats(struct io_data *io_data, int i, char *id, struct cgminer_st
 		root = api_add_uint64(root, "Bytes Recv", &(pool_stats->bytes_received), false);
 		root = api_add_uint64(root, "Net Bytes Sent", &(pool_stats->net_bytes_sent), false);
 		root = api_add_uint64(root, "Net Bytes Recv", &(pool_stats->net_bytes_received), false);
+		root = api_add_uint64(root, "Send Syscalls", &(pool_stats->send_syscalls), false);
+		root = api_add_uint64(root, "Shares Sent", &(pool_stats->shares_sent), false);
+		root = api_add_uint64(root, "Share Sends", &(pool_stats->share_sends), false);
+		root = api_add_uint64(root, "Share Syscalls", &(pool_stats->share_syscalls), false);
+		double share_syscalls = pool_stats->shares_sent ?
+				(double)(pool_stats->share_syscalls) / (double)(pool_stats->shares_sent) : 0;
+		root = api_add_double(root, "Syscalls Per Share", &share_syscalls, true);
+		double share_wait = pool_stats->shares_sent ?
+				pool_stats->share_wait_ms / (double)(pool_stats->shares_sent) : 0;
+		root = api_add_double(root, "Share Wait Avg", &share_wait, true);
 	}
 
 	if (extra)
@@ -4918,9 +4970,11 @@ void api(int api_thr_id)
 										break;
 									}
 								}
-								if (ISPRIVGROUP(group) || strstr(COMMANDS(group), cmdbuf))
+								if (ISPRIVGROUP(group) || strstr(COMMANDS(group), cmdbuf)) {
+									/* The counts are kept per thread until folded */
+									stats_fold();
 									(cmds[i].func)(io_data, c, param, isjson, group);
-								else {
+								} else {
 									message(io_data, MSG_ACCDENY, 0, cmds[i].name, isjson);
 									applog(LOG_DEBUG, "API: access denied to '%s' for '%s' command", connectaddr, cmds[i].name);
 								}
@@ -89,6 +89,10 @@ char *curly = ":D";
 #include "driver-cointerra.h"
 #endif
 
+#ifdef USE_CPU
+#include "driver-cpu.h"
+#endif
+
 #ifdef USE_HASHFAST
 #include "driver-hashfast.h"
 #endif
@@ -150,6 +154,12 @@ const int opt_cutofftemp = 95;
 int opt_log_interval = 5;
 int opt_queue = 9999;
 static int max_queue = 1;
+#define GEN_BATCH_MAX 256
+static int opt_gen_batch = 64;
+static int opt_gen_threads;
+#ifdef HAVE_LIBCURL
+static int opt_submit_threads = 4;
+#endif
 int opt_scantime = -1;
 int opt_expiry = 120;
 static const bool opt_time = true;
@@ -307,6 +317,7 @@ static struct timeval restart_tv_start, update_tv_start;
 
 cglock_t control_lock;
 pthread_mutex_t stats_lock;
+static int pool_stats_ids;
 
 int hw_errors;
 int64_t total_accepted, total_rejected, total_diff1;
@@ -358,18 +369,24 @@ static struct block *blocks = NULL;
 
 int swork_id;
 
-/* For creating a hash database of stratum shares submitted that have not had
- * a response yet */
+/* For creating a hash database per pool of stratum shares submitted that have
+ * not had a response yet, and a timer wheel to expire them from */
 struct stratum_share {
 	UT_hash_handle hh;
+	struct list_head wheel;
 	bool block;
 	struct work *work;
 	int id;
 	time_t sshare_time;
 	time_t sshare_sent;
+	struct timeval tv_sent;
 };
 
-static struct stratum_share *stratum_shares = NULL;
+/* Upper bounds in ms of the response round trip time ranges, the last range
+ * is everything slower */
+const int sshare_rtt_bounds[SSHARE_RTT_BUCKETS - 1] = {
+	10, 25, 50, 100, 250, 500, 1000, 2500
+};
 
 char *opt_socks_proxy = NULL;
 
@@ -394,7 +411,17 @@ struct sigaction termhandler, inthandler;
 struct thread_q *getq;
 
 static uint32_t total_work;
-struct work *staged_work = NULL;
+
+/* Staged work, oldest tv_staged first. Work that can be rolled is kept apart
+ * from clones and work that can't, so hash_pop() takes the head of either. */
+static LIST_HEAD(staged_fixed);
+static LIST_HEAD(staged_rolling);
+static int staged_count;
+
+/* How long stgd_lock is held, for the API. Only touched with it held. */
+static struct timeval stgd_taken;
+static uint64_t stgd_locks;
+static double stgd_hold_us, stgd_hold_max_us;
 
 struct schedtime {
 	bool enable;
@@ -622,11 +649,13 @@ void adjust_quota_gcd(void)
 struct pool *add_pool(void)
 {
 	struct pool *pool;
+	int i;
 
 	pool = calloc(sizeof(struct pool), 1);
 	if (!pool)
 		quit(1, "Failed to malloc pool in add_pool");
 	pool->pool_no = pool->prio = total_pools;
+	pool->stats_id = pool_stats_ids++;
 	pools = realloc(pools, sizeof(struct pool *) * (total_pools + 2));
 	pools[total_pools++] = pool;
 	mutex_init(&pool->pool_lock);
@@ -636,6 +665,9 @@ struct pool *add_pool(void)
 	mutex_init(&pool->stratum_lock);
 	cglock_init(&pool->gbt_lock);
 	INIT_LIST_HEAD(&pool->curlring);
+	mutex_init(&pool->sshare_lock);
+	for (i = 0; i < SSHARE_WHEEL; i++)
+		INIT_LIST_HEAD(&pool->sshare_wheel[i]);
 
 	/* Make sure the pool doesn't think we've been idle since time 0 */
 	pool->tv_idle.tv_sec = ~0UL;
@@ -737,6 +769,11 @@ static char *set_int_1_to_10(const char *arg, int *i)
 	return set_int_range(arg, i, 1, 10);
 }
 
+static char *set_gen_batch(const char *arg, int *i)
+{
+	return set_int_range(arg, i, 1, GEN_BATCH_MAX);
+}
+
 static char __maybe_unused *set_int_0_to_4(const char *arg, int *i)
 {
 	return set_int_range(arg, i, 0, 4);
@@ -1208,6 +1245,11 @@ static struct opt_table opt_config_table[] = {
 			opt_set_bool, &opt_compact,
 			"Use compact display without per device statistics"),
 #endif
+#ifdef USE_CPU
+	OPT_WITH_ARG("--cpu-threads",
+		set_int_0_to_9999, opt_show_intval, &opt_cpu_threads,
+		"Number of host threads to hash on, one CPU device each (default: 0)"),
+#endif
 #ifdef USE_COINTERRA
 	OPT_WITH_ARG("--cta-load",
 		set_int_0_to_255, opt_show_intval, &opt_cta_load,
@@ -1239,6 +1281,12 @@ static struct opt_table opt_config_table[] = {
 	OPT_WITHOUT_ARG("--fix-protocol",
 			opt_set_bool, &opt_fix_protocol,
 			"Do not redirect to a different getwork protocol (eg. stratum)"),
+	OPT_WITH_ARG("--gen-batch",
+		     set_gen_batch, opt_show_intval, &opt_gen_batch,
+		     "Most stratum works to generate and stage at once, 1-256"),
+	OPT_WITH_ARG("--gen-threads",
+		     set_int_0_to_255, opt_show_intval, &opt_gen_threads,
+		     "Threads helping generate batches of stratum work (default: 0)"),
 #ifdef USE_HASHFAST
 	OPT_WITHOUT_ARG("--hfa-dfu-boot",
 			opt_set_bool, &opt_hfa_dfu_boot,
@@ -1391,6 +1439,11 @@ static struct opt_table opt_config_table[] = {
 	OPT_WITH_ARG("--socks-proxy",
 		     opt_set_charp, NULL, &opt_socks_proxy,
 		     "Set socks4 proxy (host:port)"),
+#ifdef HAVE_LIBCURL
+	OPT_WITH_ARG("--submit-threads",
+		     set_int_1_to_65535, opt_show_intval, &opt_submit_threads,
+		     "Threads submitting shares to getwork and GBT pools (default: 4)"),
+#endif
 #ifdef HAVE_SYSLOG_H
 	OPT_WITHOUT_ARG("--syslog",
 			opt_set_bool, &use_syslog,
@@ -1749,39 +1802,182 @@ static int total_work_inc(void)
 	return ret;
 }
 
+/* Retired work structs are kept here, already cleaned, for make_work() to
+ * hand out again instead of going back to the heap. They are linked by their
+ * staged list_head, unused once work is retired. */
+#define WORK_POOL_MAX 4096
+
+static pthread_mutex_t work_pool_lock;
+static LIST_HEAD(work_pool);
+static int work_pool_count;
+static uint64_t work_allocs, work_reuses;
+
 static struct work *make_work(void)
 {
-	struct work *work = calloc(1, sizeof(struct work));
+	struct work *work = NULL;
+
+	mutex_lock(&work_pool_lock);
+	if (likely(work_pool_count)) {
+		work = list_entry(work_pool.next, struct work, staged);
+		list_del(&work->staged);
+		work_pool_count--;
+		work_reuses++;
+	} else
+		work_allocs++;
+	mutex_unlock(&work_pool_lock);
 
-	if (unlikely(!work))
-		quit(1, "Failed to calloc work in make_work");
+	if (unlikely(!work)) {
+		work = calloc(1, sizeof(struct work));
+		if (unlikely(!work))
+			quit(1, "Failed to calloc work in make_work");
+	}
 
 	work->id = total_work_inc();
 
 	return work;
 }
 
+void work_pool_stats(uint64_t *allocs, uint64_t *reuses)
+{
+	mutex_lock(&work_pool_lock);
+	*allocs = work_allocs;
+	*reuses = work_reuses;
+	mutex_unlock(&work_pool_lock);
+}
+
 /* This is the central place all work that is about to be retired should be
- * cleaned to remove any dynamically allocated arrays within the struct */
+ * cleaned to release any dynamically allocated arrays within the struct */
 void clean_work(struct work *work)
 {
-	free(work->job_id);
-	free(work->ntime);
-	free(work->coinbase);
-	free(work->nonce1);
+	refstr_put(work->job_id);
+	refstr_put(work->ntime);
+	refstr_put(work->coinbase);
+	refstr_put(work->nonce1);
 	memset(work, 0, sizeof(struct work));
 }
 
 /* All dynamically allocated work structs should be freed here to not leak any
- * ram from arrays allocated within the work struct */
+ * ram from arrays allocated within the work struct. The struct itself goes
+ * back to the work pool. */
 void _free_work(struct work *work)
 {
 	clean_work(work);
+
+	mutex_lock(&work_pool_lock);
+	if (work_pool_count < WORK_POOL_MAX) {
+		list_add(&work->staged, &work_pool);
+		work_pool_count++;
+		work = NULL;
+	}
+	mutex_unlock(&work_pool_lock);
+
 	free(work);
 }
 
+/* Keeps *ref a refstr of str for work to share, only making a new one when
+ * str has changed. Must be called with the lock protecting both held. */
+static void intern_work_str(char **ref, const char *str)
+{
+	if (*ref && !strcmp(*ref, str))
+		return;
+	refstr_put(*ref);
+	*ref = refstr_new(str);
+}
+
 static void gen_hash(unsigned char *data, unsigned char *hash, int len);
+static void gen_batch_zero(void);
 static void calc_diff(struct work *work, double known);
+
+/* Keeps pool->coinbase_mid the midstate of the coinbase's whole blocks before
+ * nonce2, only hashing them again when they changed, which is once per job
+ * at most. Must be called with the write lock on the coinbase held. */
+static void __update_coinbase_mid(struct pool *pool)
+{
+	int len = pool->nonce2_offset / SHA256_BLOCK_SIZE * SHA256_BLOCK_SIZE;
+
+	if (pool->coinbase_prefix && len == pool->coinbase_prefix_len &&
+	    !memcmp(pool->coinbase_prefix, pool->coinbase, len))
+		return;
+
+	pool->coinbase_prefix = realloc(pool->coinbase_prefix, len + 1);
+	if (unlikely(!pool->coinbase_prefix))
+		quit(1, "Failed to realloc coinbase_prefix in __update_coinbase_mid");
+	memcpy(pool->coinbase_prefix, pool->coinbase, len);
+	pool->coinbase_prefix_len = len;
+	sha256_midstate(pool->coinbase, len / SHA256_BLOCK_SIZE, pool->coinbase_mid);
+}
+
+/* The double hash of the coinbase as it stands, only hashing what follows the
+ * blocks in coinbase_mid. Must be called with at least the read lock held. */
+static void __gen_coinbase_hash(struct pool *pool, unsigned char *hash)
+{
+	int done = pool->coinbase_prefix_len;
+
+	sha256d_resume(pool->coinbase_mid, done, pool->coinbase + done,
+		       pool->coinbase_len - done, hash);
+}
+
+#define MERKLE_BATCH 64
+
+/* Folds a merkle branch into n coinbase hashes, leaving the merkle roots in
+ * their place. The levels of one root depend on each other but the roots
+ * don't, so with enough of them every level is hashed with the multi-buffer
+ * kernels, a lane per root. */
+static void fold_merkle(unsigned char (*roots)[32], int n, unsigned char *const *branch,
+			int merkles)
+{
+	/* the second block of a 64 byte message, and of a 32 byte one */
+	static const unsigned char pad64[64] = { [0] = 0x80, [62] = 0x02 };
+	unsigned char data[MERKLE_BATCH][64], merkle_sha[64];
+	const uint8_t *blocks[MERKLE_BATCH], *pads[MERKLE_BATCH];
+	uint32_t state[MERKLE_BATCH][8];
+	int i, j, k, m;
+
+	if (n < sha256_lanes()) {
+		for (i = 0; i < n; i++) {
+			memcpy(merkle_sha, roots[i], 32);
+			for (j = 0; j < merkles; j++) {
+				memcpy(merkle_sha + 32, branch[j], 32);
+				gen_hash(merkle_sha, roots[i], 64);
+				memcpy(merkle_sha, roots[i], 32);
+			}
+		}
+		return;
+	}
+
+	for (i = 0; i < MERKLE_BATCH; i++) {
+		blocks[i] = data[i];
+		pads[i] = pad64;
+	}
+
+	for (; n > 0; n -= m, roots += m) {
+		m = n < MERKLE_BATCH ? n : MERKLE_BATCH;
+		for (j = 0; j < merkles; j++) {
+			for (i = 0; i < m; i++) {
+				memcpy(data[i], roots[i], 32);
+				memcpy(data[i] + 32, branch[j], 32);
+				memcpy(state[i], sha256_h0, 32);
+			}
+			sha256_transform_many(state, blocks, m);
+			sha256_transform_many(state, pads, m);
+
+			for (i = 0; i < m; i++) {
+				for (k = 0; k < 8; k++)
+					*(uint32_t *)(data[i] + k * 4) = htobe32(state[i][k]);
+				memset(data[i] + 32, 0, 32);
+				data[i][32] = 0x80;
+				data[i][62] = 0x01;
+				memcpy(state[i], sha256_h0, 32);
+			}
+			sha256_transform_many(state, blocks, m);
+
+			for (i = 0; i < m; i++) {
+				for (k = 0; k < 8; k++)
+					*(uint32_t *)(roots[i] + k * 4) = htobe32(state[i][k]);
+			}
+		}
+	}
+}
 char *workpadding = "000000800000000000000000000000000000000000000000000000000000000000000000000000000000000080020000";
 
 #ifdef HAVE_LIBCURL
@@ -1801,16 +1997,13 @@ static void __build_gbt_txns(struct pool *pool, json_t *res_val)
 
 static void __gbt_merkleroot(struct pool *pool, unsigned char *merkle_root)
 {
-	unsigned char merkle_sha[64];
+	unsigned char *branch[16];
 	int i;
 
-	gen_hash(pool->coinbase, merkle_root, pool->coinbase_len);
-	memcpy(merkle_sha, merkle_root, 32);
-	for (i = 0; i < pool->merkles; i++) {
-		memcpy(merkle_sha + 32, pool->merklebin + i * 32, 32);
-		gen_hash(merkle_sha, merkle_root, 64);
-		memcpy(merkle_sha, merkle_root, 32);
-	}
+	for (i = 0; i < pool->merkles; i++)
+		branch[i] = pool->merklebin + i * 32;
+	__gen_coinbase_hash(pool, merkle_root);
+	fold_merkle((unsigned char (*)[32])merkle_root, 1, branch, pool->merkles);
 }
 
 static bool work_decode(struct pool *pool, struct work *work, json_t *val);
@@ -1867,6 +2060,9 @@ static void gen_gbt_work(struct pool *pool, struct work *work)
 	nonce2le = htole64(pool->nonce2);
 	memcpy(pool->coinbase + pool->nonce2_offset, &nonce2le, pool->n2size);
 	pool->nonce2++;
+	__update_coinbase_mid(pool);
+	if (pool->gbt_workid)
+		intern_work_str(&pool->work_job_id, pool->gbt_workid);
 	cg_dwlock(&pool->gbt_lock);
 	__gbt_merkleroot(pool, merkleroot);
 
@@ -1877,13 +2073,13 @@ static void gen_gbt_work(struct pool *pool, struct work *work)
 
 	memcpy(work->target, pool->gbt_target, 32);
 
-	work->coinbase = bin2hex(pool->coinbase, pool->coinbase_len);
+	work->coinbase = refstr_bin2hex(pool->coinbase, pool->coinbase_len);
 
 	/* For encoding the block data on submission */
 	work->gbt_txns = pool->gbt_txns + 1;
 
 	if (pool->gbt_workid)
-		work->job_id = strdup(pool->gbt_workid);
+		work->job_id = refstr_get(pool->work_job_id);
 	cg_runlock(&pool->gbt_lock);
 
 	flip32(work->data + 4 + 32, merkleroot);
@@ -2337,18 +2533,85 @@ void decay_time(double *f, double fadd, double fsecs, double interval)
 	*f /= ftotal;
 }
 
+static inline void __stgd_taken(void)
+{
+	cgtime(&stgd_taken);
+}
+
+static inline void __stgd_released(void)
+{
+	struct timeval now;
+	double held;
+
+	cgtime(&now);
+	held = us_tdiff(&now, &stgd_taken);
+	stgd_locks++;
+	stgd_hold_us += held;
+	if (held > stgd_hold_max_us)
+		stgd_hold_max_us = held;
+}
+
+static void stgd_lock_take(void)
+{
+	mutex_lock(stgd_lock);
+	__stgd_taken();
+}
+
+static void stgd_lock_release(void)
+{
+	__stgd_released();
+	mutex_unlock(stgd_lock);
+}
+
+/* Waiting on a condition gives up stgd_lock, so it doesn't count as held */
+static void stgd_cond_wait(pthread_cond_t *cond)
+{
+	__stgd_released();
+	pthread_cond_wait(cond, stgd_lock);
+	__stgd_taken();
+}
+
+static int stgd_cond_timedwait(pthread_cond_t *cond, const struct timespec *abstime)
+{
+	int rc;
+
+	__stgd_released();
+	rc = pthread_cond_timedwait(cond, stgd_lock, abstime);
+	__stgd_taken();
+
+	return rc;
+}
+
+void stgd_lock_stats(uint64_t *locks, double *hold_avg, double *hold_max)
+{
+	stgd_lock_take();
+	*locks = stgd_locks;
+	*hold_avg = stgd_locks ? stgd_hold_us / stgd_locks : 0;
+	*hold_max = stgd_hold_max_us;
+	stgd_lock_release();
+}
+
+static void stgd_lock_zero(void)
+{
+	stgd_lock_take();
+	stgd_locks = 0;
+	stgd_hold_us = 0;
+	stgd_hold_max_us = 0;
+	stgd_lock_release();
+}
+
 static int __total_staged(void)
 {
-	return HASH_COUNT(staged_work);
+	return staged_count;
 }
 
 static int total_staged(void)
 {
 	int ret;
 
-	mutex_lock(stgd_lock);
+	stgd_lock_take();
 	ret = __total_staged();
-	mutex_unlock(stgd_lock);
+	stgd_lock_release();
 
 	return ret;
 }
@@ -2856,9 +3119,341 @@ static void reject_pool(struct pool *pool)
 
 static void restart_threads(void);
 
-/* Theoretically threads could race when modifying accepted and
- * rejected values but the chance of two submits completing at the
- * same time is zero so there is no point adding extra locking */
+/* Share, difficulty and hardware error counts are not added to the totals,
+ * pools and devices by the threads that find or submit shares. Each thread
+ * adds them up in a shard of its own, that only it writes, and stats_fold()
+ * adds what the shards gained since the last fold into the fields everything
+ * else reads, just before they get read. stats_lock only serialises the
+ * folding and the rare growing of a shard. A device's own hw_errors are the
+ * exception, drivers read them back to throttle so inc_hw_errors() adds to
+ * them in place. */
+struct share_counts {
+	int64_t accepted, rejected, stale, hw_errors, diff1;
+	double diff_accepted, diff_rejected, diff_stale;
+};
+
+struct stats_cell {
+	struct share_counts sum;	/* Only ever grows, written by the owner */
+	struct share_counts folded;	/* What of sum has been folded so far */
+};
+
+struct stats_shard {
+	char pad_start[64];
+	struct stats_cell total;
+	/* Indexed by pool->stats_id and cgpu->cgminer_id */
+	struct stats_cell *pools, *devs;
+	int npools, ndevs;
+	bool idle;
+	struct stats_shard *next;
+	char pad_end[64];
+};
+
+static pthread_key_t stats_key;
+static struct stats_shard *stats_shards;
+
+/* The shard of an exited thread is handed on to the next new thread, so
+ * there are never more shards than threads counting at once */
+static void stats_shard_idle(void *arg)
+{
+	struct stats_shard *shard = arg;
+
+	mutex_lock(&stats_lock);
+	shard->idle = true;
+	mutex_unlock(&stats_lock);
+}
+
+static struct stats_shard *stats_shard(void)
+{
+	struct stats_shard *shard = pthread_getspecific(stats_key);
+
+	if (likely(shard))
+		return shard;
+
+	mutex_lock(&stats_lock);
+	for (shard = stats_shards; shard; shard = shard->next) {
+		if (shard->idle)
+			break;
+	}
+	if (!shard) {
+		shard = calloc(sizeof(struct stats_shard), 1);
+		if (unlikely(!shard))
+			quit(1, "Failed to calloc stats shard");
+		shard->next = stats_shards;
+		stats_shards = shard;
+	}
+	shard->idle = false;
+	mutex_unlock(&stats_lock);
+
+	pthread_setspecific(stats_key, shard);
+	return shard;
+}
+
+/* The cell for id in one of the shard's arrays, grown when id is new to it */
+static struct stats_cell *stats_cell(struct stats_cell **cells, int *ncells, int id)
+{
+	if (unlikely(id >= *ncells)) {
+		int n = id + 8;
+		struct stats_cell *grown = calloc(sizeof(struct stats_cell), n);
+
+		if (unlikely(!grown))
+			quit(1, "Failed to calloc stats cells");
+		mutex_lock(&stats_lock);
+		if (*ncells)
+			memcpy(grown, *cells, sizeof(struct stats_cell) * *ncells);
+		free(*cells);
+		*cells = grown;
+		*ncells = n;
+		mutex_unlock(&stats_lock);
+	}
+	return &(*cells)[id];
+}
+
+/* Only the owner writes a cell, the stores are atomic so that a fold never
+ * sees half of one */
+static inline void count_add(int64_t *count, int64_t n)
+{
+	__atomic_store_n(count, *count + n, __ATOMIC_RELAXED);
+}
+
+static inline void diff_add(double *diff, double n)
+{
+	double sum = *diff + n;
+
+	__atomic_store(diff, &sum, __ATOMIC_RELAXED);
+}
+
+enum share_count {
+	SHARE_ACCEPTED,
+	SHARE_REJECTED,
+	SHARE_STALE,
+};
+
+static void __stats_add(struct stats_cell *cell, enum share_count what, double diff)
+{
+	struct share_counts *sum = &cell->sum;
+
+	switch (what) {
+		case SHARE_ACCEPTED:
+			count_add(&sum->accepted, 1);
+			diff_add(&sum->diff_accepted, diff);
+			break;
+		case SHARE_REJECTED:
+			count_add(&sum->rejected, 1);
+			diff_add(&sum->diff_rejected, diff);
+			break;
+		case SHARE_STALE:
+			count_add(&sum->stale, 1);
+			diff_add(&sum->diff_stale, diff);
+			break;
+	}
+}
+
+/* Counts a share of diff against the totals, the pool and, when it is known,
+ * the device */
+static void stats_add_share(struct pool *pool, struct cgpu_info *cgpu,
+			    enum share_count what, double diff)
+{
+	struct stats_shard *shard = stats_shard();
+
+	__stats_add(&shard->total, what, diff);
+	__stats_add(stats_cell(&shard->pools, &shard->npools, pool->stats_id), what, diff);
+	if (cgpu)
+		__stats_add(stats_cell(&shard->devs, &shard->ndevs, cgpu->cgminer_id), what, diff);
+}
+
+/* Shares lost in bulk, counted against the totals and the pool only */
+static void stats_add_stale(struct pool *pool, int shares, double diff)
+{
+	struct stats_shard *shard = stats_shard();
+	struct stats_cell *cell = stats_cell(&shard->pools, &shard->npools, pool->stats_id);
+
+	count_add(&shard->total.sum.stale, shares);
+	diff_add(&shard->total.sum.diff_stale, diff);
+	count_add(&cell->sum.stale, shares);
+	diff_add(&cell->sum.diff_stale, diff);
+}
+
+/* diff1 is counted in whole shares, as adding device_diff straight to the
+ * int64_t fields did */
+static void stats_add_diff1(struct pool *pool, struct cgpu_info *cgpu, double diff)
+{
+	struct stats_shard *shard = stats_shard();
+	int64_t diff1 = diff;
+
+	count_add(&shard->total.sum.diff1, diff1);
+	count_add(&stats_cell(&shard->pools, &shard->npools, pool->stats_id)->sum.diff1, diff1);
+	count_add(&stats_cell(&shard->devs, &shard->ndevs, cgpu->cgminer_id)->sum.diff1, diff1);
+}
+
+static void stats_add_hw_error(void)
+{
+	count_add(&stats_shard()->total.sum.hw_errors, 1);
+}
+
+/* What the cell gained since it was last folded */
+static void __stats_gained(struct stats_cell *cell, struct share_counts *gain)
+{
+	struct share_counts *sum = &cell->sum, *folded = &cell->folded, now;
+
+	now.accepted = __atomic_load_n(&sum->accepted, __ATOMIC_RELAXED);
+	now.rejected = __atomic_load_n(&sum->rejected, __ATOMIC_RELAXED);
+	now.stale = __atomic_load_n(&sum->stale, __ATOMIC_RELAXED);
+	now.hw_errors = __atomic_load_n(&sum->hw_errors, __ATOMIC_RELAXED);
+	now.diff1 = __atomic_load_n(&sum->diff1, __ATOMIC_RELAXED);
+	__atomic_load(&sum->diff_accepted, &now.diff_accepted, __ATOMIC_RELAXED);
+	__atomic_load(&sum->diff_rejected, &now.diff_rejected, __ATOMIC_RELAXED);
+	__atomic_load(&sum->diff_stale, &now.diff_stale, __ATOMIC_RELAXED);
+
+	gain->accepted = now.accepted - folded->accepted;
+	gain->rejected = now.rejected - folded->rejected;
+	gain->stale = now.stale - folded->stale;
+	gain->hw_errors = now.hw_errors - folded->hw_errors;
+	gain->diff1 = now.diff1 - folded->diff1;
+	gain->diff_accepted = now.diff_accepted - folded->diff_accepted;
+	gain->diff_rejected = now.diff_rejected - folded->diff_rejected;
+	gain->diff_stale = now.diff_stale - folded->diff_stale;
+	*folded = now;
+}
+
+static void __stats_fold(void)
+{
+	struct share_counts gain;
+	struct stats_shard *shard;
+	int i;
+
+	for (shard = stats_shards; shard; shard = shard->next) {
+		__stats_gained(&shard->total, &gain);
+		total_accepted += gain.accepted;
+		total_rejected += gain.rejected;
+		total_stale += gain.stale;
+		hw_errors += gain.hw_errors;
+		total_diff1 += gain.diff1;
+		total_diff_accepted += gain.diff_accepted;
+		total_diff_rejected += gain.diff_rejected;
+		total_diff_stale += gain.diff_stale;
+
+		/* What removed pools gained stays in their cells, unread */
+		for (i = 0; i < total_pools; i++) {
+			struct pool *pool = pools[i];
+
+			if (pool->stats_id >= shard->npools)
+				continue;
+			__stats_gained(&shard->pools[pool->stats_id], &gain);
+			pool->accepted += gain.accepted;
+			pool->rejected += gain.rejected;
+			pool->stale_shares += gain.stale;
+			pool->diff1 += gain.diff1;
+			pool->diff_accepted += gain.diff_accepted;
+			pool->diff_rejected += gain.diff_rejected;
+			pool->diff_stale += gain.diff_stale;
+		}
+
+		for (i = 0; i < total_devices; i++) {
+			struct cgpu_info *cgpu = get_devices(i);
+
+			if (cgpu->cgminer_id >= shard->ndevs)
+				continue;
+			__stats_gained(&shard->devs[cgpu->cgminer_id], &gain);
+			cgpu->accepted += gain.accepted;
+			cgpu->rejected += gain.rejected;
+			cgpu->diff1 += gain.diff1;
+			cgpu->diff_accepted += gain.diff_accepted;
+			cgpu->diff_rejected += gain.diff_rejected;
+		}
+	}
+}
+
+/* Folds what the shards have gained so far, so none of it turns up in the
+ * counts after they are zeroed */
+static void stats_zero(void)
+{
+	int i;
+
+	mutex_lock(&stats_lock);
+	__stats_fold();
+
+	total_accepted = 0;
+	total_rejected = 0;
+	total_stale = 0;
+	hw_errors = 0;
+	total_diff1 = 0;
+	total_diff_accepted = 0;
+	total_diff_rejected = 0;
+	total_diff_stale = 0;
+
+	for (i = 0; i < total_pools; i++) {
+		struct pool *pool = pools[i];
+
+		pool->accepted = 0;
+		pool->rejected = 0;
+		pool->stale_shares = 0;
+		pool->diff1 = 0;
+		pool->diff_accepted = 0;
+		pool->diff_rejected = 0;
+		pool->diff_stale = 0;
+	}
+
+	for (i = 0; i < total_devices; i++) {
+		struct cgpu_info *cgpu = get_devices(i);
+
+		cgpu->accepted = 0;
+		cgpu->rejected = 0;
+		cgpu->hw_errors = 0;
+		cgpu->diff1 = 0;
+		cgpu->diff_accepted = 0;
+		cgpu->diff_rejected = 0;
+	}
+	mutex_unlock(&stats_lock);
+}
+
+/* Brings the totals, pool and device counts up to date with the shards, to be
+ * called before reading any of them */
+void stats_fold(void)
+{
+	mutex_lock(&stats_lock);
+	__stats_fold();
+	mutex_unlock(&stats_lock);
+}
+
+/* Keeps the time from the share being found to the pool's reply to it among
+ * the pool's last SUBMIT_LATENCIES */
+static void record_submit_latency(const struct work *work)
+{
+	struct pool *pool = work->pool;
+	struct timeval now;
+
+	cgtime(&now);
+	pool->submit_latency[__sync_fetch_and_add(&pool->submit_latencies, 1) % SUBMIT_LATENCIES] =
+		us_tdiff(&now, (struct timeval *)&work->tv_work_found) / 1000;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* The 50th, 90th and 99th percentiles of the pool's recent submit latencies,
+ * in ms */
+void pool_submit_latency(struct pool *pool, double *p50, double *p90, double *p99)
+{
+	double lat[SUBMIT_LATENCIES];
+	int n;
+
+	n = MIN(pool->submit_latencies, SUBMIT_LATENCIES);
+	memcpy(lat, pool->submit_latency, n * sizeof(double));
+
+	if (!n) {
+		*p50 = *p90 = *p99 = 0;
+		return;
+	}
+	qsort(lat, n, sizeof(double), cmp_double);
+	*p50 = lat[n * 50 / 100];
+	*p90 = lat[n * 90 / 100];
+	*p99 = lat[n * 99 / 100];
+}
+
 static void
 share_result(json_t *val, json_t *res, json_t *err, const struct work *work,
 	     char *hashshow, bool resubmit, char *worktime)
@@ -2867,16 +3462,10 @@ share_result(json_t *val, json_t *res, json_t *err, const struct work *work,
 	struct cgpu_info *cgpu;
 
 	cgpu = get_thr_cgpu(work->thr_id);
+	record_submit_latency(work);
 
 	if (json_is_true(res) || (work->gbt && json_is_null(res))) {
-		mutex_lock(&stats_lock);
-		cgpu->accepted++;
-		total_accepted++;
-		pool->accepted++;
-		cgpu->diff_accepted += work->work_difficulty;
-		total_diff_accepted += work->work_difficulty;
-		pool->diff_accepted += work->work_difficulty;
-		mutex_unlock(&stats_lock);
+		stats_add_share(pool, cgpu, SHARE_ACCEPTED, work->work_difficulty);
 
 		pool->seq_rejects = 0;
 		cgpu->last_share_pool = pool->pool_no;
@@ -2894,6 +3483,8 @@ share_result(json_t *val, json_t *res, json_t *err, const struct work *work,
 				       hashshow, cgpu->drv->name, cgpu->device_id, resubmit ? "(resubmit)" : "", worktime);
 		}
 		sharelog("accept", work);
+		if (opt_shares)
+			stats_fold();
 		if (opt_shares && total_diff_accepted >= opt_shares) {
 			applog(LOG_WARNING, "Successfully mined %d accepted shares as requested and exiting.", opt_shares);
 			kill_work();
@@ -2914,15 +3505,9 @@ share_result(json_t *val, json_t *res, json_t *err, const struct work *work,
 		if (unlikely(work->block))
 			restart_threads();
 	} else {
-		mutex_lock(&stats_lock);
-		cgpu->rejected++;
-		total_rejected++;
-		pool->rejected++;
-		cgpu->diff_rejected += work->work_difficulty;
-		total_diff_rejected += work->work_difficulty;
-		pool->diff_rejected += work->work_difficulty;
-		pool->seq_rejects++;
-		mutex_unlock(&stats_lock);
+		stats_add_share(pool, cgpu, SHARE_REJECTED, work->work_difficulty);
+		/* The submit threads may take rejects of the same pool at once */
+		__sync_fetch_and_add(&pool->seq_rejects, 1);
 
 		applog(LOG_DEBUG, "PROOF OF WORK RESULT: false (booooo)");
 		if (!QUIET) {
@@ -3897,8 +4482,8 @@ static inline bool can_roll(struct work *work)
 		work->rolls < 7000 && !stale_work(work, false));
 }
 
-/* Adjust an existing char ntime field with a relative noffset */
-static void modify_ntime(char *ntime, int noffset)
+/* Returns a new refstr of an ntime field adjusted by a relative noffset */
+static char *offset_ntime(const char *ntime, int noffset)
 {
 	unsigned char bin[4];
 	uint32_t h32, *be32 = (uint32_t *)bin;
@@ -3906,7 +4491,8 @@ static void modify_ntime(char *ntime, int noffset)
 	hex2bin(bin, ntime, 4);
 	h32 = be32toh(*be32) + noffset;
 	*be32 = htobe32(h32);
-	__bin2hex(ntime, bin, 4);
+
+	return refstr_bin2hex(bin, 4);
 }
 
 void roll_work(struct work *work)
@@ -3922,56 +4508,171 @@ void roll_work(struct work *work)
 	work->rolls++;
 	work->nonce = 0;
 	applog(LOG_DEBUG, "Successfully rolled work");
-	/* Change the ntime field if this is stratum work */
-	if (work->ntime)
-		modify_ntime(work->ntime, 1);
+	/* Change the ntime field if this is stratum work. It may be shared so
+	 * it is replaced, not modified */
+	if (work->ntime) {
+		char *ntime = work->ntime;
+
+		work->ntime = offset_ntime(ntime, 1);
+		refstr_put(ntime);
+	}
 
 	/* This is now a different work item so it needs a different ID for the
 	 * hashtable */
 	work->id = total_work_inc();
 }
 
-static void *submit_work_thread(void *userdata)
+/* Found shares of getwork and GBT pools queue here for the submit threads, up
+ * to SUBMIT_QUEUE_MAX of them. The device threads queueing them never wait for
+ * room, a full queue loses its oldest share instead. */
+#define SUBMIT_QUEUE_MAX 1024
+
+struct submit_ent {
+	struct list_head list;
+	struct work *work;
+	bool resubmit;
+};
+
+static pthread_mutex_t submit_lock;
+static pthread_cond_t submit_cond;
+static LIST_HEAD(submit_queue);
+static int submit_queued;
+
+static void __submit_add(struct submit_ent *ent)
+{
+	list_add_tail(&ent->list, &submit_queue);
+	submit_queued++;
+	pthread_cond_signal(&submit_cond);
+}
+
+/* Takes the oldest queued share, or the oldest one of pool if there is a
+ * pool. Must be called with submit_lock held. */
+static struct submit_ent *__submit_take(struct pool *pool)
 {
-	struct work *work = (struct work *)userdata;
+	struct submit_ent *ent;
+
+	list_for_each_entry(ent, &submit_queue, list) {
+		if (!pool || ent->work->pool == pool) {
+			list_del(&ent->list);
+			submit_queued--;
+			return ent;
+		}
+	}
+	return NULL;
+}
+
+static void queue_submit_work(struct work *work)
+{
+	struct submit_ent *ent = calloc(sizeof(struct submit_ent), 1), *old = NULL;
+
+	if (unlikely(!ent))
+		quit(1, "Failed to calloc in queue_submit_work");
+	ent->work = work;
+
+	/* A queue this full is most likely stuck behind a pool not taking
+	 * shares, which must not stop the device from hashing. Its oldest share
+	 * of the same pool goes, or the oldest of all. */
+	mutex_lock(&submit_lock);
+	if (unlikely(submit_queued >= SUBMIT_QUEUE_MAX)) {
+		old = __submit_take(work->pool);
+		if (!old)
+			old = __submit_take(NULL);
+	}
+	__submit_add(ent);
+	mutex_unlock(&submit_lock);
+
+	if (unlikely(old)) {
+		struct pool *pool = old->work->pool;
+
+		applog(LOG_NOTICE, "Pool %d submit queue full, discarding its oldest share", pool->pool_no);
+		stats_add_share(pool, NULL, SHARE_STALE, old->work->work_difficulty);
+		free_work(old->work);
+		free(old);
+	}
+}
+
+/* Submits one share on the connection of ce. A share that fails is queued
+ * again behind the others unless it has gone stale meanwhile, returning
+ * false to give up the connection. */
+static bool submit_one(struct submit_ent *ent, struct curl_ent *ce)
+{
+	struct work *work = ent->work;
 	struct pool *pool = work->pool;
-	bool resubmit = false;
+
+	/* submit solution to bitcoin via JSON-RPC */
+	if (submit_upstream_work(work, ce->curl, ent->resubmit))
+		goto out_free;
+
+	if (opt_lowmem) {
+		applog(LOG_NOTICE, "Pool %d share being discarded to minimise memory cache", pool->pool_no);
+		goto out_free;
+	}
+	ent->resubmit = true;
+	if (stale_work(work, true)) {
+		applog(LOG_NOTICE, "Pool %d share became stale while retrying submit, discarding", pool->pool_no);
+
+		stats_add_share(pool, NULL, SHARE_STALE, work->work_difficulty);
+		goto out_free;
+	}
+
+	applog(LOG_INFO, "json_rpc_call failed on submit_work, retrying");
+	mutex_lock(&submit_lock);
+	__submit_add(ent);
+	mutex_unlock(&submit_lock);
+	return false;
+
+out_free:
+	free_work(work);
+	free(ent);
+	return true;
+}
+
+static void *submit_work_thread(void __maybe_unused *userdata)
+{
+	struct submit_ent *ent;
 	struct curl_ent *ce;
+	struct pool *pool;
 
 	pthread_detach(pthread_self());
 
 	RenameThread("SubmitWork");
 
-	applog(LOG_DEBUG, "Creating extra submit work thread");
-
-	ce = pop_curl_entry(pool);
-	/* submit solution to bitcoin via JSON-RPC */
-	while (!submit_upstream_work(work, ce->curl, resubmit)) {
-		if (opt_lowmem) {
-			applog(LOG_NOTICE, "Pool %d share being discarded to minimise memory cache", pool->pool_no);
-			break;
+	while (42) {
+		mutex_lock(&submit_lock);
+		while (!(ent = __submit_take(NULL)))
+			pthread_cond_wait(&submit_cond, &submit_lock);
+		mutex_unlock(&submit_lock);
+
+		/* Shares of the same pool queued meanwhile go out one after
+		 * the other on the same kept alive connection */
+		pool = ent->work->pool;
+		ce = pop_curl_entry(pool);
+		while (submit_one(ent, ce)) {
+			mutex_lock(&submit_lock);
+			ent = __submit_take(pool);
+			mutex_unlock(&submit_lock);
+			if (!ent)
+				break;
 		}
-		resubmit = true;
-		if (stale_work(work, true)) {
-			applog(LOG_NOTICE, "Pool %d share became stale while retrying submit, discarding", pool->pool_no);
+		push_curl_entry(ce, pool);
+	}
 
-			mutex_lock(&stats_lock);
-			total_stale++;
-			pool->stale_shares++;
-			total_diff_stale += work->work_difficulty;
-			pool->diff_stale += work->work_difficulty;
-			mutex_unlock(&stats_lock);
+	return NULL;
+}
 
-			free_work(work);
-			break;
-		}
+static void start_submit_threads(void)
+{
+	pthread_t submit_thread;
+	int i;
 
-		/* pause, then restart work-request loop */
-		applog(LOG_INFO, "json_rpc_call failed on submit_work, retrying");
-	}
-	push_curl_entry(ce, pool);
+	mutex_init(&submit_lock);
+	if (unlikely(pthread_cond_init(&submit_cond, NULL)))
+		early_quit(1, "Failed to pthread_cond_init submit_cond");
 
-	return NULL;
+	for (i = 0; i < opt_submit_threads; i++) {
+		if (unlikely(pthread_create(&submit_thread, NULL, submit_work_thread, NULL)))
+			early_quit(1, "submit thread create failed");
+	}
 }
 
 struct work *make_clone(struct work *work)
@@ -3998,14 +4699,15 @@ static void _stage_work(struct work *work);
 
 static bool clone_available(void)
 {
-	struct work *work_clone = NULL, *work, *tmp;
+	struct work *work_clone = NULL, *work;
 	bool cloned = false;
 
-	mutex_lock(stgd_lock);
+	stgd_lock_take();
 	if (!staged_rollable)
 		goto out_unlock;
 
-	HASH_ITER(hh, staged_work, work, tmp) {
+	/* Only work_rollable() work can roll */
+	list_for_each_entry(work, &staged_rolling, staged) {
 		if (can_roll(work) && should_roll(work)) {
 			roll_work(work);
 			work_clone = make_clone(work);
@@ -4016,7 +4718,7 @@ static bool clone_available(void)
 	}
 
 out_unlock:
-	mutex_unlock(stgd_lock);
+	stgd_lock_release();
 
 	if (cloned) {
 		applog(LOG_DEBUG, "Pushing cloned available work to stage thread");
@@ -4061,29 +4763,20 @@ static struct work *clone_work(struct work *work)
 }
 
 #else /* HAVE_LIBCURL */
-static void *submit_work_thread(void __maybe_unused *userdata)
+static void queue_submit_work(struct work *work)
 {
-	pthread_detach(pthread_self());
-	return NULL;
+	free_work(work);
 }
-#endif /* HAVE_LIBCURL */
 
-/* Return an adjusted ntime if we're submitting work that a device has
- * internally offset the ntime. */
-static char *offset_ntime(const char *ntime, int noffset)
+static void start_submit_threads(void)
 {
-	unsigned char bin[4];
-	uint32_t h32, *be32 = (uint32_t *)bin;
-
-	hex2bin(bin, ntime, 4);
-	h32 = be32toh(*be32) + noffset;
-	*be32 = htobe32(h32);
-
-	return bin2hex(bin, 4);
 }
+#endif /* HAVE_LIBCURL */
 
-/* Duplicates any dynamically allocated arrays within the work struct to
- * prevent a copied work struct from freeing ram belonging to another struct */
+/* Return an adjusted ntime if we're submitting work that a device has
+ * internally offset the ntime. */
+/* Takes references to any dynamically allocated arrays within the work struct
+ * so a copied work struct doesn't free ram another struct still uses */
 static void _copy_work(struct work *work, const struct work *base_work, int noffset)
 {
 	uint32_t id = work->id;
@@ -4093,10 +4786,8 @@ static void _copy_work(struct work *work, const struct work *base_work, int noff
 	/* Keep the unique new id assigned during make_work to prevent copied
 	 * work from having the same id. */
 	work->id = id;
-	if (base_work->job_id)
-		work->job_id = strdup(base_work->job_id);
-	if (base_work->nonce1)
-		work->nonce1 = strdup(base_work->nonce1);
+	work->job_id = refstr_get(base_work->job_id);
+	work->nonce1 = refstr_get(base_work->nonce1);
 	if (base_work->ntime) {
 		/* If we are passed an noffset the binary work->data ntime and
 		 * the work->ntime hex string need to be adjusted. */
@@ -4108,7 +4799,7 @@ static void _copy_work(struct work *work, const struct work *base_work, int noff
 			*work_ntime = htobe32(ntime);
 			work->ntime = offset_ntime(base_work->ntime, noffset);
 		} else
-			work->ntime = strdup(base_work->ntime);
+			work->ntime = refstr_get(base_work->ntime);
 	} else if (noffset) {
 		uint32_t *work_ntime = (uint32_t *)(work->data + 68);
 		uint32_t ntime = be32toh(*work_ntime);
@@ -4116,8 +4807,7 @@ static void _copy_work(struct work *work, const struct work *base_work, int noff
 		ntime += noffset;
 		*work_ntime = htobe32(ntime);
 	}
-	if (base_work->coinbase)
-		work->coinbase = strdup(base_work->coinbase);
+	work->coinbase = refstr_get(base_work->coinbase);
 }
 
 void set_work_ntime(struct work *work, int ntime)
@@ -4126,8 +4816,8 @@ void set_work_ntime(struct work *work, int ntime)
 
 	*work_ntime = htobe32(ntime);
 	if (work->ntime) {
-		free(work->ntime);
-		work->ntime = bin2hex((unsigned char *)work_ntime, 4);
+		refstr_put(work->ntime);
+		work->ntime = refstr_bin2hex((unsigned char *)work_ntime, 4);
 	}
 }
 
@@ -4258,11 +4948,9 @@ static void regen_hash(struct work *work)
 	uint32_t *data32 = (uint32_t *)(work->data);
 	unsigned char swap[80];
 	uint32_t *swap32 = (uint32_t *)swap;
-	unsigned char hash1[32];
 
 	flip80(swap32, data32);
-	sha256(swap, 80, hash1);
-	sha256(hash1, 32, (unsigned char *)(work->hash));
+	sha256d(swap, 80, (unsigned char *)(work->hash));
 }
 
 static bool cnx_needed(struct pool *pool);
@@ -4396,26 +5084,38 @@ void _discard_work(struct work *work)
 
 static void wake_gws(void)
 {
-	mutex_lock(stgd_lock);
+	stgd_lock_take();
 	pthread_cond_signal(&gws_cond);
-	mutex_unlock(stgd_lock);
+	stgd_lock_release();
 }
 
-static void discard_stale(void)
+static void __staged_del(struct work *work);
+
+static int __discard_stale(struct list_head *head)
 {
 	struct work *work, *tmp;
 	int stale = 0;
 
-	mutex_lock(stgd_lock);
-	HASH_ITER(hh, staged_work, work, tmp) {
+	list_for_each_entry_safe(work, tmp, head, staged) {
 		if (stale_work(work, false)) {
-			HASH_DEL(staged_work, work);
+			__staged_del(work);
 			discard_work(work);
 			stale++;
 		}
 	}
+
+	return stale;
+}
+
+static void discard_stale(void)
+{
+	int stale;
+
+	stgd_lock_take();
+	stale = __discard_stale(&staged_fixed);
+	stale += __discard_stale(&staged_rolling);
 	pthread_cond_signal(&gws_cond);
-	mutex_unlock(stgd_lock);
+	stgd_lock_release();
 
 	if (stale)
 		applog(LOG_DEBUG, "Discarded %d stales that didn't match current hash", stale);
@@ -4694,30 +5394,51 @@ out:
 	return ret;
 }
 
-static int tv_sort(struct work *worka, struct work *workb)
+static bool work_rollable(struct work *work)
 {
-	return worka->tv_staged.tv_sec - workb->tv_staged.tv_sec;
+	return (!work->clone && work->rolltime);
 }
 
-static bool work_rollable(struct work *work)
+/* Work is staged as it arrives, so it nearly always goes at the tail. Clones
+ * are made a second older and end up a few places from it. Equal times keep
+ * the order they were staged in. */
+static void __staged_add(struct work *work)
 {
-	return (!work->clone && work->rolltime);
+	struct list_head *head, *pos;
+
+	if (work_rollable(work)) {
+		head = &staged_rolling;
+		staged_rollable++;
+	} else
+		head = &staged_fixed;
+
+	for (pos = head->prev; pos != head; pos = pos->prev) {
+		if (list_entry(pos, struct work, staged)->tv_staged.tv_sec <= work->tv_staged.tv_sec)
+			break;
+	}
+	list_add(&work->staged, pos);
+	staged_count++;
+}
+
+static void __staged_del(struct work *work)
+{
+	list_del(&work->staged);
+	if (work_rollable(work))
+		staged_rollable--;
+	staged_count--;
 }
 
 static bool hash_push(struct work *work)
 {
 	bool rc = true;
 
-	mutex_lock(stgd_lock);
-	if (work_rollable(work))
-		staged_rollable++;
-	if (likely(!getq->frozen)) {
-		HASH_ADD_INT(staged_work, id, work);
-		HASH_SORT(staged_work, tv_sort);
-	} else
+	stgd_lock_take();
+	if (likely(!getq->frozen))
+		__staged_add(work);
+	else
 		rc = false;
 	pthread_cond_broadcast(&getq->cond);
-	mutex_unlock(stgd_lock);
+	stgd_lock_release();
 
 	return rc;
 }
@@ -4731,6 +5452,29 @@ static void _stage_work(struct work *work)
 	hash_push(work);
 }
 
+/* Stages n works of the same job from one pool under a single hold of the
+ * stgd_lock. They share their block, so only the first is tested for it. */
+static void stage_work_batch(struct work **works, int n)
+{
+	struct pool *pool = works[0]->pool;
+	int i;
+
+	applog(LOG_DEBUG, "Pushing %d works from pool %d to hash queue", n, pool->pool_no);
+	works[0]->work_block = work_block;
+	test_work_current(works[0]);
+	for (i = 1; i < n; i++)
+		works[i]->work_block = works[0]->work_block;
+	pool->works += n;
+
+	stgd_lock_take();
+	if (likely(!getq->frozen)) {
+		for (i = 0; i < n; i++)
+			__staged_add(works[i]);
+	}
+	pthread_cond_broadcast(&getq->cond);
+	stgd_lock_release();
+}
+
 #ifdef HAVE_CURSES
 int curses_int(const char *query)
 {
@@ -4967,6 +5711,9 @@ void zero_stats(void)
 {
 	int i;
 
+	/* The share counts, the rest is zeroed here */
+	stats_zero();
+
 	cgtime(&total_tv_start);
 	copy_time(&tv_hashmeter, &total_tv_start);
 	total_rolling = 0;
@@ -4975,37 +5722,28 @@ void zero_stats(void)
 	rolling15 = 0;
 	total_mhashes_done = 0;
 	total_getworks = 0;
-	total_accepted = 0;
-	total_rejected = 0;
-	hw_errors = 0;
-	total_stale = 0;
 	total_discarded = 0;
 	local_work = 0;
 	total_go = 0;
 	total_ro = 0;
 	total_secs = 1.0;
-	total_diff1 = 0;
 	found_blocks = 0;
-	total_diff_accepted = 0;
-	total_diff_rejected = 0;
-	total_diff_stale = 0;
+	stgd_lock_zero();
+	gen_batch_zero();
 
 	for (i = 0; i < total_pools; i++) {
 		struct pool *pool = pools[i];
 
 		pool->getwork_requested = 0;
-		pool->accepted = 0;
-		pool->rejected = 0;
-		pool->stale_shares = 0;
 		pool->discarded_work = 0;
 		pool->getfail_occasions = 0;
 		pool->remotefail_occasions = 0;
 		pool->last_share_time = 0;
-		pool->diff1 = 0;
-		pool->diff_accepted = 0;
-		pool->diff_rejected = 0;
-		pool->diff_stale = 0;
 		pool->last_share_diff = 0;
+		pool->submit_latencies = 0;
+		mutex_lock(&pool->sshare_lock);
+		memset(pool->sshare_rtt, 0, sizeof(pool->sshare_rtt));
+		mutex_unlock(&pool->sshare_lock);
 	}
 
 	zero_bestshare();
@@ -5017,14 +5755,8 @@ void zero_stats(void)
 
 		mutex_lock(&hash_lock);
 		cgpu->total_mhashes = 0;
-		cgpu->accepted = 0;
-		cgpu->rejected = 0;
-		cgpu->hw_errors = 0;
 		cgpu->utility = 0.0;
 		cgpu->last_share_pool_time = 0;
-		cgpu->diff1 = 0;
-		cgpu->diff_accepted = 0;
-		cgpu->diff_rejected = 0;
 		cgpu->last_share_diff = 0;
 		mutex_unlock(&hash_lock);
 
@@ -5735,6 +6467,8 @@ static void hashmeter(int thr_id, uint64_t hashes_done)
 		return;
 	}
 	copy_time(&tv_hashmeter, &total_tv_end);
+	if (showlog)
+		stats_fold();
 
 	if (thr_id >= 0) {
 		struct thr_info *thr = get_thread(thr_id);
@@ -5827,6 +6561,28 @@ static void hashmeter(int thr_id, uint64_t hashes_done)
 	}
 }
 
+/* Counts the response round trip of a share, under pool->sshare_lock */
+static void __record_share_rtt(struct pool *pool, struct stratum_share *sshare)
+{
+	struct timeval now;
+	int rtt, i;
+
+	cgtime(&now);
+	rtt = ms_tdiff(&now, &sshare->tv_sent);
+	for (i = 0; i < SSHARE_RTT_BUCKETS - 1; i++) {
+		if (rtt < sshare_rtt_bounds[i])
+			break;
+	}
+	pool->sshare_rtt[i]++;
+}
+
+void pool_share_rtt(struct pool *pool, uint64_t *rtt)
+{
+	mutex_lock(&pool->sshare_lock);
+	memcpy(rtt, pool->sshare_rtt, sizeof(pool->sshare_rtt));
+	mutex_unlock(&pool->sshare_lock);
+}
+
 static void stratum_share_result(json_t *val, json_t *res_val, json_t *err_val,
 				 struct stratum_share *sshare)
 {
@@ -5881,13 +6637,15 @@ static bool parse_stratum_response(struct pool *pool, char *s)
 
 	id = json_integer_value(id_val);
 
-	mutex_lock(&sshare_lock);
-	HASH_FIND_INT(stratum_shares, &id, sshare);
+	mutex_lock(&pool->sshare_lock);
+	HASH_FIND_INT(pool->stratum_shares, &id, sshare);
 	if (sshare) {
-		HASH_DEL(stratum_shares, sshare);
+		HASH_DEL(pool->stratum_shares, sshare);
+		list_del(&sshare->wheel);
 		pool->sshares--;
+		__record_share_rtt(pool, sshare);
 	}
-	mutex_unlock(&sshare_lock);
+	mutex_unlock(&pool->sshare_lock);
 
 	if (!sshare) {
 		double pool_diff;
@@ -5903,21 +6661,11 @@ static bool parse_stratum_response(struct pool *pool, char *s)
 
 			/* We don't know what device this came from so we can't
 			 * attribute the work to the relevant cgpu */
-			mutex_lock(&stats_lock);
-			total_accepted++;
-			pool->accepted++;
-			total_diff_accepted += pool_diff;
-			pool->diff_accepted += pool_diff;
-			mutex_unlock(&stats_lock);
+			stats_add_share(pool, NULL, SHARE_ACCEPTED, pool_diff);
 		} else {
 			applog(LOG_NOTICE, "Rejected untracked stratum share from pool %d", pool->pool_no);
 
-			mutex_lock(&stats_lock);
-			total_rejected++;
-			pool->rejected++;
-			total_diff_rejected += pool_diff;
-			pool->diff_rejected += pool_diff;
-			mutex_unlock(&stats_lock);
+			stats_add_share(pool, NULL, SHARE_REJECTED, pool_diff);
 		}
 		goto out;
 	}
@@ -5939,42 +6687,42 @@ void clear_stratum_shares(struct pool *pool)
 	double diff_cleared = 0;
 	int cleared = 0;
 
-	mutex_lock(&sshare_lock);
-	HASH_ITER(hh, stratum_shares, sshare, tmpshare) {
-		if (sshare->work->pool == pool) {
-			HASH_DEL(stratum_shares, sshare);
-			diff_cleared += sshare->work->work_difficulty;
-			free_work(sshare->work);
-			pool->sshares--;
-			free(sshare);
-			cleared++;
-		}
+	mutex_lock(&pool->sshare_lock);
+	HASH_ITER(hh, pool->stratum_shares, sshare, tmpshare) {
+		HASH_DEL(pool->stratum_shares, sshare);
+		list_del(&sshare->wheel);
+		diff_cleared += sshare->work->work_difficulty;
+		free_work(sshare->work);
+		pool->sshares--;
+		free(sshare);
+		cleared++;
 	}
-	mutex_unlock(&sshare_lock);
+	mutex_unlock(&pool->sshare_lock);
 
 	if (cleared) {
 		applog(LOG_WARNING, "Lost %d shares due to stratum disconnect on pool %d", cleared, pool->pool_no);
-		pool->stale_shares += cleared;
-		total_stale += cleared;
-		pool->diff_stale += diff_cleared;
-		total_diff_stale += diff_cleared;
+		stats_add_stale(pool, cleared, diff_cleared);
 	}
 }
 
 void clear_pool_work(struct pool *pool)
 {
+	struct list_head *heads[] = { &staged_fixed, &staged_rolling };
 	struct work *work, *tmp;
 	int cleared = 0;
+	unsigned int i;
 
-	mutex_lock(stgd_lock);
-	HASH_ITER(hh, staged_work, work, tmp) {
-		if (work->pool == pool) {
-			HASH_DEL(staged_work, work);
-			free_work(work);
-			cleared++;
+	stgd_lock_take();
+	for (i = 0; i < ARRAY_SIZE(heads); i++) {
+		list_for_each_entry_safe(work, tmp, heads[i], staged) {
+			if (work->pool == pool) {
+				__staged_del(work);
+				free_work(work);
+				cleared++;
+			}
 		}
 	}
-	mutex_unlock(stgd_lock);
+	stgd_lock_release();
 
 	if (cleared)
 		applog(LOG_INFO, "Cleared %d work items due to stratum disconnect on pool %d", cleared, pool->pool_no);
@@ -6148,7 +6896,19 @@ static void *stratum_rthread(void *userdata)
 
 		if (!parse_method(pool, s) && !parse_stratum_response(pool, s))
 			applog(LOG_INFO, "Unknown stratum msg: %s", s);
-		else if (pool->swork.clean) {
+		else if (unlikely(pool->stratum_reconnect)) {
+			/* Only now that s, which lives in the sockbuf the
+			 * reconnect clears, is done with */
+			if (!restart_stratum(pool)) {
+				pool_died(pool);
+				while (!restart_stratum(pool)) {
+					if (pool->removed)
+						goto out;
+					cgsleep_ms(30000);
+				}
+				stratum_resumed(pool);
+			}
+		} else if (pool->swork.clean) {
 			struct work *work = make_work();
 
 			/* Generate a single work item to update the current
@@ -6161,20 +6921,112 @@ static void *stratum_rthread(void *userdata)
 			test_work_current(work);
 			free_work(work);
 		}
-		free(s);
 	}
 
 out:
 	return NULL;
 }
 
+static void track_stratum_share(struct pool *pool, struct stratum_share *sshare)
+{
+	mutex_lock(&pool->sshare_lock);
+	HASH_ADD_INT(pool->stratum_shares, id, sshare);
+	list_add_tail(&sshare->wheel, &pool->sshare_wheel[sshare->sshare_time & (SSHARE_WHEEL - 1)]);
+	pool->sshares++;
+	mutex_unlock(&pool->sshare_lock);
+}
+
+/* Takes back a share that failed to send, returns false if it was no longer
+ * tracked, in which case it has been freed */
+static bool untrack_stratum_share(struct pool *pool, int id)
+{
+	struct stratum_share *sshare;
+
+	mutex_lock(&pool->sshare_lock);
+	HASH_FIND_INT(pool->stratum_shares, &id, sshare);
+	if (sshare) {
+		HASH_DEL(pool->stratum_shares, sshare);
+		list_del(&sshare->wheel);
+		pool->sshares--;
+	}
+	mutex_unlock(&pool->sshare_lock);
+
+	return sshare != NULL;
+}
+
+static void discard_stratum_share(struct pool *pool, struct stratum_share *sshare)
+{
+	applog(LOG_DEBUG, "Failed to submit stratum share, discarding");
+	free_work(sshare->work);
+	free(sshare);
+	stats_add_stale(pool, 1, 0);
+}
+
+/* Most shares written out to a pool at once */
+#define SSHARE_BATCH 64
+
+/* The start of the mining.submit lines of a job, up to the nonce2, which is
+ * only put together again when the job changes */
+struct submit_head {
+	char *job_id; /* a refstr held while it's the job */
+	char *s;
+	size_t len;
+};
+
+static void submit_head(struct pool *pool, struct submit_head *head, char *job_id)
+{
+	size_t size;
+
+	if (head->job_id == job_id)
+		return;
+	refstr_put(head->job_id);
+	head->job_id = refstr_get(job_id);
+
+	size = strlen(pool->rpc_user) + strlen(job_id) + 24;
+	head->s = realloc(head->s, size);
+	if (unlikely(!head->s))
+		quithere(1, "Failed to realloc submit head");
+	head->len = snprintf(head->s, size, "{\"params\": [\"%s\", \"%s\", \"", pool->rpc_user, job_id);
+}
+
+/* Room a mining.submit line needs past its head */
+#define SUBMIT_TAIL_LEN 128
+
+/* Serialises the mining.submit line of a share to p, returning its length */
+static size_t put_submit(char *p, const struct submit_head *head, struct work *work, int id)
+{
+	unsigned char nonce2[8];
+	uint64_t nonce2_64;
+	uint32_t nonce;
+	char *start = p;
+
+	memcpy(p, head->s, head->len);
+	p += head->len;
+
+	nonce2_64 = htole64(work->nonce2);
+	memcpy(nonce2, &nonce2_64, 8);
+	__bin2hex(p, nonce2, work->nonce2_len);
+	p += work->nonce2_len * 2;
+
+	nonce = *((uint32_t *)(work->data + 76));
+	p += sprintf(p, "\", \"%s\", \"", work->ntime);
+	__bin2hex(p, (const unsigned char *)&nonce, 4);
+	p += 8;
+	p += sprintf(p, "\"], \"id\": %d, \"method\": \"mining.submit\"}\n", id);
+
+	return p - start;
+}
+
 /* Each pool has one stratum send thread for sending shares to avoid many
  * threads being created for submission since all sends need to be serialised
- * anyway. */
+ * anyway. Whatever has queued up by the time it's woken is written out in
+ * one go. */
 static void *stratum_sthread(void *userdata)
 {
 	struct pool *pool = (struct pool *)userdata;
-	char threadname[16];
+	struct submit_head head = {NULL, NULL, 0};
+	size_t bufsize = 0;
+	char threadname[16], *buf = NULL;
 
 	pthread_detach(pthread_self());
 
@@ -6186,75 +7038,121 @@ static void *stratum_sthread(void *userdata)
 		quit(1, "Failed to create stratum_q in stratum_sthread");
 
 	while (42) {
-		char noncehex[12], nonce2hex[20], s[1024];
-		struct stratum_share *sshare;
-		uint32_t *hash32, nonce;
-		unsigned char nonce2[8];
-		uint64_t *nonce2_64;
-		struct work *work;
-		bool submitted;
+		struct stratum_share *sshares[SSHARE_BATCH];
+		struct work *works[SSHARE_BATCH];
+		time_t work_times[SSHARE_BATCH];
+		int ids[SSHARE_BATCH];
+		int i, j, n, pending;
 
 		if (unlikely(pool->removed))
 			break;
 
-		work = tq_pop(pool->stratum_q, NULL);
-		if (unlikely(!work))
+		n = tq_pop_batch(pool->stratum_q, (void **)works, SSHARE_BATCH, NULL);
+		if (unlikely(!n))
 			quit(1, "Stratum q returned empty work");
 
-		if (unlikely(work->nonce2_len > 8)) {
-			applog(LOG_ERR, "Pool %d asking for inappropriately long nonce2 length %d",
-			       pool->pool_no, (int)work->nonce2_len);
-			applog(LOG_ERR, "Not attempting to submit shares");
-			free_work(work);
-			continue;
-		}
+		for (i = pending = 0; i < n; i++) {
+			struct work *work = works[i];
+			struct stratum_share *sshare;
+			uint32_t *hash32;
 
-		sshare = calloc(sizeof(struct stratum_share), 1);
-		hash32 = (uint32_t *)work->hash;
-		submitted = false;
+			if (unlikely(work->nonce2_len > 8)) {
+				applog(LOG_ERR, "Pool %d asking for inappropriately long nonce2 length %d",
+				       pool->pool_no, (int)work->nonce2_len);
+				applog(LOG_ERR, "Not attempting to submit shares");
+				free_work(work);
+				continue;
+			}
+
+			sshare = calloc(sizeof(struct stratum_share), 1);
+			if (unlikely(!sshare))
+				quithere(1, "Failed to calloc stratum share");
+			sshare->sshare_time = work_times[pending] = time(NULL);
+			/* This work item is freed in parse_stratum_response */
+			sshare->work = work;
+			sshares[pending++] = sshare;
 
-		sshare->sshare_time = time(NULL);
-		/* This work item is freed in parse_stratum_response */
-		sshare->work = work;
-		nonce = *((uint32_t *)(work->data + 76));
-		__bin2hex(noncehex, (const unsigned char *)&nonce, 4);
-		memset(s, 0, 1024);
+			hash32 = (uint32_t *)work->hash;
+			applog(LOG_INFO, "Submitting share %08lx to pool %d",
+						(long unsigned int)htole32(hash32[6]), pool->pool_no);
+		}
+		if (unlikely(!pending))
+			continue;
 
 		mutex_lock(&sshare_lock);
-		/* Give the stratum share a unique id */
-		sshare->id = swork_id++;
+		/* Give the stratum shares unique ids */
+		for (i = 0; i < pending; i++)
+			sshares[i]->id = ids[i] = swork_id++;
 		mutex_unlock(&sshare_lock);
 
-		nonce2_64 = (uint64_t *)nonce2;
-		*nonce2_64 = htole64(work->nonce2);
-		__bin2hex(nonce2hex, nonce2, work->nonce2_len);
-
-		snprintf(s, sizeof(s),
-			"{\"params\": [\"%s\", \"%s\", \"%s\", \"%s\", \"%s\"], \"id\": %d, \"method\": \"mining.submit\"}",
-			pool->rpc_user, work->job_id, nonce2hex, work->ntime, noncehex, sshare->id);
-
-		applog(LOG_INFO, "Submitting share %08lx to pool %d",
-					(long unsigned int)htole32(hash32[6]), pool->pool_no);
-
 		/* Try resubmitting for up to 2 minutes if we fail to submit
 		 * once and the stratum pool nonce1 still matches suggesting
 		 * we may be able to resume. */
-		while (time(NULL) < sshare->sshare_time + 120) {
-			bool sessionid_match;
+		while (pending) {
+			struct timeval tv_sent;
+			time_t sent_time;
+			double wait_ms = 0;
+			size_t len = 0;
+
+			sent_time = time(NULL);
+			cgtime(&tv_sent);
+			for (i = 0; i < pending; i++) {
+				struct stratum_share *sshare = sshares[i];
+				struct work *work = sshare->work;
+
+				size_t room;
+
+				submit_head(pool, &head, work->job_id);
+				room = head.len + strlen(work->ntime) + SUBMIT_TAIL_LEN;
+				if (len + room > bufsize) {
+					bufsize = len + room * (pending - i);
+					buf = realloc(buf, bufsize);
+					if (unlikely(!buf))
+						quithere(1, "Failed to realloc stratum submit buffer");
+				}
+				len += put_submit(buf + len, &head, work, sshare->id);
+				wait_ms += us_tdiff(&tv_sent, &work->tv_work_found) / 1000;
+			}
+
+			/* Track the shares before sending them since their
+			 * responses can be read before the send returns */
+			for (i = 0; i < pending; i++) {
+				sshares[i]->sshare_sent = sent_time;
+				sshares[i]->tv_sent = tv_sent;
+				track_stratum_share(pool, sshares[i]);
+			}
 
-			if (likely(stratum_send(pool, s, strlen(s)))) {
+			if (likely(stratum_send_shares(pool, buf, len, pending))) {
 				if (pool_tclear(pool, &pool->submit_fail))
 						applog(LOG_WARNING, "Pool %d communication resumed, submitting work", pool->pool_no);
 
-				mutex_lock(&sshare_lock);
-				HASH_ADD_INT(stratum_shares, id, sshare);
-				pool->sshares++;
-				mutex_unlock(&sshare_lock);
+				applog(LOG_DEBUG, "Successfully submitted %d, added to stratum_shares db", pending);
+				pool->cgminer_pool_stats.share_wait_ms += wait_ms;
+				for (i = 0; i < pending; i++) {
+					int ssdiff = sent_time - work_times[i];
 
-				applog(LOG_DEBUG, "Successfully submitted, adding to stratum_shares db");
-				submitted = true;
+					if (opt_debug || ssdiff > 0) {
+						applog(LOG_INFO, "Pool %d stratum share submission lag time %d seconds",
+						       pool->pool_no, ssdiff);
+					}
+				}
+				pending = 0;
 				break;
 			}
+
+			/* Those that are gone have been answered regardless, or
+			 * been cleared by a disconnect and counted as stale */
+			for (i = j = 0; i < pending; i++) {
+				if (untrack_stratum_share(pool, ids[i])) {
+					sshares[j] = sshares[i];
+					work_times[j] = work_times[i];
+					ids[j++] = ids[i];
+				}
+			}
+			pending = j;
+			if (!pending)
+				break;
+
 			if (!pool_tset(pool, &pool->submit_fail) && cnx_needed(pool)) {
 				applog(LOG_WARNING, "Pool %d stratum share submission failure", pool->pool_no);
 				total_ro++;
@@ -6266,40 +7164,43 @@ static void *stratum_sthread(void *userdata)
 				break;
 			}
 
-			cg_rlock(&pool->data_lock);
-			sessionid_match = (pool->nonce1 && !strcmp(work->nonce1, pool->nonce1));
-			cg_runlock(&pool->data_lock);
-
-			if (!sessionid_match) {
-				applog(LOG_DEBUG, "No matching session id for resubmitting stratum share");
-				break;
+			/* Only keep those that can still be resumed by the
+			 * time of the next try, every 5 seconds */
+			for (i = j = 0; i < pending; i++) {
+				struct stratum_share *sshare = sshares[i];
+				bool sessionid_match;
+
+				cg_rlock(&pool->data_lock);
+				sessionid_match = (pool->nonce1 && !strcmp(sshare->work->nonce1, pool->nonce1));
+				cg_runlock(&pool->data_lock);
+
+				if (!sessionid_match)
+					applog(LOG_DEBUG, "No matching session id for resubmitting stratum share");
+				else if (time(NULL) + 5 < work_times[i] + SSHARE_TIMEOUT) {
+					sshares[j] = sshares[i];
+					work_times[j] = work_times[i];
+					ids[j++] = ids[i];
+					continue;
+				}
+				discard_stratum_share(pool, sshare);
 			}
-			/* Retry every 5 seconds */
-			sleep(5);
+			pending = j;
+			if (pending)
+				sleep(5);
 		}
 
-		if (unlikely(!submitted)) {
-			applog(LOG_DEBUG, "Failed to submit stratum share, discarding");
-			free_work(work);
-			free(sshare);
-			pool->stale_shares++;
-			total_stale++;
-		} else {
-			int ssdiff;
-
-			sshare->sshare_sent = time(NULL);
-			ssdiff = sshare->sshare_sent - sshare->sshare_time;
-			if (opt_debug || ssdiff > 0) {
-				applog(LOG_INFO, "Pool %d stratum share submission lag time %d seconds",
-				       pool->pool_no, ssdiff);
-			}
-		}
+		for (i = 0; i < pending; i++)
+			discard_stratum_share(pool, sshares[i]);
 	}
 
 	/* Freeze the work queue but don't free up its memory in case there is
 	 * work still trying to be submitted to the removed pool. */
 	tq_freeze(pool->stratum_q);
 
+	refstr_put(head.job_id);
+	free(head.s);
+	free(buf);
+
 	return NULL;
 }
 
@@ -6424,7 +7325,7 @@ retry_stratum:
 		bool init = pool_tset(pool, &pool->stratum_init);
 
 		if (!init) {
-			bool ret = initiate_stratum(pool) && auth_stratum(pool);
+			bool ret = restart_stratum(pool);
 
 			if (ret)
 				init_stratum_threads(pool);
@@ -6613,11 +7514,10 @@ static bool work_emptied;
  * be handled. */
 static struct work *hash_pop(bool blocking)
 {
-	struct work *work = NULL, *tmp;
-	int hc;
+	struct work *work = NULL;
 
-	mutex_lock(stgd_lock);
-	if (!HASH_COUNT(staged_work)) {
+	stgd_lock_take();
+	if (!staged_count) {
 		/* Increase the queue if we reach zero and we know we can reach
 		 * the maximum we're asking for. */
 		if (work_filled && max_queue < opt_queue) {
@@ -6636,7 +7536,7 @@ static struct work *hash_pop(bool blocking)
 			then.tv_sec = now.tv_sec + 10;
 			then.tv_nsec = now.tv_usec * 1000;
 			pthread_cond_signal(&gws_cond);
-			rc = pthread_cond_timedwait(&getq->cond, stgd_lock, &then);
+			rc = stgd_cond_timedwait(&getq->cond, &then);
 			/* Check again for !no_work as multiple threads may be
 				* waiting on this condition and another may set the
 				* bool separately. */
@@ -6644,7 +7544,7 @@ static struct work *hash_pop(bool blocking)
 				no_work = true;
 				applog(LOG_WARNING, "Waiting for work to be available from pools.");
 			}
-		} while (!HASH_COUNT(staged_work));
+		} while (!staged_count);
 	}
 
 	if (no_work) {
@@ -6652,18 +7552,12 @@ static struct work *hash_pop(bool blocking)
 		no_work = false;
 	}
 
-	hc = HASH_COUNT(staged_work);
-	/* Find clone work if possible, to allow masters to be reused */
-	if (hc > staged_rollable) {
-		HASH_ITER(hh, staged_work, work, tmp) {
-			if (!work_rollable(work))
-				break;
-		}
-	} else
-		work = staged_work;
-	HASH_DEL(staged_work, work);
-	if (work_rollable(work))
-		staged_rollable--;
+	/* Take clone work if possible, to allow masters to be reused */
+	if (!list_empty(&staged_fixed))
+		work = list_entry(staged_fixed.next, struct work, staged);
+	else
+		work = list_entry(staged_rolling.next, struct work, staged);
+	__staged_del(work);
 
 	/* Signal the getwork scheduler to look for more work */
 	pthread_cond_signal(&gws_cond);
@@ -6674,17 +7568,14 @@ static struct work *hash_pop(bool blocking)
 	/* Keep track of last getwork grabbed */
 	last_getwork = time(NULL);
 out_unlock:
-	mutex_unlock(stgd_lock);
+	stgd_lock_release();
 
 	return work;
 }
 
 static void gen_hash(unsigned char *data, unsigned char *hash, int len)
 {
-	unsigned char hash1[32];
-
-	sha256(data, len, hash1);
-	sha256(hash1, 32, hash);
+	sha256d(data, len, hash);
 }
 
 void set_target(unsigned char *dest_target, double diff)
@@ -6757,82 +7648,261 @@ void submit_nonce2_nonce(struct thr_info *thr, uint32_t pool_no, uint32_t nonce2
 }
 #endif
 
-/* Generates stratum based work based on the most recent notify information
- * from the pool. This will keep generating work while a pool is down so we use
- * other means to detect when the pool has died in stratum_thread */
-static void gen_stratum_work(struct pool *pool, struct work *work)
+/* A batch of stratum works being generated, handed out in slices to the
+ * getwork thread and the gen helper threads. What they read off the pool is
+ * protected by the read lock the generating thread holds throughout. */
+struct gen_batch {
+	struct pool *pool;
+	struct work **works;
+	unsigned char (*roots)[32];
+	uint64_t nonce2;
+	int n, slice, slices;
+	/* Slices handed out and finished, under gen_lock */
+	int next, done;
+};
+
+static pthread_mutex_t gen_lock;
+static pthread_cond_t gen_cond, gen_done_cond;
+static struct gen_batch *gen_current;
+
+/* Generation stats for the API, under gen_lock */
+static uint64_t gen_batches, gen_works, gen_discarded;
+static int gen_batch_max;
+static double gen_us;
+
+void gen_batch_stats(uint64_t *batches, double *avg, int *max, uint64_t *discarded,
+		     double *rate)
 {
-	unsigned char merkle_root[32], merkle_sha[64];
-	uint32_t *data32, *swap32;
+	mutex_lock(&gen_lock);
+	*batches = gen_batches;
+	*avg = gen_batches ? (double)gen_works / gen_batches : 0;
+	*max = gen_batch_max;
+	*discarded = gen_discarded;
+	*rate = gen_us > 0 ? gen_works / gen_us * 1000000 : 0;
+	mutex_unlock(&gen_lock);
+}
+
+static void gen_batch_zero(void)
+{
+	mutex_lock(&gen_lock);
+	gen_batches = gen_works = gen_discarded = 0;
+	gen_batch_max = 0;
+	gen_us = 0;
+	mutex_unlock(&gen_lock);
+}
+
+/* Generates works start to start + n - 1 of the batch: a coinbase hash per
+ * nonce2 resumed from the coinbase midstate, the merkle roots folded for all
+ * of them at once, and the headers built around them. */
+static void gen_stratum_slice(struct gen_batch *batch, int start, int n)
+{
+	struct pool *pool = batch->pool;
+	int done = pool->coinbase_prefix_len, len = pool->coinbase_len - done;
+	unsigned char (*roots)[32] = batch->roots + start, *tail;
 	uint64_t nonce2le;
 	int i;
 
+	tail = malloc(len);
+	if (unlikely(!tail))
+		quit(1, "Failed to malloc tail in gen_stratum_slice");
+	memcpy(tail, pool->coinbase + done, len);
+
+	/* Always use an LE encoded nonce2 to fill in values from left to
+	 * right and prevent overflow errors with small n2sizes */
+	for (i = 0; i < n; i++) {
+		nonce2le = htole64(batch->nonce2 + start + i);
+		memcpy(tail + pool->nonce2_offset - done, &nonce2le, pool->n2size);
+		sha256d_resume(pool->coinbase_mid, done, tail, len, roots[i]);
+	}
+	free(tail);
+
+	fold_merkle(roots, n, pool->swork.merkle_bin, pool->merkles);
+
+	for (i = 0; i < n; i++) {
+		struct work *work = batch->works[start + i];
+
+		/* Copy the data template from header_bin */
+		memcpy(work->data, pool->header_bin, 112);
+		flip32(work->data + 36, roots[i]);
+		work->nonce2 = batch->nonce2 + start + i;
+		work->nonce2_len = pool->n2size;
+
+		/* Store the stratum work diff to check it still matches the
+		 * pool's stratum diff when submitting shares */
+		work->sdiff = pool->sdiff;
+
+		/* Copy parameters required for share submission */
+		work->job_id = refstr_get(pool->work_job_id);
+		work->nonce1 = refstr_get(pool->work_nonce1);
+		work->ntime = refstr_get(pool->work_ntime);
+
+		calc_midstate(work);
+		set_target(work->target, work->sdiff);
+	}
+}
+
+/* Generates slices of the batch until none are left to hand out. Must be
+ * called with gen_lock held. */
+static void __gen_slices(struct gen_batch *batch)
+{
+	int start;
+
+	while (batch->next < batch->slices) {
+		start = batch->next++ * batch->slice;
+		mutex_unlock(&gen_lock);
+		gen_stratum_slice(batch, start, MIN(batch->slice, batch->n - start));
+		mutex_lock(&gen_lock);
+		if (++batch->done == batch->slices)
+			pthread_cond_signal(&gen_done_cond);
+	}
+}
+
+static void *gen_thread(void __maybe_unused *userdata)
+{
+	pthread_detach(pthread_self());
+
+	RenameThread("GenWork");
+
+	mutex_lock(&gen_lock);
+	while (42) {
+		if (gen_current && gen_current->next < gen_current->slices)
+			__gen_slices(gen_current);
+		else
+			pthread_cond_wait(&gen_cond, &gen_lock);
+	}
+	mutex_unlock(&gen_lock);
+
+	return NULL;
+}
+
+/* Generates n stratum works based on the most recent notify information from
+ * the pool, with consecutive nonce2s. This will keep generating work while a
+ * pool is down so we use other means to detect when the pool has died in
+ * stratum_thread */
+static void gen_stratum_works(struct pool *pool, struct work **works, int n)
+{
+	unsigned char roots[GEN_BATCH_MAX][32];
+	struct gen_batch batch;
+	int i, lanes, threads;
+
+	batch.pool = pool;
+	batch.works = works;
+	batch.roots = roots;
+	batch.n = n;
+	batch.next = batch.done = 0;
+
 	cg_wlock(&pool->data_lock);
 
-	/* Update coinbase. Always use an LE encoded nonce2 to fill in values
-	 * from left to right and prevent overflow errors with small n2sizes */
-	nonce2le = htole64(pool->nonce2);
-	memcpy(pool->coinbase + pool->nonce2_offset, &nonce2le, pool->n2size);
-	work->nonce2 = pool->nonce2++;
-	work->nonce2_len = pool->n2size;
+	/* Take the nonce2s of the whole batch */
+	batch.nonce2 = pool->nonce2;
+	pool->nonce2 += n;
+
+	/* The strings and the coinbase midstate change once per job, not per
+	 * work */
+	intern_work_str(&pool->work_job_id, pool->swork.job_id);
+	intern_work_str(&pool->work_nonce1, pool->nonce1);
+	intern_work_str(&pool->work_ntime, pool->ntime);
+	__update_coinbase_mid(pool);
 
 	/* Downgrade to a read lock to read off the pool variables */
 	cg_dwlock(&pool->data_lock);
 
-	/* Generate merkle root */
-	gen_hash(pool->coinbase, merkle_root, pool->coinbase_len);
-	memcpy(merkle_sha, merkle_root, 32);
-	for (i = 0; i < pool->merkles; i++) {
-		memcpy(merkle_sha + 32, pool->swork.merkle_bin[i], 32);
-		gen_hash(merkle_sha, merkle_root, 64);
-		memcpy(merkle_sha, merkle_root, 32);
-	}
-	data32 = (uint32_t *)merkle_sha;
-	swap32 = (uint32_t *)merkle_root;
-	flip32(swap32, data32);
+	/* Slices are whole multiples of the hashing lanes, so the helpers only
+	 * join in when there is a full set of lanes for each */
+	threads = opt_gen_threads + 1;
+	lanes = sha256_lanes();
+	batch.slice = (n + threads - 1) / threads;
+	batch.slice = (batch.slice + lanes - 1) / lanes * lanes;
+	batch.slices = (n + batch.slice - 1) / batch.slice;
+
+	if (batch.slices > 1) {
+		/* Only the getwork thread generates more than a slice */
+		mutex_lock(&gen_lock);
+		gen_current = &batch;
+		pthread_cond_broadcast(&gen_cond);
+		__gen_slices(&batch);
+		while (batch.done < batch.slices)
+			pthread_cond_wait(&gen_done_cond, &gen_lock);
+		gen_current = NULL;
+		mutex_unlock(&gen_lock);
+	} else
+		gen_stratum_slice(&batch, 0, n);
 
-	/* Copy the data template from header_bin */
-	memcpy(work->data, pool->header_bin, 112);
-	memcpy(work->data + 36, merkle_root, 32);
+	cg_runlock(&pool->data_lock);
 
-	/* Store the stratum work diff to check it still matches the pool's
-	 * stratum diff when submitting shares */
-	work->sdiff = pool->sdiff;
+	local_work += n;
+	for (i = 0; i < n; i++) {
+		struct work *work = works[i];
 
-	/* Copy parameters required for share submission */
-	work->job_id = strdup(pool->swork.job_id);
-	work->nonce1 = strdup(pool->nonce1);
-	work->ntime = strdup(pool->ntime);
-	cg_runlock(&pool->data_lock);
+		if (opt_debug) {
+			char *header, *merkle_hash;
 
-	if (opt_debug) {
-		char *header, *merkle_hash;
+			header = bin2hex(work->data, 112);
+			merkle_hash = bin2hex(work->data + 36, 32);
+			applog(LOG_DEBUG, "Generated stratum merkle %s", merkle_hash);
+			applog(LOG_DEBUG, "Generated stratum header %s", header);
+			applog(LOG_DEBUG, "Work job_id %s nonce2 %"PRIu64" ntime %s", work->job_id,
+			       work->nonce2, work->ntime);
+			free(header);
+			free(merkle_hash);
+		}
 
-		header = bin2hex(work->data, 112);
-		merkle_hash = bin2hex((const unsigned char *)merkle_root, 32);
-		applog(LOG_DEBUG, "Generated stratum merkle %s", merkle_hash);
-		applog(LOG_DEBUG, "Generated stratum header %s", header);
-		applog(LOG_DEBUG, "Work job_id %s nonce2 %"PRIu64" ntime %s", work->job_id,
-		       work->nonce2, work->ntime);
-		free(header);
-		free(merkle_hash);
+		work->pool = pool;
+		work->stratum = true;
+		work->nonce = 0;
+		work->longpoll = false;
+		work->getwork_mode = GETWORK_MODE_STRATUM;
+		work->work_block = work_block;
+		/* Nominally allow a driver to ntime roll 60 seconds */
+		work->drv_rolllimit = 60;
+		calc_diff(work, work->sdiff);
+
+		cgtime(&work->tv_staged);
 	}
+}
 
-	calc_midstate(work);
-	set_target(work->target, work->sdiff);
+static void gen_stratum_work(struct pool *pool, struct work *work)
+{
+	gen_stratum_works(pool, &work, 1);
+}
 
-	local_work++;
-	work->pool = pool;
-	work->stratum = true;
-	work->nonce = 0;
-	work->longpoll = false;
-	work->getwork_mode = GETWORK_MODE_STRATUM;
-	work->work_block = work_block;
-	/* Nominally allow a driver to ntime roll 60 seconds */
-	work->drv_rolllimit = 60;
-	calc_diff(work, work->sdiff);
+/* Generates as many of the need works the getwork thread is short of as one
+ * batch takes, starting with work, and stages them all at once. A notify
+ * from the pool while they were generated makes the whole batch stale. */
+static void gen_stratum_batch(struct pool *pool, struct work *work, int need)
+{
+	struct work *works[GEN_BATCH_MAX];
+	struct timeval tv_start, tv_end;
+	int i, n = MIN(need, opt_gen_batch);
+	bool stale;
 
-	cgtime(&work->tv_staged);
+	works[0] = work;
+	for (i = 1; i < n; i++)
+		works[i] = make_work();
+
+	cgtime(&tv_start);
+	gen_stratum_works(pool, works, n);
+	cgtime(&tv_end);
+
+	stale = stale_work(works[0], false);
+	if (stale) {
+		applog(LOG_DEBUG, "Discarding stale batch of %d stratum works", n);
+		for (i = 0; i < n; i++)
+			discard_work(works[i]);
+	} else {
+		applog(LOG_DEBUG, "Generated batch of %d stratum works", n);
+		stage_work_batch(works, n);
+	}
+
+	mutex_lock(&gen_lock);
+	gen_batches++;
+	gen_works += n;
+	if (stale)
+		gen_discarded += n;
+	if (n > gen_batch_max)
+		gen_batch_max = n;
+	gen_us += us_tdiff(&tv_end, &tv_start);
+	mutex_unlock(&gen_lock);
 }
 
 #ifdef HAVE_LIBCURL
@@ -6898,7 +7968,7 @@ out:
 
 static void gen_solo_work(struct pool *pool, struct work *work)
 {
-	unsigned char merkle_root[32], merkle_sha[64];
+	unsigned char merkle_root[32], merkle_sha[64], *branch[16];
 	uint32_t *data32, *swap32;
 	struct timeval now;
 	uint64_t nonce2le;
@@ -6917,21 +7987,17 @@ static void gen_solo_work(struct pool *pool, struct work *work)
 	work->nonce2 = pool->nonce2++;
 	work->nonce2_len = pool->n2size;
 	work->gbt_txns = pool->transactions + 1;
+	intern_work_str(&pool->work_ntime, pool->ntime);
+	__update_coinbase_mid(pool);
 
 	/* Downgrade to a read lock to read off the pool variables */
 	cg_dwlock(&pool->gbt_lock);
-	work->coinbase = bin2hex(pool->coinbase, pool->coinbase_len);
+	work->coinbase = refstr_bin2hex(pool->coinbase, pool->coinbase_len);
 	/* Generate merkle root */
-	gen_hash(pool->coinbase, merkle_root, pool->coinbase_len);
-	memcpy(merkle_sha, merkle_root, 32);
-	for (i = 0; i < pool->merkles; i++) {
-		unsigned char *merkle_bin;
-
-		merkle_bin = pool->merklebin + (i * 32);
-		memcpy(merkle_sha + 32, merkle_bin, 32);
-		gen_hash(merkle_sha, merkle_root, 64);
-		memcpy(merkle_sha, merkle_root, 32);
-	}
+	for (i = 0; i < pool->merkles; i++)
+		branch[i] = pool->merklebin + (i * 32);
+	__gen_coinbase_hash(pool, merkle_sha);
+	fold_merkle((unsigned char (*)[32])merkle_sha, 1, branch, pool->merkles);
 	data32 = (uint32_t *)merkle_sha;
 	swap32 = (uint32_t *)merkle_root;
 	flip32(swap32, data32);
@@ -6943,7 +8009,7 @@ static void gen_solo_work(struct pool *pool, struct work *work)
 	work->sdiff = pool->sdiff;
 
 	/* Copy parameters required for share submission */
-	work->ntime = strdup(pool->ntime);
+	work->ntime = refstr_get(pool->work_ntime);
 	memcpy(work->target, pool->gbt_target, 32);
 	cg_runlock(&pool->gbt_lock);
 
@@ -7020,7 +8086,6 @@ struct work *get_work(struct thr_info *thr, const int thr_id)
 static void submit_work_async(struct work *work)
 {
 	struct pool *pool = work->pool;
-	pthread_t submit_thread;
 
 	cgtime(&work->tv_work_found);
 
@@ -7033,12 +8098,7 @@ static void submit_work_async(struct work *work)
 			applog(LOG_NOTICE, "Pool %d stale share detected, discarding", pool->pool_no);
 			sharelog("discard", work);
 
-			mutex_lock(&stats_lock);
-			total_stale++;
-			pool->stale_shares++;
-			total_diff_stale += work->work_difficulty;
-			pool->diff_stale += work->work_difficulty;
-			mutex_unlock(&stats_lock);
+			stats_add_share(pool, NULL, SHARE_STALE, work->work_difficulty);
 
 			free_work(work);
 			return;
@@ -7049,13 +8109,18 @@ static void submit_work_async(struct work *work)
 	if (work->stratum) {
 		applog(LOG_DEBUG, "Pushing pool %d work to stratum queue", pool->pool_no);
 		if (unlikely(!tq_push(pool->stratum_q, work))) {
-			applog(LOG_DEBUG, "Discarding work from removed pool");
+			/* Removed, or so far behind sending that the queue is
+			 * full, so it could only go stale waiting */
+			if (pool->removed)
+				applog(LOG_DEBUG, "Discarding work from removed pool");
+			else
+				applog(LOG_NOTICE, "Pool %d stratum queue full, discarding share", pool->pool_no);
+			stats_add_share(pool, NULL, SHARE_STALE, work->work_difficulty);
 			free_work(work);
 		}
 	} else {
-		applog(LOG_DEBUG, "Pushing submit work to work thread");
-		if (unlikely(pthread_create(&submit_thread, NULL, submit_work_thread, (void *)work)))
-			quit(1, "Failed to create submit_work_thread");
+		applog(LOG_DEBUG, "Pushing submit work to submit queue");
+		queue_submit_work(work);
 	}
 }
 
@@ -7064,10 +8129,8 @@ void inc_hw_errors(struct thr_info *thr)
 	applog(LOG_INFO, "%s%d: invalid nonce - HW error", thr->cgpu->drv->name,
 	       thr->cgpu->device_id);
 
-	mutex_lock(&stats_lock);
-	hw_errors++;
-	thr->cgpu->hw_errors++;
-	mutex_unlock(&stats_lock);
+	__sync_fetch_and_add(&thr->cgpu->hw_errors, 1);
+	stats_add_hw_error();
 
 	thr->cgpu->drv->hw_error(thr);
 }
@@ -7117,12 +8180,8 @@ static void update_work_stats(struct thr_info *thr, struct work *work)
 		applog(LOG_NOTICE, "Found block for pool %d!", work->pool->pool_no);
 	}
 
-	mutex_lock(&stats_lock);
-	total_diff1 += work->device_diff;
-	thr->cgpu->diff1 += work->device_diff;
-	work->pool->diff1 += work->device_diff;
+	stats_add_diff1(work->pool, thr->cgpu, work->device_diff);
 	thr->cgpu->last_device_valid_work = time(NULL);
-	mutex_unlock(&stats_lock);
 }
 
 /* To be used once the work has been tested to be meet diff1 and has had its
@@ -7396,11 +8455,16 @@ static void fill_queue(struct thr_info *mythr, struct cgpu_info *cgpu, struct de
 	} while (!drv->queue_full(cgpu));
 }
 
-/* Add a work item to a cgpu's queued hashlist */
+/* Add a work item to a cgpu's queued hashlist, and to the index of it by
+ * midstate. The key is what the work holds now, drivers that change it
+ * afterwards are still found by the search in __find_queued_bymidstate(). */
 void __add_queued(struct cgpu_info *cgpu, struct work *work)
 {
 	cgpu->queued_count++;
 	HASH_ADD_INT(cgpu->queued_work, id, work);
+	memcpy(work->queued_key, work->midstate, 32);
+	memcpy(work->queued_key + 32, work->data + 64, 12);
+	HASH_ADD(hh_mid, cgpu->queued_bymid, queued_key, QUEUED_KEY_LEN, work);
 }
 
 /* This function is for retrieving one work item from the unqueued pointer and
@@ -7461,6 +8525,26 @@ struct work *__find_work_bymidstate(struct work *que, char *midstate, size_t mid
 	return ret;
 }
 
+/* As __find_work_bymidstate on cgpu->queued_work, but the common values are
+ * looked up in cgpu->queued_bymid instead of comparing every queued work.
+ * The key is only trusted while the work still matches it. */
+static struct work *__find_queued_bymidstate(struct cgpu_info *cgpu, char *midstate, size_t midstatelen, char *data, int offset, size_t datalen)
+{
+	unsigned char key[QUEUED_KEY_LEN];
+	struct work *work = NULL;
+
+	if (midstatelen == 32 && offset == 64 && datalen == 12) {
+		memcpy(key, midstate, 32);
+		memcpy(key + 32, data, 12);
+		HASH_FIND(hh_mid, cgpu->queued_bymid, key, QUEUED_KEY_LEN, work);
+		if (work && !memcmp(work->midstate, midstate, 32) &&
+		    !memcmp(work->data + 64, data, 12))
+			return work;
+	}
+
+	return __find_work_bymidstate(cgpu->queued_work, midstate, midstatelen, data, offset, datalen);
+}
+
 /* This function is for finding an already queued work item in the
  * device's queued_work hashtable. Code using this function must be able
  * to handle NULL as a return which implies there is no matching work.
@@ -7470,7 +8554,7 @@ struct work *find_queued_work_bymidstate(struct cgpu_info *cgpu, char *midstate,
 	struct work *ret;
 
 	rd_lock(&cgpu->qlock);
-	ret = __find_work_bymidstate(cgpu->queued_work, midstate, midstatelen, data, offset, datalen);
+	ret = __find_queued_bymidstate(cgpu, midstate, midstatelen, data, offset, datalen);
 	rd_unlock(&cgpu->qlock);
 
 	return ret;
@@ -7481,7 +8565,7 @@ struct work *clone_queued_work_bymidstate(struct cgpu_info *cgpu, char *midstate
 	struct work *work, *ret = NULL;
 
 	rd_lock(&cgpu->qlock);
-	work = __find_work_bymidstate(cgpu->queued_work, midstate, midstatelen, data, offset, datalen);
+	work = __find_queued_bymidstate(cgpu, midstate, midstatelen, data, offset, datalen);
 	if (work)
 		ret = copy_work(work);
 	rd_unlock(&cgpu->qlock);
@@ -7495,14 +8579,9 @@ struct work *clone_queued_work_bymidstate(struct cgpu_info *cgpu, char *midstate
  * The calling function must lock access to the que if it is required. */
 struct work *__find_work_byid(struct work *que, uint32_t id)
 {
-	struct work *work, *tmp, *ret = NULL;
+	struct work *ret = NULL;
 
-	HASH_ITER(hh, que, work, tmp) {
-		if (work->id == id) {
-			ret = work;
-			break;
-		}
-	}
+	HASH_FIND_INT(que, &id, ret);
 
 	return ret;
 }
@@ -7522,6 +8601,7 @@ void __work_completed(struct cgpu_info *cgpu, struct work *work)
 {
 	cgpu->queued_count--;
 	HASH_DEL(cgpu->queued_work, work);
+	HASH_DELETE(hh_mid, cgpu->queued_bymid, work);
 }
 
 /* This iterates over a queued hashlist finding work started more than secs
@@ -7566,7 +8646,7 @@ struct work *take_queued_work_bymidstate(struct cgpu_info *cgpu, char *midstate,
 	struct work *work;
 
 	wr_lock(&cgpu->qlock);
-	work = __find_work_bymidstate(cgpu->queued_work, midstate, midstatelen, data, offset, datalen);
+	work = __find_queued_bymidstate(cgpu, midstate, midstatelen, data, offset, datalen);
 	if (work)
 		__work_completed(cgpu, work);
 	wr_unlock(&cgpu->qlock);
@@ -8074,25 +9154,37 @@ static void reap_curl(struct pool *pool)
 static void prune_stratum_shares(struct pool *pool)
 {
 	struct stratum_share *sshare, *tmpshare;
-	time_t current_time = time(NULL);
+	time_t expired = time(NULL) - SSHARE_TIMEOUT - 1, t;
 	int cleared = 0;
 
-	mutex_lock(&sshare_lock);
-	HASH_ITER(hh, stratum_shares, sshare, tmpshare) {
-		if (sshare->work->pool == pool && current_time > sshare->sshare_time + 120) {
-			HASH_DEL(stratum_shares, sshare);
+	mutex_lock(&pool->sshare_lock);
+	/* Only the slots of the seconds that have come due since the last
+	 * sweep, or the whole wheel once if that was a turn ago or the clock
+	 * went back. Shares from a later turn are left where they are. */
+	t = pool->sshare_swept;
+	if (expired - t > SSHARE_WHEEL || expired < t)
+		t = expired - SSHARE_WHEEL;
+	while (t < expired) {
+		struct list_head *slot = &pool->sshare_wheel[++t & (SSHARE_WHEEL - 1)];
+
+		list_for_each_entry_safe(sshare, tmpshare, slot, wheel) {
+			if (sshare->sshare_time > expired)
+				continue;
+			HASH_DEL(pool->stratum_shares, sshare);
+			list_del(&sshare->wheel);
 			free_work(sshare->work);
+			pool->sshares--;
 			free(sshare);
 			cleared++;
 		}
 	}
-	mutex_unlock(&sshare_lock);
+	pool->sshare_swept = expired;
+	mutex_unlock(&pool->sshare_lock);
 
 	if (cleared) {
 		applog(LOG_WARNING, "Lost %d shares due to no stratum share response from pool %d",
 		       cleared, pool->pool_no);
-		pool->stale_shares += cleared;
-		total_stale += cleared;
+		stats_add_stale(pool, cleared, 0);
 	}
 }
 
@@ -8202,6 +9294,7 @@ static void *watchdog_thread(void __maybe_unused *userdata)
 		sleep(interval);
 
 		discard_stale();
+		stats_fold();
 
 		hashmeter(-1, 0);
 
@@ -8354,6 +9447,7 @@ void print_summary(void)
 	mins = (diff.tv_sec % 3600) / 60;
 	secs = diff.tv_sec % 60;
 
+	stats_fold();
 	utility = total_accepted / total_secs * 60;
 	work_util = total_diff1 / total_secs * 60;
 
@@ -8888,6 +9982,7 @@ void enable_device(struct cgpu_info *cgpu)
 
 	rwlock_init(&cgpu->qlock);
 	cgpu->queued_work = NULL;
+	cgpu->queued_bymid = NULL;
 }
 
 struct _cgpu_devid_counter {
@@ -8921,9 +10016,7 @@ bool add_cgpu(struct cgpu_info *cgpu)
 	devices = realloc(devices, sizeof(struct cgpu_info *) * (total_devices + new_devices + 2));
 	wr_unlock(&devices_lock);
 
-	mutex_lock(&stats_lock);
 	cgpu->last_device_valid_work = time(NULL);
-	mutex_unlock(&stats_lock);
 
 	if (hotplug_mode)
 		devices[total_devices + new_devices++] = cgpu;
@@ -9142,9 +10235,12 @@ int main(int argc, char *argv[])
 	initial_args[argc] = NULL;
 
 	mutex_init(&hash_lock);
+	mutex_init(&work_pool_lock);
 	mutex_init(&console_lock);
 	cglock_init(&control_lock);
 	mutex_init(&stats_lock);
+	if (unlikely(pthread_key_create(&stats_key, stats_shard_idle)))
+		early_quit(1, "Failed to pthread_key_create stats_key");
 	mutex_init(&sharelog_lock);
 	cglock_init(&ch_lock);
 	mutex_init(&sshare_lock);
@@ -9164,6 +10260,12 @@ int main(int argc, char *argv[])
 	if (unlikely(pthread_cond_init(&gws_cond, NULL)))
 		early_quit(1, "Failed to pthread_cond_init gws_cond");
 
+	mutex_init(&gen_lock);
+	if (unlikely(pthread_cond_init(&gen_cond, NULL)))
+		early_quit(1, "Failed to pthread_cond_init gen_cond");
+	if (unlikely(pthread_cond_init(&gen_done_cond, NULL)))
+		early_quit(1, "Failed to pthread_cond_init gen_done_cond");
+
 	/* Create a unique get work queue */
 	getq = tq_new();
 	if (!getq)
@@ -9245,6 +10347,7 @@ int main(int argc, char *argv[])
 #endif
 
 	applog(LOG_WARNING, "Started %s", packagename);
+	applog(LOG_INFO, "Using %s SHA256", sha256_select());
 	if (cnfbuf) {
 		applog(LOG_NOTICE, "Loaded configuration file %s", cnfbuf);
 		switch (fileconf_load) {
@@ -9426,6 +10529,9 @@ int main(int argc, char *argv[])
 		pool->idle = true;
 	}
 
+	/* Shares can be found as soon as a probed pool hands out work */
+	start_submit_threads();
+
 	/* Look for at least one active pool before starting */
 	applog(LOG_NOTICE, "Probing for an alive pool");
 	probe_pools();
@@ -9501,6 +10607,13 @@ begin_bench:
 	pthread_detach(thr->pth);
 #endif
 
+	for (i = 0; i < opt_gen_threads; i++) {
+		pthread_t gen_pth;
+
+		if (unlikely(pthread_create(&gen_pth, NULL, gen_thread, NULL)))
+			early_quit(1, "gen thread create failed");
+	}
+
 #ifdef HAVE_CURSES
 	/* Create curses input thread for keyboard input. Create this last so
 	 * that we know all threads are created since this can call kill_work
@@ -9534,7 +10647,7 @@ begin_bench:
 		if (!pool_localgen(cp) && !staged_rollable)
 			max_staged += mining_threads;
 
-		mutex_lock(stgd_lock);
+		stgd_lock_take();
 		ts = __total_staged();
 
 		if (!pool_localgen(cp) && !ts && !opt_fail_only)
@@ -9547,10 +10660,10 @@ begin_bench:
 				work_emptied = false;
 			}
 			work_filled = true;
-			pthread_cond_wait(&gws_cond, stgd_lock);
+			stgd_cond_wait(&gws_cond);
 			ts = __total_staged();
 		}
-		mutex_unlock(stgd_lock);
+		stgd_lock_release();
 
 		if (ts > max_staged) {
 			/* Keeps slowly generating work even if it's not being
@@ -9590,9 +10703,8 @@ retry:
 					goto retry;
 				}
 			}
-			gen_stratum_work(pool, work);
-			applog(LOG_DEBUG, "Generated stratum work");
-			stage_work(work);
+			gen_stratum_batch(pool, work, max_staged - ts + 1);
+			work = NULL;
 			continue;
 		}
 
@@ -9662,6 +10774,7 @@ retry:
 			push_curl_entry(ce, pool);
 			pool = select_pool(!opt_fail_only);
 			free_work(work);
+			work = make_work();
 			goto retry;
 		}
 		if (ts >= max_staged)
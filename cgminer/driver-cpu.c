@@ -0,0 +1,219 @@
+/* vim:et:sts=2:sw=2:ts=2:tw=78
+ */
+/* scans nonces on the host cpus, as a fallback and as a baseline to compare
+ * the hardware against. the scanning is sha256d_scan() of the sha256 library,
+ * which precomputes what doesn't depend on the nonce and runs on the widest
+ * simd kernels the cpu has. */
+#define _GNU_SOURCE
+#include "miner.h"
+#include "driver-cpu.h"
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+
+/* built with its clashing names renamed, see Makefile.am */
+#include "sha256.h"
+
+/* nonces between two looks at work_restart */
+#define CPU_BATCH 0x4000u
+/* first chunk handed to scanhash, hash_sole_work adapts it from there */
+#define CPU_FIRST_CHUNK 0xfffffu
+/* longest single scanhash call */
+#define CPU_SCAN_SECONDS 1.0
+/* hits taken from one sha256d_scan() call, more just need another call */
+#define CPU_MAX_HITS 16
+
+int opt_cpu_threads;
+
+/* what sha256d_scan() wants of a work */
+struct cpu_job {
+  uint8_t midstate[32];
+  uint8_t tail[12];
+};
+
+struct cpu_info {
+  int core;
+  struct cpu_job job;
+
+  uint64_t hashes;
+  uint64_t candidates;
+  double scan_time;
+};
+
+/* difficulty 1: every hash that test_nonce() would look at */
+static uint8_t cpu_diff1_target[32];
+
+static void cpu_job(struct cpu_job* job, const unsigned char* data) {
+  unsigned char header[64];
+  sha256_context ctx;
+
+  /* work->data is word swapped, the library wants the header as serialized */
+  flip64(header, data);
+  sha256_init(&ctx);
+  sha256_update(&ctx, header, sizeof(header));
+  sha256_nofinish(&ctx, job->midstate);
+  flip12(job->tail, data + 64);
+}
+
+/* block 125552 has to be found where it is, by whichever kernel scans it */
+static bool cpu_selftest(void) {
+  static const unsigned char header[80] =
+    "\x01\x00\x00\x00"
+    "\x81\xcd\x02\xab\x7e\x56\x9e\x8b\xcd\x93\x17\xe2\xfe\x99\xf2\xde\x44\xd4\x9a\xb2\xb8\x85\x1b\xa4\xa3\x08\x00\x00\x00\x00\x00\x00"
+    "\xe3\x20\xb6\xc2\xff\xfc\x8d\x75\x04\x23\xdb\x8b\x1e\xb9\x42\xae\x71\x0e\x95\x1e\xd7\x97\xf7\xaf\xfc\x88\x92\xb0\xf1\xfc\x12\x2b"
+    "\xc7\xf5\xd7\x4d\xf2\xb9\x44\x1a\x42\xa1\x46\x95";
+  unsigned char data[80];
+  struct cpu_job job;
+  uint32_t nonce = 0x42a14695, hits[CPU_MAX_HITS];
+  size_t found;
+
+  flip80(data, header);
+  cpu_job(&job, data);
+  found = sha256d_scan(job.midstate, job.tail, cpu_diff1_target, nonce - 0x1000, nonce + 0x1000,
+      hits, CPU_MAX_HITS);
+
+  return found == 1 && hits[0] == nonce;
+}
+
+static void cpu_drv_detect(bool __maybe_unused hotplug) {
+  struct cgpu_info* cgpu;
+  struct cpu_info* info;
+  int i;
+
+  if (opt_cpu_threads <= 0)
+    return;
+
+  memset(cpu_diff1_target, 0xff, 28);
+  if (!cpu_selftest()) {
+    applog(LOG_ERR, "cpu: selftest failed, not mining on the cpu");
+    return;
+  }
+  applog(LOG_INFO, "cpu: scanning %d nonces at a time", sha256_lanes());
+
+  for (i = 0; i < opt_cpu_threads; ++i) {
+    cgpu = calloc(1, sizeof(*cgpu));
+    info = calloc(1, sizeof(*info));
+    if (unlikely(!cgpu || !info))
+      quithere(1, "Failed to calloc cpu device");
+
+    info->core = i;
+    cgpu->drv = &cpu_drv;
+    cgpu->deven = DEV_ENABLED;
+    cgpu->threads = 1;
+    cgpu->device_data = info;
+
+    if (unlikely(!add_cgpu(cgpu))) {
+      free(info);
+      free(cgpu);
+      return;
+    }
+  }
+}
+
+static bool cpu_thread_init(struct thr_info* thr) {
+  struct cpu_info* info = (struct cpu_info*) thr->cgpu->device_data;
+#ifdef __linux
+  cpu_set_t set;
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+  /* one thread per core, so that the per device rates are per core */
+  if (cores > 0) {
+    CPU_ZERO(&set);
+    CPU_SET(info->core % cores, &set);
+    if (sched_setaffinity(0, sizeof(set), &set))
+      applog(LOG_INFO, "cpu%d: could not pin to core %ld", info->core, info->core % cores);
+  }
+#else
+  (void) info;
+#endif
+  return true;
+}
+
+static uint64_t cpu_can_limit_work(struct thr_info __maybe_unused *thr) {
+  return CPU_FIRST_CHUNK;
+}
+
+static bool cpu_prepare_work(struct thr_info* thr, struct work* work) {
+  struct cpu_info* info = (struct cpu_info*) thr->cgpu->device_data;
+
+  cpu_job(&info->job, work->data);
+  return true;
+}
+
+static int64_t cpu_scanhash(struct thr_info* thr, struct work* work,
+    int64_t max_nonce) {
+  struct cpu_info* info = (struct cpu_info*) thr->cgpu->device_data;
+  const struct cpu_job* job = &info->job;
+  struct timeval tv_start, tv_end;
+  uint32_t first = work->nonce, nonce = first, last, stop, hits[CPU_MAX_HITS];
+  size_t found, i;
+
+  /* max_nonce is exclusive. hash_sole_work() adds the limit to the nonce in
+   * 32 bits, so once the limit has grown to the whole space it wraps */
+  if (max_nonce > 0xffffffffll || max_nonce <= first)
+    last = 0xffffffffu;
+  else
+    last = max_nonce;
+
+  cgtime(&tv_start);
+  tv_end = tv_start;
+  /* a whole nonce space takes minutes, come back for the hashmeter */
+  while (nonce < last && !thr->work_restart && tdiff(&tv_end, &tv_start) < CPU_SCAN_SECONDS) {
+    stop = last - nonce > CPU_BATCH ? nonce + CPU_BATCH : last;
+    do {
+      found = sha256d_scan(job->midstate, job->tail, cpu_diff1_target, nonce, stop - 1,
+          hits, CPU_MAX_HITS);
+      for (i = 0; i < found; ++i)
+        submit_nonce(thr, work, hits[i]);
+      info->candidates += found;
+      /* a full hits array means the scan stopped at the last one */
+      nonce = found == CPU_MAX_HITS ? hits[found - 1] + 1 : stop;
+    } while (nonce < stop);
+    cgtime(&tv_end);
+  }
+
+  work->nonce = nonce;
+  info->hashes += nonce - first;
+  info->scan_time += tdiff(&tv_end, &tv_start);
+
+  return nonce - first;
+}
+
+static struct api_data* cpu_api_stats(struct cgpu_info* cgpu) {
+  struct cpu_info* info = (struct cpu_info*) cgpu->device_data;
+  struct api_data* root = NULL;
+  double mhs = 0.0;
+
+  /* the rate while scanning, without the time spent waiting for work */
+  if (info->scan_time > 0.0)
+    mhs = info->hashes / info->scan_time / 1000000.0;
+
+  root = api_add_int(root, "Core", &info->core, false);
+  root = api_add_uint64(root, "Hashes", &info->hashes, false);
+  root = api_add_uint64(root, "Candidates", &info->candidates, false);
+  root = api_add_elapsed(root, "Scan Time", &info->scan_time, false);
+  root = api_add_mhs(root, "Scan MHS", &mhs, true);
+
+  return root;
+}
+
+static void cpu_zero_stats(struct cgpu_info* cgpu) {
+  struct cpu_info* info = (struct cpu_info*) cgpu->device_data;
+
+  info->hashes = 0;
+  info->candidates = 0;
+  info->scan_time = 0.0;
+}
+
+struct device_drv cpu_drv = {
+  .drv_id = DRIVER_cpu,
+  .dname = "cpu",
+  .name = "CPU",
+  .drv_detect = cpu_drv_detect,
+  .thread_init = cpu_thread_init,
+  .can_limit_work = cpu_can_limit_work,
+  .prepare_work = cpu_prepare_work,
+  .scanhash = cpu_scanhash,
+  .get_api_stats = cpu_api_stats,
+  .zero_stats = cpu_zero_stats,
+};
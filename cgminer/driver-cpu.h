@@ -0,0 +1,9 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include "miner.h"
+
+/* number of host threads to mine on, one device each */
+extern int opt_cpu_threads;
+
+#endif /* CPU_H */
@@ -3,6 +3,8 @@
 #define _GNU_SOURCE
 #include "miner.h"
 #include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
@@ -10,14 +12,65 @@
 
 #include <sha256_accel.h>
 #define CLOCK_FREQ 110u
+/* the kernel module derives the FCLK divisor as 1000 / freq, 6 bits wide */
+#define EDC_MIN_CLOCK 16u
+#define EDC_MAX_CLOCK 250u
 #define TEMPFILE "/sys/devices/amba.0/f8007100.ps7-xadc/temp"
 
+/* all cores run off the same fabric clock, so there is only one setting */
+static volatile uint32_t edc_clock = CLOCK_FREQ;
+
+#define EDC_STATUS_RDY 0x01u
+#define EDC_STATUS_BUSY 0x02u
+#define EDC_STATUS_IDLE 0x08u
+#define EDC_STATUS_FOUND 0x10u
+#define EDC_STATUS_CANDIDATE SHA256_ACCEL_STATUS_CANDIDATE
+
+/* every work item is searched in full, one after the other */
+#define EDC_NONCE_FIRST 0x00000000u
+#define EDC_NONCE_LAST 0xffffffffu
+#define EDC_POLL_US 100000
+/* results fetched per read() */
+#define EDC_MSG_BATCH 16
+
 struct edc_info {
   int fd;
   pthread_mutex_t fd_lock;
+  /* result ring and register window shared with the kernel, NULL if the
+   * module cannot map them; we fall back to read() and ioctl() then */
+  struct sha256_accel_ring_s* ring;
+  volatile const uint32_t* regs;
+
+  /* clock currently programmed from this thread */
+  uint32_t clock_set;
+  /* the core stopped somewhere else than at the end of a range and has to
+   * be reset before it accepts new work */
+  bool need_reset;
+  /* set by flush_work, handled by the mining thread */
+  bool flush;
+
+  /* the work in the main register bank, in the shadow bank, the one that
+   * ran before the active one and the one fetched but not loaded yet */
+  struct work* work_active;
+  struct work* work_next;
+  struct work* work_prev;
+  struct work* work_pending;
+  /* nonces of the active and next work already accounted for */
+  uint32_t done_active;
+  uint32_t done_next;
+
+  /* per-work statistics, all durations in seconds */
+  uint64_t works;
+  double latency_last;
+  double latency_max;
+  double latency_total;
+  double idle_total;
+  uint64_t candidates;
+  struct timeval tv_session;
+  struct timeval tv_idle;
 };
 
-static void edc_drv_detect(bool hotplug) {
+static bool edc_detect_one(const char* path) {
   struct stat chr_stat;
   char buf[128], *strerr;
   int errsv;
@@ -25,31 +78,36 @@ static void edc_drv_detect(bool hotplug) {
   struct cgpu_info *info;
   struct edc_info* edcinfo;
 
-  info = calloc(1, sizeof(*info));
-  edcinfo = (struct edc_info*) (
-      info->device_data = calloc(1, sizeof(struct edc_info))
-      );
-
-  if (unlikely(NULL == info))
-    quithere(1, "Failed to calloc edccgpu");
-
-  if (unlikely(-1 == stat(SHA256_ACCEL_DEVICE, &chr_stat))) {
+  if (-1 == stat(path, &chr_stat)) {
     errsv = errno;
-    strerr = strerror_r(errsv, strerr, sizeof(buf));
+    /* instances are numbered without gaps, the first missing one ends the scan */
+    if (errsv == ENOENT)
+      return false;
 
-    applog(LOG_ERR, "failed to stat %s: (%d) %s", SHA256_ACCEL_DEVICE, errsv, strerr);
-    goto cleanup;
+    strerr = strerror_r(errsv, buf, sizeof(buf));
+    applog(LOG_ERR, "failed to stat %s: (%d) %s", path, errsv, strerr);
+    return false;
   }
 
   if (unlikely( !S_ISCHR(chr_stat.st_mode) )) {
-    applog(LOG_ERR, "not a character device: " SHA256_ACCEL_DEVICE);
-    goto cleanup;
+    applog(LOG_ERR, "not a character device: %s", path);
+    return false;
   }
 
+  info = calloc(1, sizeof(*info));
+  if (unlikely(NULL == info))
+    quithere(1, "Failed to calloc edccgpu");
+
+  edcinfo = (struct edc_info*) (
+      info->device_data = calloc(1, sizeof(struct edc_info))
+      );
+  if (unlikely(NULL == edcinfo))
+    quithere(1, "Failed to calloc edcinfo");
+
   info->drv = &edc_drv;
   info->deven = DEV_ENABLED;
   info->threads = 1;
-  info->device_path = SHA256_ACCEL_DEVICE;
+  info->device_path = strdup(path);
 
   mutex_init(&edcinfo->fd_lock);
   edcinfo->fd = -1;
@@ -57,10 +115,28 @@ static void edc_drv_detect(bool hotplug) {
   if (unlikely(!add_cgpu(info)))
     goto cleanup;
 
-  return;
+  return true;
 
 cleanup:
+  free((void*) info->device_path);
+  free(edcinfo);
   free(info);
+  return false;
+}
+
+/* every accelerator core in the fabric shows up as /dev/sha256N */
+static void edc_drv_detect(bool hotplug) {
+  char path[64];
+  int i;
+
+  for (i = 0; i < SHA256_ACCEL_MAX_DEVICES; ++i) {
+    snprintf(path, sizeof(path), SHA256_ACCEL_DEVICE_FMT, i);
+    if (!edc_detect_one(path))
+      break;
+  }
+
+  if (i == 0)
+    applog(LOG_ERR, "edc: no accelerator found at " SHA256_ACCEL_DEVICE);
 }
 
 #define LOG_ERRNO(fmt, args...) { \
@@ -81,25 +157,181 @@ data[0x18], data[0x19], data[0x1a], data[0x1b], data[0x1c], data[0x1d],
 data[0x1e], data[0x1f]);
 }
 
-int64_t edc_scanhash(struct thr_info* thr, struct work* work,
-    int64_t max_nonce) {
-  uint32_t status = 0u, nonce_current;
+/* program the FPGA clock, but only if it differs from the current one */
+static bool edc_set_clock(struct edc_info* edcinfo) {
   char buf[128], *strerr;
-  int errsv, i, ret, fd, tempfd;
-  unsigned char b;
-  int64_t hashes = -1;
-  fd_set set;
-  struct timeval timeout;
-  struct sha256_accel_msg_s msg;
+  int errsv;
+  uint32_t clock = edc_clock;
+
+  if (likely(clock == edcinfo->clock_set))
+    return true;
+
+  if (unlikely(-1 == ioctl(edcinfo->fd, SHA256_ACCEL_SET_CLOCK_SPEED, clock))) {
+    LOG_ERRNO("edc: failed to send frequency=%u", clock, );
+    return false;
+  }
+
+  edcinfo->clock_set = clock;
+  return true;
+}
+
+static bool edc_reset(struct thr_info* thr, struct edc_info* edcinfo) {
+  char buf[128], *strerr;
+  int errsv;
+  uint32_t status = 0u;
+
+  if (unlikely(-1 == ioctl(edcinfo->fd, SHA256_ACCEL_RESET))) {
+    LOG_ERRNO("edc: failed to send reset command");
+    return false;
+  }
+
+  /* waiting for device to get ready */
+  do {
+    if (unlikely(-1 == ioctl(edcinfo->fd, SHA256_ACCEL_GET_STATUS, &status))) {
+      LOG_ERRNO("edc: failed to retrieve hw status");
+      return false;
+    }
+    // TODO maybe add a timeout here?
+  } while(status != EDC_STATUS_RDY && !thr->work_restart);
+
+  if (unlikely(status != EDC_STATUS_RDY)) {
+    applog(LOG_ERR, "edc: got restarted while working for reset!!");
+    return false;
+  }
+
+  /* keep scanning the range on a candidate, every share of it is reported */
+  if (unlikely(-1 == ioctl(edcinfo->fd, SHA256_ACCEL_SET_CONTROL, SHA256_ACCEL_CONTROL_CONTINUE))) {
+    LOG_ERRNO("edc: failed to enable continue mode");
+    return false;
+  }
+
+  edcinfo->need_reset = false;
+  return true;
+}
+
+/* map the result ring and the register window, so that polling progress and
+ * draining results does not cost a syscall each */
+static void edc_map(struct edc_info* edcinfo) {
+  long pagesize = sysconf(_SC_PAGESIZE);
+  void* ring;
+  void* regs;
+
+  ring = mmap(NULL, pagesize, PROT_READ | PROT_WRITE, MAP_SHARED, edcinfo->fd,
+              SHA256_ACCEL_MMAP_RING * pagesize);
+  if (ring == MAP_FAILED) {
+    applog(LOG_NOTICE, "edc: result ring not mappable, using read()");
+    return;
+  }
+
+  regs = mmap(NULL, pagesize, PROT_READ, MAP_SHARED, edcinfo->fd,
+              SHA256_ACCEL_MMAP_REGS * pagesize);
+  if (regs == MAP_FAILED) {
+    applog(LOG_NOTICE, "edc: registers not mappable, using read()");
+    munmap(ring, pagesize);
+    return;
+  }
+
+  edcinfo->ring = (struct sha256_accel_ring_s*) ring;
+  edcinfo->regs = (volatile const uint32_t*) regs;
+}
+
+static void edc_unmap(struct edc_info* edcinfo) {
+  long pagesize = sysconf(_SC_PAGESIZE);
+
+  if (edcinfo->ring)
+    munmap(edcinfo->ring, pagesize);
+  if (edcinfo->regs)
+    munmap((void*) edcinfo->regs, pagesize);
+  edcinfo->ring = NULL;
+  edcinfo->regs = NULL;
+}
+
+/* fetch up to max results, either from the shared ring or through read();
+ * returns the number of results or -1 on error */
+static int edc_fetch(struct edc_info* edcinfo, struct sha256_accel_msg_s* msgs,
+    int max) {
+  struct sha256_accel_ring_s* ring = edcinfo->ring;
+  uint32_t head, tail;
+  ssize_t ret;
+  int i, n;
+
+  if (ring) {
+    head = *(volatile uint32_t*) &ring->head;
+    tail = ring->tail;
+    /* pairs with the barrier the driver issues before publishing head */
+    __sync_synchronize();
+
+    n = MIN((int) (head - tail), max);
+    for (i = 0; i < n; ++i)
+      msgs[i] = ring->msgs[(tail + i) % SHA256_ACCEL_RING_SIZE];
+
+    /* the entries must be copied before the driver may reuse them */
+    __sync_synchronize();
+    *(volatile uint32_t*) &ring->tail = tail + n;
+    return n;
+  }
+
+  ret = read(edcinfo->fd, (char*) msgs, max * sizeof(msgs[0]));
+  if (ret == -1 && errno == EAGAIN)
+    return 0;
+  if (unlikely(ret < 0 || ret % sizeof(msgs[0])))
+    return -1;
+  return ret / sizeof(msgs[0]);
+}
+
+static bool edc_thread_prepare(struct thr_info* thr) {
+  struct cgpu_info* cgpu = thr->cgpu;
+  struct edc_info* edcinfo = (struct edc_info*) cgpu->device_data;
+  char buf[128], *strerr;
+  int errsv, fd;
+
+  mutex_lock(&edcinfo->fd_lock);
+  /* non-blocking, results are waited for with select() */
+  fd = open(cgpu->device_path, O_RDWR | O_NONBLOCK);
+  edcinfo->fd = fd;
+  mutex_unlock(&edcinfo->fd_lock);
+
+  if (unlikely(-1 == fd)) {
+    LOG_ERRNO("edc: failed to open %s", cgpu->device_path, );
+    return false;
+  }
+
+  edc_map(edcinfo);
+
+  /* the clock register survives a close, but we cannot know its value */
+  edcinfo->clock_set = 0u;
+  if (unlikely(!edc_set_clock(edcinfo) || !edc_reset(thr, edcinfo)))
+    goto close;
+
+  cgtime(&edcinfo->tv_session);
+  copy_time(&edcinfo->tv_idle, &edcinfo->tv_session);
+  return true;
+
+close:
+  mutex_lock(&edcinfo->fd_lock);
+  edc_unmap(edcinfo);
+  close(fd);
+  edcinfo->fd = -1;
+  mutex_unlock(&edcinfo->fd_lock);
+  return false;
+}
+
+static void edc_thread_shutdown(struct thr_info* thr) {
   struct edc_info* edcinfo = (struct edc_info*) thr->cgpu->device_data;
 
-  /*
-   * 
-   * NOTE: occasionally check thr->work_restart in blocking loops! we are supposed to
-   * abort if it is set.
-   * 
-   */
+  mutex_lock(&edcinfo->fd_lock);
+  if (edcinfo->fd != -1) {
+    /* closing the device stops any running computation */
+    edc_unmap(edcinfo);
+    close(edcinfo->fd);
+    edcinfo->fd = -1;
+  }
+  mutex_unlock(&edcinfo->fd_lock);
+}
 
+static void edc_set_target(struct work* work) {
+  int i;
+  unsigned char b;
 
   memset(work->device_target, '\0', 32);
   for (i = 31; i >= 0; --i)
@@ -108,141 +340,363 @@ int64_t edc_scanhash(struct thr_info* thr, struct work* work,
         goto found;
 
 found:
-  for ( ; i < 32; ++i) { 
+  for ( ; i < 32; ++i) {
     for ( ; b > 0; b >>= 1)
       work->device_target[i] |= b;
     b = 0x80;
   }
 
   print_hex(work->device_target);
+}
 
-  mutex_lock(&edcinfo->fd_lock);
-  fd = open(thr->cgpu->device_path, O_RDWR);
-  edcinfo->fd = fd;
-  if (unlikely(-1 == fd)) {
-    mutex_unlock(&edcinfo->fd_lock);
-    LOG_ERRNO("edc: failed to open %s", thr->cgpu->device_path, );
-    return -1;
-  }
-  mutex_unlock(&edcinfo->fd_lock);
+static void edc_account_latency(struct edc_info* edcinfo,
+    struct timeval* tv_load) {
+  struct timeval now;
+  double latency;
+
+  cgtime(&now);
+  latency = tdiff(&now, tv_load);
+  edcinfo->works++;
+  edcinfo->latency_last = latency;
+  edcinfo->latency_total += latency;
+  if (latency > edcinfo->latency_max)
+    edcinfo->latency_max = latency;
+}
 
-  /* set clock speed */
-  if (unlikely(-1 == ioctl(fd, SHA256_ACCEL_SET_CLOCK_SPEED, CLOCK_FREQ))) {
-    LOG_ERRNO("edc: failed to send frequency=%u", CLOCK_FREQ, );
-    goto close;
-  }
+/* load work into the main register bank of an idle core and start it */
+static bool edc_start_work(struct thr_info* thr, struct edc_info* edcinfo,
+    struct work* work) {
+  char buf[128], *strerr;
+  int errsv, fd = edcinfo->fd;
+  struct timeval tv_load, tv_start;
+  unsigned char prefix[12];
 
-  /* reset device */
-  if (unlikely(-1 == ioctl(fd, SHA256_ACCEL_RESET))) {
-    LOG_ERRNO("edc: failed to send reset command");
-    goto close;
-  }
+  cgtime(&tv_load);
+  edc_set_target(work);
+  /* the core hashes the header as serialized, work->data is word swapped */
+  flip12(prefix, work->data + 64);
 
-  /* waiting for device to get ready */
-  do {
-    if (unlikely(-1 == ioctl(fd, SHA256_ACCEL_GET_STATUS, &status))) {
-      LOG_ERRNO("edc: failed to retrieve hw status");
-      goto close;
-    }
-    // TODO maybe add a timeout here?
-  } while(status != 0x1u && !thr->work_restart);
+  if (unlikely(edcinfo->need_reset) && !edc_reset(thr, edcinfo))
+    return false;
 
-  if (unlikely(status != 0x1u)) {
-    applog(LOG_ERR, "edc: got restarted while working for reset!!");
-    goto close;
-  }
+  /* anything that fails from here on leaves the core in an unknown state */
+  edcinfo->need_reset = true;
 
   if (unlikely(-1 == ioctl(fd, SHA256_ACCEL_SET_STATE_IN, work->midstate))) {
     LOG_ERRNO("edc: failed to set midstate");
-    goto close;
+    return false;
   }
 
-  if (unlikely(-1 == ioctl(fd, SHA256_ACCEL_SET_PREFIX, work->data + 64))) {
+  if (unlikely(-1 == ioctl(fd, SHA256_ACCEL_SET_PREFIX, prefix))) {
     LOG_ERRNO("edc: failed to set prefix");
-    goto close;
+    return false;
   }
 
-
   if (unlikely(-1 == ioctl(fd, SHA256_ACCEL_SET_DIFFICULTY_MASK, work->device_target))) {
     LOG_ERRNO("edc: failed to set difficulty mask");
-    goto close;
+    return false;
+  }
+
+  if (unlikely(-1 == ioctl(fd, SHA256_ACCEL_SET_NONCE_FIRST, EDC_NONCE_FIRST)
+        || -1 == ioctl(fd, SHA256_ACCEL_SET_NONCE_LAST, EDC_NONCE_LAST))) {
+    LOG_ERRNO("edc: failed to set nonce range");
+    return false;
+  }
+
+  if (unlikely(-1 == ioctl(fd, SHA256_ACCEL_SET_JOB_ID, work->id))) {
+    LOG_ERRNO("edc: failed to set job id");
+    return false;
   }
 
   if (unlikely(-1 == ioctl(fd, SHA256_ACCEL_START))) {
     LOG_ERRNO("edc: failed to send start command");
-    goto close;
+    return false;
   }
 
+  edcinfo->need_reset = false;
+  edc_account_latency(edcinfo, &tv_load);
+  cgtime(&tv_start);
+  edcinfo->idle_total += tdiff(&tv_start, &edcinfo->tv_idle);
+  edcinfo->work_active = work;
+  edcinfo->done_active = 0;
+  return true;
+}
 
-  while (1) {
-    FD_ZERO(&set);
-    FD_SET(fd, &set);
-    timeout.tv_sec = 0;
-    timeout.tv_usec = 200000;
+/* arm the shadow register bank with the work to run after the active one */
+static bool edc_queue_work(struct edc_info* edcinfo, struct work* work) {
+  char buf[128], *strerr;
+  int errsv;
+  struct timeval tv_load;
+  struct sha256_accel_job_s job;
+
+  cgtime(&tv_load);
+  edc_set_target(work);
+
+  memcpy(job.state_in, work->midstate, sizeof(job.state_in));
+  flip12(job.prefix, work->data + 64);
+  memcpy(job.difficulty_mask, work->device_target, sizeof(job.difficulty_mask));
+  job.nonce_first = EDC_NONCE_FIRST;
+  job.nonce_last = EDC_NONCE_LAST;
+  job.job_id = work->id;
+
+  if (unlikely(-1 == ioctl(edcinfo->fd, SHA256_ACCEL_QUEUE_JOB, &job))) {
+    LOG_ERRNO("edc: failed to queue job");
+    return false;
+  }
 
-    ret = select(fd + 1, &set, NULL, NULL, &timeout);
+  edc_account_latency(edcinfo, &tv_load);
+  edcinfo->work_next = work;
+  edcinfo->done_next = 0;
+  return true;
+}
 
-    if (likely(ret == 0)) {
-      /* timeout */
-      if (unlikely(thr->work_restart)) {
-        applog(LOG_ERR, "edc: dropping work\n");
-        break;
-      }
+/* the active work ran through its range, the queued one (if any) took over */
+static int64_t edc_retire_active(struct cgpu_info* cgpu,
+    struct edc_info* edcinfo) {
+  int64_t hashes = (int64_t) (EDC_NONCE_LAST - EDC_NONCE_FIRST) - edcinfo->done_active;
 
-      if (unlikely(-1 == ioctl(fd, SHA256_ACCEL_GET_STATUS, &status))) {
-        LOG_ERRNO("edc: failed to retrieve hw status");
-        break;
-      }
+  /* candidates from the tail of the range may still be in flight, so the
+   * work stays on the queue until the next one retires */
+  if (edcinfo->work_prev)
+    work_completed(cgpu, edcinfo->work_prev);
+  edcinfo->work_prev = edcinfo->work_active;
 
-      if (unlikely((status & 0x2) == 0)) {
-        applog(LOG_ERR, "edc: hardware stopped for some reason!");
-        break;
-      }
+  edcinfo->work_active = edcinfo->work_next;
+  edcinfo->done_active = edcinfo->done_next;
+  edcinfo->work_next = NULL;
+  edcinfo->done_next = 0;
 
-      /* we are still alive! please don't kill us! we'll do everything! :-( */
-      cgtime(&thr->last);
-      tempfd = open(TEMPFILE, O_RDONLY);
-      if (tempfd != -1) {
-        ret = read(tempfd, buf, sizeof(msg));
-        if (ret > 0) {
-          buf[MIN(ret, 127)] = '\0';
-          sscanf(buf, "%lf", &thr->cgpu->temp);
-        }
-        close(tempfd);
-      }
+  return hashes;
+}
 
-    } else if (unlikely(ret == -1)) {
-      LOG_ERRNO("edc: failed to select");
-      break;
-    } else {
-      ret = read(fd, (char*) &msg, sizeof(msg));
-      if (sizeof(msg) != ret) {
-        applog(LOG_ERR, "edc: short read");
+/* account the nonces the core got through since the last call */
+static int64_t edc_progress(struct edc_info* edcinfo) {
+  char buf[128], *strerr;
+  int errsv;
+  uint32_t job_id, nonce;
+  int64_t hashes = 0;
+
+  /* the job id has to be read first: if the core switches jobs in between,
+   * the nonce is a small one of the new job and gets ignored below */
+  if (edcinfo->regs) {
+    job_id = edcinfo->regs[SHA256_ACCEL_REG_JOB_ID];
+    nonce = edcinfo->regs[SHA256_ACCEL_REG_NONCE_CURRENT];
+  } else if (unlikely(-1 == ioctl(edcinfo->fd, SHA256_ACCEL_GET_JOB_ID, &job_id))) {
+    LOG_ERRNO("edc: failed to get job id");
+    return 0;
+  } else if (unlikely(-1 == ioctl(edcinfo->fd, SHA256_ACCEL_GET_NONCE_CURRENT, &nonce))) {
+    LOG_ERRNO("edc: failed to get current nonce");
+    return 0;
+  }
+
+  nonce -= EDC_NONCE_FIRST;
+
+  /* the core rewinds a little when it resumes after a candidate */
+  if (edcinfo->work_active && edcinfo->work_active->id == job_id) {
+    if (nonce > edcinfo->done_active) {
+      hashes = nonce - edcinfo->done_active;
+      edcinfo->done_active = nonce;
+    }
+  } else if (edcinfo->work_next && edcinfo->work_next->id == job_id) {
+    /* the handover interrupt has not been read yet */
+    if (nonce > edcinfo->done_next) {
+      hashes = nonce - edcinfo->done_next;
+      edcinfo->done_next = nonce;
+    }
+  }
+
+  return hashes;
+}
+
+static struct work* edc_find_work(struct cgpu_info* cgpu,
+    struct edc_info* edcinfo, uint32_t job_id) {
+  if (edcinfo->work_active && edcinfo->work_active->id == job_id)
+    return edcinfo->work_active;
+  if (edcinfo->work_next && edcinfo->work_next->id == job_id)
+    return edcinfo->work_next;
+  if (edcinfo->work_prev && edcinfo->work_prev->id == job_id)
+    return edcinfo->work_prev;
+  return find_queued_work_byid(cgpu, job_id);
+}
+
+/* drop everything that is on the core and reset it, e.g. on a block change */
+static int64_t edc_flush(struct thr_info* thr, struct edc_info* edcinfo) {
+  struct cgpu_info* cgpu = thr->cgpu;
+  int64_t hashes;
+
+  /* the nonces done so far count, even if the work is stale now */
+  hashes = edc_progress(edcinfo);
+
+  edcinfo->need_reset = true;
+  edc_reset(thr, edcinfo);
+  cgtime(&edcinfo->tv_idle);
+
+  if (edcinfo->work_prev)
+    work_completed(cgpu, edcinfo->work_prev);
+  if (edcinfo->work_active)
+    work_completed(cgpu, edcinfo->work_active);
+  if (edcinfo->work_next)
+    work_completed(cgpu, edcinfo->work_next);
+  if (edcinfo->work_pending)
+    work_completed(cgpu, edcinfo->work_pending);
+  edcinfo->work_prev = edcinfo->work_active = NULL;
+  edcinfo->work_next = edcinfo->work_pending = NULL;
+  edcinfo->done_active = edcinfo->done_next = 0;
+
+  return hashes;
+}
+
+static int64_t edc_handle_msg(struct thr_info* thr, struct edc_info* edcinfo,
+    struct sha256_accel_msg_s* msg) {
+  struct cgpu_info* cgpu = thr->cgpu;
+  char buf[128], *strerr;
+  int errsv;
+  struct work* work;
+
+  if (msg->status & (EDC_STATUS_FOUND | EDC_STATUS_CANDIDATE)) {
+    edcinfo->candidates++;
+    work = edc_find_work(cgpu, edcinfo, msg->job_id);
+    if (likely(work))
+      submit_nonce(thr, work, msg->nonce_candidate);
+    else
+      applog(LOG_ERR, "edc: candidate %08x for unknown job %08x",
+             msg->nonce_candidate, msg->job_id);
+
+    /* drained by the kernel while the core carried on */
+    if (!(msg->status & EDC_STATUS_FOUND))
+      return 0;
+
+    /* the core halted on the candidate, let it carry on with the range */
+    if (unlikely(-1 == ioctl(edcinfo->fd, SHA256_ACCEL_START))) {
+      LOG_ERRNO("edc: failed to resume after candidate");
+      edcinfo->need_reset = true;
+    }
+    return 0;
+  }
+
+  if (msg->status & EDC_STATUS_IDLE) {
+    cgtime(&edcinfo->tv_idle);
+    return edc_retire_active(cgpu, edcinfo);
+  }
+
+  if (edcinfo->work_next && msg->job_id == edcinfo->work_next->id)
+    return edc_retire_active(cgpu, edcinfo);
+
+  applog(LOG_DEBUG, "edc: ignoring message status=%08x job=%08x",
+         msg->status, msg->job_id);
+  return 0;
+}
+
+/* handle the messages already queued by the kernel, without waiting */
+static int64_t edc_drain(struct thr_info* thr, struct edc_info* edcinfo) {
+  int i, n;
+  int64_t hashes = 0;
+  struct sha256_accel_msg_s msgs[EDC_MSG_BATCH];
+
+  while ((n = edc_fetch(edcinfo, msgs, EDC_MSG_BATCH)) > 0)
+    for (i = 0; i < n; ++i)
+      hashes += edc_handle_msg(thr, edcinfo, &msgs[i]);
+
+  return hashes;
+}
+
+static bool edc_queue_full(struct cgpu_info* cgpu) {
+  struct edc_info* edcinfo = (struct edc_info*) cgpu->device_data;
+
+  if (!edcinfo->work_pending)
+    edcinfo->work_pending = get_queued(cgpu);
+
+  return edcinfo->work_pending != NULL;
+}
+
+static void edc_flush_work(struct cgpu_info* cgpu) {
+  struct edc_info* edcinfo = (struct edc_info*) cgpu->device_data;
+
+  /* picked up by the mining thread, which owns the device */
+  edcinfo->flush = true;
+}
+
+static int64_t edc_scanwork(struct thr_info* thr) {
+  struct cgpu_info* cgpu = thr->cgpu;
+  struct edc_info* edcinfo = (struct edc_info*) cgpu->device_data;
+  char buf[128], *strerr;
+  int errsv, i, n, ret, fd = edcinfo->fd, tempfd;
+  bool waited = false;
+  int64_t hashes = 0;
+  fd_set set;
+  struct timeval timeout;
+  struct sha256_accel_msg_s msgs[EDC_MSG_BATCH];
+
+  if (unlikely(edcinfo->flush)) {
+    edcinfo->flush = false;
+    /* candidates found before the restart are still worth submitting */
+    hashes = edc_drain(thr, edcinfo);
+    return hashes + edc_flush(thr, edcinfo);
+  }
+
+  if (unlikely(!edc_set_clock(edcinfo)))
+    return -1;
+
+  /* keep the core and its shadow bank loaded */
+  if (edcinfo->work_pending && !edcinfo->work_active) {
+    if (unlikely(!edc_start_work(thr, edcinfo, edcinfo->work_pending)))
+      return -1;
+    edcinfo->work_pending = NULL;
+  } else if (edcinfo->work_pending && !edcinfo->work_next) {
+    if (unlikely(!edc_queue_work(edcinfo, edcinfo->work_pending)))
+      return -1;
+    edcinfo->work_pending = NULL;
+  }
+
+  if (edcinfo->work_pending == NULL)
+    return 0;
+
+  timeout.tv_sec = 0;
+  timeout.tv_usec = EDC_POLL_US;
+
+  while (!edcinfo->flush) {
+    n = edc_fetch(edcinfo, msgs, EDC_MSG_BATCH);
+    if (unlikely(n < 0)) {
+      applog(LOG_ERR, "edc: short read");
+      return -1;
+    }
+
+    /* sleep once if there is nothing to do, then drain what came in */
+    if (n == 0) {
+      if (waited)
         break;
+
+      FD_ZERO(&set);
+      FD_SET(fd, &set);
+      if (unlikely(-1 == select(fd + 1, &set, NULL, NULL, &timeout))) {
+        LOG_ERRNO("edc: failed to select");
+        return -1;
       }
+      waited = true;
+      continue;
+    }
 
-      if (msg.status == 0x10) {
-        applog(LOG_ERR, "GOT A RESULT w00t");
-        submit_nonce(thr, work, msg.nonce_candidate);
-      } else
-        applog(LOG_ERR, "no result in this nonce domain :-(");
+    for (i = 0; i < n; ++i)
+      hashes += edc_handle_msg(thr, edcinfo, &msgs[i]);
+    if (!edcinfo->work_active || !edcinfo->work_next)
       break;
-    }
   }
 
-  if (unlikely(-1 == ioctl(fd, SHA256_ACCEL_GET_NONCE_CURRENT, &nonce_current))) {
-    LOG_ERRNO("edc: failed to get current nonce");
-    goto close;
+  if (likely(edcinfo->work_active))
+    hashes += edc_progress(edcinfo);
+
+  /* we are still alive! please don't kill us! we'll do everything! :-( */
+  cgtime(&thr->last);
+  tempfd = open(TEMPFILE, O_RDONLY);
+  if (tempfd != -1) {
+    ret = read(tempfd, buf, sizeof(buf) - 1);
+    if (ret > 0) {
+      buf[MIN(ret, 127)] = '\0';
+      sscanf(buf, "%lf", &cgpu->temp);
+    }
+    close(tempfd);
   }
 
-  hashes = (int64_t) nonce_current;
-
-close:
-  mutex_lock(&edcinfo->fd_lock);
-  close(fd);
-  edcinfo->fd = -1;
-  mutex_unlock(&edcinfo->fd_lock);
-  applog(LOG_ERR, "edc: hashed %lld hashes", hashes);
   return hashes;
 }
 
@@ -259,12 +713,13 @@ static void edc_get_statline_before(char* outbuf, size_t bufsiz,
     goto close;
   }
 
-  if (unlikely(-1 == ioctl(edcinfo->fd, SHA256_ACCEL_GET_STATUS, &status))) {
+  if (edcinfo->regs) {
+    status = edcinfo->regs[SHA256_ACCEL_REG_STATUS];
+    nonce = edcinfo->regs[SHA256_ACCEL_REG_NONCE_CURRENT];
+  } else if (unlikely(-1 == ioctl(edcinfo->fd, SHA256_ACCEL_GET_STATUS, &status))) {
     LOG_ERRNO("edc: failed to retrieve hw status");
     goto close;
-  }
-
-  if (unlikely(-1 == ioctl(edcinfo->fd, SHA256_ACCEL_GET_NONCE_CURRENT, &nonce))) {
+  } else if (unlikely(-1 == ioctl(edcinfo->fd, SHA256_ACCEL_GET_NONCE_CURRENT, &nonce))) {
     LOG_ERRNO("edc: failed to get current nonce");
     goto close;
   }
@@ -277,12 +732,108 @@ close:
   mutex_unlock(&edcinfo->fd_lock);
 }
 
+static struct api_data* edc_api_stats(struct cgpu_info* cgpu) {
+  struct edc_info* edcinfo = (struct edc_info*) cgpu->device_data;
+  struct api_data* root = NULL;
+  struct timeval now;
+  double avg = 0.0, idle = 0.0, elapsed;
+  uint32_t overflows = 0, status = 0;
+  bool fifo_overflow;
+
+  if (edcinfo->works)
+    avg = edcinfo->latency_total / edcinfo->works;
+
+  cgtime(&now);
+  elapsed = tdiff(&now, &edcinfo->tv_session);
+  if (elapsed > 0.0)
+    idle = edcinfo->idle_total / elapsed * 100.0;
+
+  /* results the kernel had to drop because we did not read them in time */
+  mutex_lock(&edcinfo->fd_lock);
+  if (edcinfo->ring)
+    overflows = edcinfo->ring->overflows;
+  else if (edcinfo->fd != -1)
+    ioctl(edcinfo->fd, SHA256_ACCEL_GET_OVERFLOWS, &overflows);
+  /* candidates the core had to drop, the fifo was not drained in time */
+  if (edcinfo->regs)
+    status = edcinfo->regs[SHA256_ACCEL_REG_STATUS];
+  else if (edcinfo->fd != -1)
+    ioctl(edcinfo->fd, SHA256_ACCEL_GET_STATUS, &status);
+  mutex_unlock(&edcinfo->fd_lock);
+  fifo_overflow = !!(status & SHA256_ACCEL_STATUS_FIFO_OVERFLOW);
+
+  root = api_add_uint32(root, "Clock", &edcinfo->clock_set, false);
+  root = api_add_uint64(root, "Works", &edcinfo->works, false);
+  root = api_add_double(root, "Work Latency Last", &edcinfo->latency_last, false);
+  root = api_add_double(root, "Work Latency Avg", &avg, true);
+  root = api_add_double(root, "Work Latency Max", &edcinfo->latency_max, false);
+  root = api_add_elapsed(root, "Core Idle", &edcinfo->idle_total, false);
+  root = api_add_percent(root, "Core Idle Percent", &idle, true);
+  root = api_add_uint32(root, "Result Overflows", &overflows, true);
+  root = api_add_uint64(root, "Candidates", &edcinfo->candidates, false);
+  root = api_add_bool(root, "Candidate FIFO Overflow", &fifo_overflow, true);
+
+  return root;
+}
+
+static void edc_zero_stats(struct cgpu_info* cgpu) {
+  struct edc_info* edcinfo = (struct edc_info*) cgpu->device_data;
+
+  edcinfo->works = 0;
+  edcinfo->latency_last = 0.0;
+  edcinfo->latency_max = 0.0;
+  edcinfo->latency_total = 0.0;
+  edcinfo->idle_total = 0.0;
+  edcinfo->candidates = 0;
+  cgtime(&edcinfo->tv_session);
+}
+
+static char* edc_set_device(struct cgpu_info* cgpu, char* option,
+    char* setting, char* replybuf) {
+  int val;
+
+  if (strcasecmp(option, "help") == 0) {
+    sprintf(replybuf, "clock: range %u-%u", EDC_MIN_CLOCK, EDC_MAX_CLOCK);
+    return replybuf;
+  }
+
+  if (strcasecmp(option, "clock") == 0) {
+    if (!setting || !*setting) {
+      sprintf(replybuf, "missing clock setting");
+      return replybuf;
+    }
+
+    val = atoi(setting);
+    if (val < (int) EDC_MIN_CLOCK || val > (int) EDC_MAX_CLOCK) {
+      sprintf(replybuf, "invalid clock: '%s' valid range %u-%u",
+              setting, EDC_MIN_CLOCK, EDC_MAX_CLOCK);
+      return replybuf;
+    }
+
+    /* the clock is shared by all cores, every mining thread picks it up
+     * before it loads its next work */
+    edc_clock = (uint32_t) val;
+    return NULL;
+  }
+
+  sprintf(replybuf, "Unknown option: %s", option);
+  return replybuf;
+}
+
 
 struct device_drv edc_drv = {
   .drv_id = DRIVER_edc,
   .dname = "edcKernel",
   .name = "edc",
   .drv_detect = edc_drv_detect,
-  .scanhash = edc_scanhash,
+  .thread_prepare = edc_thread_prepare,
+  .thread_shutdown = edc_thread_shutdown,
+  .hash_work = hash_queued_work,
+  .queue_full = edc_queue_full,
+  .scanwork = edc_scanwork,
+  .flush_work = edc_flush_work,
   .get_statline_before = edc_get_statline_before,
+  .get_api_stats = edc_api_stats,
+  .set_device = edc_set_device,
+  .zero_stats = edc_zero_stats,
 };
@@ -252,9 +252,14 @@ static inline int fsync (int fd)
 	DRIVER_ADD_COMMAND(avalon) \
 	DRIVER_ADD_COMMAND(spondoolies)
 
+/* hashing on the host itself, counted neither as PGA nor as ASIC */
+#define CPU_PARSE_COMMANDS(DRIVER_ADD_COMMAND) \
+	DRIVER_ADD_COMMAND(cpu)
+
 #define DRIVER_PARSE_COMMANDS(DRIVER_ADD_COMMAND) \
 	FPGA_PARSE_COMMANDS(DRIVER_ADD_COMMAND) \
-	ASIC_PARSE_COMMANDS(DRIVER_ADD_COMMAND)
+	ASIC_PARSE_COMMANDS(DRIVER_ADD_COMMAND) \
+	CPU_PARSE_COMMANDS(DRIVER_ADD_COMMAND)
 
 #define DRIVER_ENUM(X) DRIVER_##X,
 #define DRIVER_PROTOTYPE(X) struct device_drv X##_drv;
@@ -421,6 +426,11 @@ struct cgminer_pool_stats {
 	uint64_t times_received;
 	uint64_t bytes_received;
 	uint64_t net_bytes_received;
+	uint64_t send_syscalls;
+	uint64_t shares_sent;
+	uint64_t share_sends;
+	uint64_t share_syscalls;
+	double share_wait_ms; /* summed over shares_sent, found to sent */
 };
 
 struct cgpu_info {
@@ -513,6 +523,8 @@ struct cgpu_info {
 
 	pthread_rwlock_t qlock;
 	struct work *queued_work;
+	/* the same work keyed by midstate and data[64..75] */
+	struct work *queued_bymid;
 	struct work *unqueued_work;
 	unsigned int queued_count;
 
@@ -523,11 +535,32 @@ struct cgpu_info {
 
 extern bool add_cgpu(struct cgpu_info*);
 
+struct tq_slot {
+	unsigned int	seq;
+	void		*data;
+};
+
+/* A bounded ring of entries pushed and popped without locks, see util.c */
 struct thread_q {
-	struct list_head	q;
+	struct tq_slot	*ring;
+	unsigned int	mask;
 
 	bool frozen;
 
+	/* Futex word bumped to wake poppers waiting for an entry, and how
+	 * many are waiting. Pushers never wait. */
+	int		pop_wake;
+	int		pop_waiters;
+
+	/* head and tail each get a cache line to themselves */
+	char		pad_head[64];
+	unsigned int	head;
+	char		pad_tail[64];
+	unsigned int	tail;
+	char		pad_end[64];
+
+	/* Only slept on where there are no futexes. We use getq's as the
+	 * staged lock and cond. */
 	pthread_mutex_t		mutex;
 	pthread_cond_t		cond;
 };
@@ -1039,6 +1072,10 @@ extern char *get_proxy(char *url, struct pool *pool);
 extern void __bin2hex(char *s, const unsigned char *p, size_t len);
 extern char *bin2hex(const unsigned char *p, size_t len);
 extern bool hex2bin(unsigned char *p, const char *hexstr, size_t len);
+extern char *refstr_new(const char *str);
+extern char *refstr_bin2hex(const unsigned char *p, size_t len);
+extern char *refstr_get(char *s);
+extern void refstr_put(char *s);
 
 typedef bool (*sha256_func)(struct thr_info*, const unsigned char *pmidstate,
 	unsigned char *pdata,
@@ -1149,10 +1186,18 @@ struct stratum_work {
 
 #define RBUFSIZE 8192
 #define RECVSIZE (RBUFSIZE - 4)
+#define SUBMIT_LATENCIES 256
+/* Seconds a stratum share is waited on for a response */
+#define SSHARE_TIMEOUT 120
+/* Expiry wheel slots, a power of two with one per second of the timeout */
+#define SSHARE_WHEEL 128
+#define SSHARE_RTT_BUCKETS 9
 
 struct pool {
 	int pool_no;
 	int prio;
+	/* Never reused or renumbered, unlike pool_no, for the stats shards */
+	int stats_id;
 	int64_t accepted, rejected;
 	int seq_rejects;
 	int seq_getfails;
@@ -1218,6 +1263,11 @@ struct pool {
 	struct cgminer_stats cgminer_stats;
 	struct cgminer_pool_stats cgminer_pool_stats;
 
+	/* The last SUBMIT_LATENCIES times in ms from finding a share to the
+	 * pool's reply, slots taken with an atomic add and read unlocked */
+	double submit_latency[SUBMIT_LATENCIES];
+	int submit_latencies;
+
 	/* The last block this particular pool knows about */
 	char prev_block[32];
 
@@ -1228,6 +1278,8 @@ struct pool {
 	SOCKETTYPE sock;
 	char *sockbuf;
 	size_t sockbuf_size;
+	/* Unread bytes in sockbuf, and how many of them hold no \n */
+	size_t sockbuf_start, sockbuf_len, sockbuf_scan;
 	char *sockaddr_url; /* stripped url used for sockaddr */
 	char *sockaddr_proxy_url;
 	char *sockaddr_proxy_port;
@@ -1241,12 +1293,27 @@ struct pool {
 	bool stratum_active;
 	bool stratum_init;
 	bool stratum_notify;
+	/* A client.reconnect to make once the line it came in is done with */
+	bool stratum_reconnect;
 	struct stratum_work swork;
+	/* what every work of the current job shares, as refstrs */
+	char *work_job_id;
+	char *work_nonce1;
+	char *work_ntime;
 	pthread_t stratum_sthread;
 	pthread_t stratum_rthread;
 	pthread_mutex_t stratum_lock;
 	struct thread_q *stratum_q;
 	int sshares; /* stratum shares submitted waiting on response */
+	/* Those shares by id and in the wheel slot of the second they were
+	 * found in, under sshare_lock. sshare_swept is the last second whose
+	 * slot has been expired. */
+	pthread_mutex_t sshare_lock;
+	struct stratum_share *stratum_shares;
+	struct list_head sshare_wheel[SSHARE_WHEEL];
+	time_t sshare_swept;
+	/* Response round trip times counted in sshare_rtt_bounds ranges */
+	uint64_t sshare_rtt[SSHARE_RTT_BUCKETS];
 
 	/* GBT  variables */
 	bool has_gbt;
@@ -1279,6 +1346,11 @@ struct pool {
 	unsigned char *coinbase;
 	int coinbase_len;
 	int nonce2_offset;
+	/* the coinbase's whole blocks before nonce2, as they were when
+	 * coinbase_mid was hashed from them */
+	unsigned char *coinbase_prefix;
+	int coinbase_prefix_len;
+	uint32_t coinbase_mid[8];
 	unsigned char header_bin[128];
 	int merkles;
 	char prev_hash[68];
@@ -1298,6 +1370,9 @@ struct pool {
 #define GETWORK_MODE_GBT 'G'
 #define GETWORK_MODE_SOLO 'C'
 
+/* midstate and the 12 bytes of data after it, what identifies queued work */
+#define QUEUED_KEY_LEN (32 + 12)
+
 struct work {
 	unsigned char	data[128];
 	unsigned char	midstate[32];
@@ -1341,6 +1416,10 @@ struct work {
 	unsigned int	work_block;
 	uint32_t	id;
 	UT_hash_handle	hh;
+	struct list_head staged;
+	/* Copied when queued, see __add_queued() */
+	unsigned char	queued_key[QUEUED_KEY_LEN];
+	UT_hash_handle	hh_mid;
 
 	double		work_difficulty;
 
@@ -1440,6 +1519,14 @@ extern void remove_pool(struct pool *pool);
 extern void write_config(FILE *fcfg);
 extern void zero_bestshare(void);
 extern void zero_stats(void);
+extern void stats_fold(void);
+extern void stgd_lock_stats(uint64_t *locks, double *hold_avg, double *hold_max);
+extern void work_pool_stats(uint64_t *allocs, uint64_t *reuses);
+extern void pool_submit_latency(struct pool *pool, double *p50, double *p90, double *p99);
+extern const int sshare_rtt_bounds[SSHARE_RTT_BUCKETS - 1];
+extern void pool_share_rtt(struct pool *pool, uint64_t *rtt);
+extern void gen_batch_stats(uint64_t *batches, double *avg, int *max, uint64_t *discarded,
+			    double *rate);
 extern void default_save_file(char *filename);
 extern bool log_curses_only(int prio, const char *datetime, const char *str);
 extern void clear_logwin(void);
@@ -1449,6 +1536,7 @@ extern struct thread_q *tq_new(void);
 extern void tq_free(struct thread_q *tq);
 extern bool tq_push(struct thread_q *tq, void *data);
 extern void *tq_pop(struct thread_q *tq, const struct timespec *abstime);
+extern int tq_pop_batch(struct thread_q *tq, void **data, int max, const struct timespec *abstime);
 extern void tq_freeze(struct thread_q *tq);
 extern void tq_thaw(struct thread_q *tq);
 extern bool successful_connect;
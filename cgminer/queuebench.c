@@ -0,0 +1,150 @@
+/*
+ * per lookup cost of finding a device's queued work by id and by midstate,
+ * for queue depths up to what the deepest queued drivers keep. the tables are
+ * built the way __add_queued() builds cgpu->queued_work and cgpu->queued_bymid,
+ * searched as __find_work_byid() and __find_work_bymidstate() do now and as
+ * they did by walking the whole table. build with "make queuebench".
+ */
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "uthash.h"
+
+#define BENCH_NS 200000000LL
+#define KEY_LEN (32 + 12)
+
+/* the parts of struct work the lookups touch */
+struct qwork {
+	unsigned char data[128];
+	unsigned char midstate[32];
+	uint32_t id;
+	UT_hash_handle hh;
+	unsigned char queued_key[KEY_LEN];
+	UT_hash_handle hh_mid;
+};
+
+static struct qwork *queued, *queued_bymid, *works;
+static int depth;
+static volatile uint32_t sink;
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void fill(int n)
+{
+	int i, j;
+
+	HASH_CLEAR(hh, queued);
+	HASH_CLEAR(hh_mid, queued_bymid);
+	free(works);
+	works = calloc(n, sizeof(*works));
+	if (!works)
+		exit(1);
+
+	/* ids are handed out in sequence, midstates look random */
+	for (i = 0; i < n; i++) {
+		struct qwork *work = &works[i];
+
+		work->id = 1000 + i;
+		for (j = 0; j < 32; j++)
+			work->midstate[j] = rand();
+		for (j = 64; j < 76; j++)
+			work->data[j] = rand();
+		HASH_ADD_INT(queued, id, work);
+		memcpy(work->queued_key, work->midstate, 32);
+		memcpy(work->queued_key + 32, work->data + 64, 12);
+		HASH_ADD(hh_mid, queued_bymid, queued_key, KEY_LEN, work);
+	}
+	depth = n;
+}
+
+static struct qwork *scan_byid(uint32_t id)
+{
+	struct qwork *work, *tmp;
+
+	HASH_ITER(hh, queued, work, tmp) {
+		if (work->id == id)
+			return work;
+	}
+	return NULL;
+}
+
+static struct qwork *find_byid(uint32_t id)
+{
+	struct qwork *ret = NULL;
+
+	HASH_FIND_INT(queued, &id, ret);
+	return ret;
+}
+
+static struct qwork *scan_bymid(const struct qwork *want)
+{
+	struct qwork *work, *tmp;
+
+	HASH_ITER(hh, queued, work, tmp) {
+		if (!memcmp(work->midstate, want->midstate, 32) &&
+		    !memcmp(work->data + 64, want->data + 64, 12))
+			return work;
+	}
+	return NULL;
+}
+
+static struct qwork *find_bymid(const struct qwork *want)
+{
+	unsigned char key[KEY_LEN];
+	struct qwork *ret = NULL;
+
+	/* the key is put together from the result, as the drivers hand it in */
+	memcpy(key, want->midstate, 32);
+	memcpy(key + 32, want->data + 64, 12);
+	HASH_FIND(hh_mid, queued_bymid, key, KEY_LEN, ret);
+	return ret;
+}
+
+/* ns per lookup, cycling through every queued work */
+static double bench(int bymid, int keyed)
+{
+	long long start = now_ns(), calls = 0;
+	struct qwork *work;
+	int i;
+
+	do {
+		for (i = 0; i < 1000; i++) {
+			work = &works[(calls + i) % depth];
+			if (bymid)
+				work = keyed ? find_bymid(work) : scan_bymid(work);
+			else
+				work = keyed ? find_byid(work->id) : scan_byid(work->id);
+			sink += work->id;
+		}
+		calls += 1000;
+	} while (now_ns() - start < BENCH_NS);
+
+	return (double)(now_ns() - start) / calls;
+}
+
+int main(void)
+{
+	static const int depths[] = { 16, 64, 256, 1024, 4096 };
+	unsigned int i;
+
+	printf("%-8s %12s %12s %12s %12s\n", "depth", "id scan ns", "id find ns",
+	       "mid scan ns", "mid find ns");
+	for (i = 0; i < sizeof(depths) / sizeof(depths[0]); i++) {
+		fill(depths[i]);
+		printf("%-8d %12.1f %12.1f %12.1f %12.1f\n", depth, bench(0, 0),
+		       bench(0, 1), bench(1, 0), bench(1, 1));
+	}
+
+	return 0;
+}
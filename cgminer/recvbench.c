@@ -0,0 +1,268 @@
+/*
+ * per message cost of splitting stratum traffic into lines as recv_line() did
+ * (strcat, strstr, strtok, strdup and memmove over a \0 terminated sockbuf)
+ * and as it does now (a length tracked sockbuf, only searched once, the line
+ * handed out in place), plus the json_loads() that follows either. traffic is
+ * replayed in RECVSIZE pieces, as recv() hands it over, from a file of
+ * captured lines (as logged by --protocol, anything up to "RECVD: " is
+ * skipped) or made up as mining.notify messages with more and more merkle
+ * branches. build with "make recvbench", run as "recvbench [capture]".
+ */
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <jansson.h>
+
+#define BENCH_NS 200000000LL
+#define RBUFSIZE 8192
+#define RECVSIZE (RBUFSIZE - 4)
+
+struct sockbuf {
+	char *buf;
+	size_t size, start, len, scan;
+};
+
+static char *traffic;
+static size_t traffic_len;
+static int messages;
+static volatile size_t sink;
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void add_line(const char *line, size_t len)
+{
+	traffic = realloc(traffic, traffic_len + len + 1);
+	if (!traffic)
+		exit(1);
+	memcpy(traffic + traffic_len, line, len);
+	traffic_len += len;
+	traffic[traffic_len++] = '\n';
+	messages++;
+}
+
+static void make_notifies(int merkles)
+{
+	char *line = malloc(1024 + merkles * 80), *p;
+	int i, j;
+
+	if (!line)
+		exit(1);
+	free(traffic);
+	traffic = NULL;
+	traffic_len = 0;
+	messages = 0;
+
+	for (i = 0; i < 16; i++) {
+		p = line + sprintf(line, "{\"params\": [\"%x\", \"%064x\", \"%0200x\", \"%0100x\", [",
+				   i, i, i, i);
+		for (j = 0; j < merkles; j++)
+			p += sprintf(p, "%s\"%064x\"", j ? ", " : "", i * merkles + j);
+		p += sprintf(p, "], \"20000000\", \"1b00f339\", \"5e8f5ac1\", %s], "
+			     "\"id\": null, \"method\": \"mining.notify\"}", i ? "false" : "true");
+		add_line(line, p - line);
+	}
+	free(line);
+}
+
+static void load_capture(const char *path)
+{
+	char *line = NULL, *start;
+	size_t size = 0;
+	ssize_t len;
+	FILE *f = fopen(path, "r");
+
+	if (!f) {
+		perror(path);
+		exit(1);
+	}
+	while ((len = getline(&line, &size, f)) > 0) {
+		start = strstr(line, "RECVD: ");
+		start = start ? start + 7 : line;
+		len -= start - line;
+		if (len && start[len - 1] == '\n')
+			len--;
+		if (len)
+			add_line(start, len);
+	}
+	free(line);
+	fclose(f);
+}
+
+/* the old recv_line() with the recv() of *pos */
+static char *old_recv_line(char **sockbuf, size_t *sockbuf_size, size_t *pos)
+{
+	char *tok, *sret;
+	ssize_t len, buflen;
+
+	while (!strstr(*sockbuf, "\n") && *pos < traffic_len) {
+		char s[RBUFSIZE];
+		size_t slen, n = traffic_len - *pos;
+
+		if (n > RECVSIZE)
+			n = RECVSIZE;
+		memset(s, 0, RBUFSIZE);
+		memcpy(s, traffic + *pos, n);
+		*pos += n;
+
+		slen = strlen(s);
+		if (strlen(*sockbuf) + slen + 1 >= *sockbuf_size) {
+			size_t old = strlen(*sockbuf), new = old + slen + 1;
+
+			new = new + (RBUFSIZE - (new % RBUFSIZE));
+			*sockbuf = realloc(*sockbuf, new);
+			memset(*sockbuf + old, 0, new - old);
+			*sockbuf_size = new;
+		}
+		strcat(*sockbuf, s);
+	}
+
+	buflen = strlen(*sockbuf);
+	tok = strtok(*sockbuf, "\n");
+	if (!tok)
+		return NULL;
+	sret = strdup(tok);
+	len = strlen(sret);
+	if (buflen > len + 1)
+		memmove(*sockbuf, *sockbuf + len + 1, buflen - len + 1);
+	else
+		strcpy(*sockbuf, "");
+	return sret;
+}
+
+/* sockbuf_reserve(), sockbuf_eol() and recv_line() as they are in util.c */
+static void sb_reserve(struct sockbuf *sb, size_t len)
+{
+	size_t new;
+
+	if (sb->start + sb->len + len < sb->size)
+		return;
+	if (sb->start) {
+		memmove(sb->buf, sb->buf + sb->start, sb->len);
+		sb->start = 0;
+		if (sb->len + len < sb->size)
+			return;
+	}
+	new = sb->len + len + 1;
+	new = new + (RBUFSIZE - (new % RBUFSIZE));
+	sb->buf = realloc(sb->buf, new);
+	sb->size = new;
+}
+
+static char *sb_eol(struct sockbuf *sb)
+{
+	char *eol;
+
+	while (sb->len && sb->buf[sb->start] == '\n') {
+		sb->start++;
+		sb->len--;
+		sb->scan = 0;
+	}
+	eol = memchr(sb->buf + sb->start + sb->scan, '\n', sb->len - sb->scan);
+	if (!eol)
+		sb->scan = sb->len;
+	return eol;
+}
+
+static char *new_recv_line(struct sockbuf *sb, size_t *pos)
+{
+	char *eol, *sret;
+	size_t len;
+
+	eol = sb_eol(sb);
+	while (!eol && *pos < traffic_len) {
+		size_t n = traffic_len - *pos;
+
+		if (n > RECVSIZE)
+			n = RECVSIZE;
+		sb_reserve(sb, RECVSIZE);
+		memcpy(sb->buf + sb->start + sb->len, traffic + *pos, n);
+		*pos += n;
+		sb->len += n;
+		eol = sb_eol(sb);
+	}
+	if (!eol)
+		return NULL;
+
+	sret = sb->buf + sb->start;
+	*eol = '\0';
+	len = eol - sret;
+	sb->start += len + 1;
+	sb->len -= len + 1;
+	sb->scan = 0;
+	return sret;
+}
+
+/* ns per message over whole replays of the traffic */
+static double bench(int new, int parse)
+{
+	long long start = now_ns(), calls = 0;
+	struct sockbuf sb = { NULL, 0, 0, 0, 0 };
+	size_t old_size = RBUFSIZE, pos;
+	char *old_buf = calloc(RBUFSIZE, 1), *line;
+	json_error_t err;
+	json_t *val;
+
+	sb_reserve(&sb, RECVSIZE);
+	do {
+		pos = 0;
+		while ((line = new ? new_recv_line(&sb, &pos) :
+			old_recv_line(&old_buf, &old_size, &pos))) {
+			if (parse) {
+				val = json_loads(line, 0, &err);
+				sink += val ? 1 : 0;
+				json_decref(val);
+			} else
+				sink += line[0];
+			if (!new)
+				free(line);
+			calls++;
+		}
+	} while (now_ns() - start < BENCH_NS);
+
+	free(old_buf);
+	free(sb.buf);
+	return (double)(now_ns() - start) / calls;
+}
+
+static void report(const char *name)
+{
+	printf("%-12s %8d %10zu %12.1f %12.1f %12.1f %12.1f\n", name, messages,
+	       traffic_len / messages, bench(0, 0), bench(1, 0), bench(0, 1), bench(1, 1));
+}
+
+int main(int argc, char **argv)
+{
+	static const int merkles[] = { 12, 64, 512, 4096 };
+	char name[32];
+	unsigned int i;
+
+	printf("%-12s %8s %10s %12s %12s %12s %12s\n", "traffic", "messages", "avg bytes",
+	       "old split ns", "new split ns", "old+json ns", "new+json ns");
+	if (argc > 1) {
+		load_capture(argv[1]);
+		if (!messages) {
+			fprintf(stderr, "%s: no messages\n", argv[1]);
+			return 1;
+		}
+		report("capture");
+		return 0;
+	}
+
+	for (i = 0; i < sizeof(merkles) / sizeof(merkles[0]); i++) {
+		make_notifies(merkles[i]);
+		sprintf(name, "notify/%d", merkles[i]);
+		report(name);
+	}
+
+	return 0;
+}
@@ -36,6 +36,16 @@
 
 #include "sha2.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define SHA2_HW_X86
+#elif defined(__aarch64__)
+#include <sys/auxv.h>
+#include <arm_neon.h>
+#define SHA2_HW_ARM
+#endif
+
 #define UNPACK32(x, str)                      \
 {                                             \
     *((str) + 3) = (uint8_t) ((x)      );       \
@@ -82,8 +92,8 @@ uint32_t sha256_k[64] =
 
 /* SHA-256 functions */
 
-void sha256_transf(sha256_ctx *ctx, const unsigned char *message,
-                   unsigned int block_nb)
+static void sha256_transf_generic(sha256_ctx *ctx, const unsigned char *message,
+                                  unsigned int block_nb)
 {
     uint32_t w[64];
     uint32_t wv[8];
@@ -128,6 +138,144 @@ void sha256_transf(sha256_ctx *ctx, const unsigned char *message,
     }
 }
 
+#ifdef SHA2_HW_X86
+/* SHA extensions: two rounds per sha256rnds2, the state split into the
+ * ABEF/CDGH halves the instruction wants */
+__attribute__((target("sha,sse4.1")))
+static void sha256_transf_shani(sha256_ctx *ctx, const unsigned char *message,
+                                unsigned int block_nb)
+{
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+                                        0x0405060700010203ULL);
+    __m128i state0, state1, abef, cdgh, msg, tmp, w[4];
+    unsigned int i;
+    int g;
+
+    tmp = _mm_loadu_si128((const __m128i *) &ctx->h[0]);
+    state1 = _mm_loadu_si128((const __m128i *) &ctx->h[4]);
+    tmp = _mm_shuffle_epi32(tmp, 0xb1);
+    state1 = _mm_shuffle_epi32(state1, 0x1b);
+    state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+    for (i = 0; i < block_nb; i++, message += SHA256_BLOCK_SIZE) {
+        abef = state0;
+        cdgh = state1;
+
+        for (g = 0; g < 4; g++)
+            w[g] = _mm_shuffle_epi8(_mm_loadu_si128(
+                    (const __m128i *) (message + 16 * g)), mask);
+
+        /* four rounds per group, w[g & 3] holding their message words */
+#pragma GCC unroll 16
+        for (g = 0; g < 16; g++) {
+            msg = _mm_add_epi32(w[g & 3],
+                    _mm_loadu_si128((const __m128i *) &sha256_k[4 * g]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            if (g >= 3 && g < 15) {
+                tmp = _mm_alignr_epi8(w[g & 3], w[(g - 1) & 3], 4);
+                w[(g + 1) & 3] = _mm_add_epi32(w[(g + 1) & 3], tmp);
+                w[(g + 1) & 3] = _mm_sha256msg2_epu32(w[(g + 1) & 3], w[g & 3]);
+            }
+            msg = _mm_shuffle_epi32(msg, 0x0e);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+            if (g >= 1 && g < 13)
+                w[(g - 1) & 3] = _mm_sha256msg1_epu32(w[(g - 1) & 3], w[g & 3]);
+        }
+
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1b);
+    state1 = _mm_shuffle_epi32(state1, 0xb1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+    _mm_storeu_si128((__m128i *) &ctx->h[0], state0);
+    _mm_storeu_si128((__m128i *) &ctx->h[4], state1);
+}
+
+static bool sha256_has_shani(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_1))
+        return false;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        return false;
+    return !!(ebx & bit_SHA);
+}
+#endif /* SHA2_HW_X86 */
+
+#ifdef SHA2_HW_ARM
+/* ARMv8 crypto extensions: four rounds per sha256h/sha256h2 pair */
+__attribute__((target("+crypto")))
+static void sha256_transf_armv8(sha256_ctx *ctx, const unsigned char *message,
+                                unsigned int block_nb)
+{
+    uint32x4_t state0, state1, abcd, efgh, wk, tmp, w[4];
+    unsigned int i;
+    int g;
+
+    state0 = vld1q_u32(&ctx->h[0]);
+    state1 = vld1q_u32(&ctx->h[4]);
+
+    for (i = 0; i < block_nb; i++, message += SHA256_BLOCK_SIZE) {
+        abcd = state0;
+        efgh = state1;
+
+        for (g = 0; g < 4; g++)
+            w[g] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(message + 16 * g)));
+
+#pragma GCC unroll 16
+        for (g = 0; g < 16; g++) {
+            wk = vaddq_u32(w[g & 3], vld1q_u32(&sha256_k[4 * g]));
+            if (g < 12)
+                w[g & 3] = vsha256su0q_u32(w[g & 3], w[(g + 1) & 3]);
+            tmp = state0;
+            state0 = vsha256hq_u32(state0, state1, wk);
+            state1 = vsha256h2q_u32(state1, tmp, wk);
+            if (g < 12)
+                w[g & 3] = vsha256su1q_u32(w[g & 3], w[(g + 2) & 3],
+                                           w[(g + 3) & 3]);
+        }
+
+        state0 = vaddq_u32(state0, abcd);
+        state1 = vaddq_u32(state1, efgh);
+    }
+
+    vst1q_u32(&ctx->h[0], state0);
+    vst1q_u32(&ctx->h[4], state1);
+}
+#endif /* SHA2_HW_ARM */
+
+static void (*sha256_transf_fn)(sha256_ctx *ctx, const unsigned char *message,
+                                unsigned int block_nb) = sha256_transf_generic;
+
+const char *sha256_select(void)
+{
+#ifdef SHA2_HW_X86
+    if (sha256_has_shani()) {
+        sha256_transf_fn = sha256_transf_shani;
+        return "SHA-NI";
+    }
+#endif
+#ifdef SHA2_HW_ARM
+    if (getauxval(AT_HWCAP) & HWCAP_SHA2) {
+        sha256_transf_fn = sha256_transf_armv8;
+        return "ARMv8 SHA2";
+    }
+#endif
+    sha256_transf_fn = sha256_transf_generic;
+    return "generic";
+}
+
+void sha256_transf(sha256_ctx *ctx, const unsigned char *message,
+                   unsigned int block_nb)
+{
+    sha256_transf_fn(ctx, message, block_nb);
+}
+
 void sha256(const unsigned char *message, unsigned int len, unsigned char *digest)
 {
     sha256_ctx ctx;
@@ -137,6 +285,58 @@ void sha256(const unsigned char *message, unsigned int len, unsigned char *diges
     sha256_final(&ctx, digest);
 }
 
+/* sha256(sha256(message)) without the context bookkeeping: the whole
+ * blocks are hashed in place and the padding of the second hash is fixed */
+void sha256d(const unsigned char *message, unsigned int len, unsigned char *digest)
+{
+    sha256d_resume(sha256_h0, 0, message, len, digest);
+}
+
+/* the state after the first blocks of a message, for sha256d_resume() */
+void sha256_midstate(const unsigned char *message, unsigned int block_nb,
+                     uint32_t state[8])
+{
+    sha256_ctx ctx;
+
+    memcpy(ctx.h, sha256_h0, sizeof(ctx.h));
+    sha256_transf_fn(&ctx, message, block_nb);
+    memcpy(state, ctx.h, sizeof(ctx.h));
+}
+
+/* sha256d() of a message whose first done bytes, whole blocks, are already
+ * hashed into state. message and len are the rest of it */
+void sha256d_resume(const uint32_t state[8], unsigned int done,
+                    const unsigned char *message, unsigned int len,
+                    unsigned char *digest)
+{
+    unsigned char block[2 * SHA256_BLOCK_SIZE];
+    unsigned int full = len / SHA256_BLOCK_SIZE, rem = len % SHA256_BLOCK_SIZE;
+    unsigned int block_nb = rem < SHA256_BLOCK_SIZE - 8 ? 1 : 2;
+    sha256_ctx ctx;
+    int i;
+
+    memcpy(ctx.h, state, sizeof(ctx.h));
+    sha256_transf_fn(&ctx, message, full);
+
+    memcpy(block, message + full * SHA256_BLOCK_SIZE, rem);
+    memset(block + rem, 0, block_nb * SHA256_BLOCK_SIZE - rem);
+    block[rem] = 0x80;
+    UNPACK32((done + len) << 3, block + block_nb * SHA256_BLOCK_SIZE - 4);
+    sha256_transf_fn(&ctx, block, block_nb);
+
+    for (i = 0; i < 8; i++)
+        UNPACK32(ctx.h[i], &block[i << 2]);
+    memset(block + SHA256_DIGEST_SIZE, 0, SHA256_BLOCK_SIZE - SHA256_DIGEST_SIZE);
+    block[SHA256_DIGEST_SIZE] = 0x80;
+    UNPACK32(SHA256_DIGEST_SIZE << 3, block + SHA256_BLOCK_SIZE - 4);
+
+    memcpy(ctx.h, sha256_h0, sizeof(ctx.h));
+    sha256_transf_fn(&ctx, block, 1);
+
+    for (i = 0; i < 8; i++)
+        UNPACK32(ctx.h[i], &digest[i << 2]);
+}
+
 void sha256_init(sha256_ctx *ctx)
 {
     int i;
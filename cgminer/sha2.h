@@ -58,6 +58,7 @@ typedef struct {
     uint32_t h[8];
 } sha256_ctx;
 
+extern uint32_t sha256_h0[8];
 extern uint32_t sha256_k[64];
 
 void sha256_init(sha256_ctx * ctx);
@@ -66,5 +67,26 @@ void sha256_update(sha256_ctx *ctx, const unsigned char *message,
 void sha256_final(sha256_ctx *ctx, unsigned char *digest);
 void sha256(const unsigned char *message, unsigned int len,
             unsigned char *digest);
+/* double sha256, as used for headers and merkle nodes */
+void sha256d(const unsigned char *message, unsigned int len,
+             unsigned char *digest);
+/* sha256d in two steps, for messages that share their first blocks */
+void sha256_midstate(const unsigned char *message, unsigned int block_nb,
+                     uint32_t state[8]);
+void sha256d_resume(const uint32_t state[8], unsigned int done,
+                    const unsigned char *message, unsigned int len,
+                    unsigned char *digest);
+void sha256_transf(sha256_ctx *ctx, const unsigned char *message,
+                   unsigned int block_nb);
+/* switches sha256_transf to the fastest implementation the cpu has
+ * (SHA-NI, ARMv8 crypto extensions or generic) and returns its name */
+const char *sha256_select(void);
+
+/* from the sha256 library (../sha256/sha256.h, which can't be included next
+ * to this header): compresses one block into each of n states, on the
+ * widest multi-buffer kernel the cpu has */
+int sha256_lanes(void);
+void sha256_transform_many(uint32_t state[][8], const uint8_t *const blocks[],
+                           size_t n);
 
 #endif /* !SHA2_H */
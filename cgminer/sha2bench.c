@@ -0,0 +1,90 @@
+/*
+ * per call cost of the double sha256 behind regen_hash (80 byte headers) and
+ * gen_hash (64 byte merkle nodes), generic code against what sha256_select()
+ * picks on this cpu. build with "make sha2bench".
+ */
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "sha2.h"
+
+#define BENCH_NS 500000000LL
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void twice(const unsigned char *data, unsigned int len, unsigned char *hash)
+{
+	unsigned char hash1[32];
+
+	sha256(data, len, hash1);
+	sha256(hash1, 32, hash);
+}
+
+/* ns per call, the input changes every call like nonces do */
+static double bench(void (*fn)(const unsigned char *, unsigned int, unsigned char *),
+		    unsigned int len)
+{
+	unsigned char data[80], hash[32];
+	long long start = now_ns(), calls = 0;
+	int i;
+
+	memset(data, 0x5a, sizeof(data));
+	do {
+		for (i = 0; i < 1000; i++) {
+			data[len - 1] = calls + i;
+			data[len - 2] = (calls + i) >> 8;
+			fn(data, len, hash);
+		}
+		calls += 1000;
+	} while (now_ns() - start < BENCH_NS);
+
+	return (double)(now_ns() - start) / calls;
+}
+
+int main(void)
+{
+	static const unsigned int lens[] = { 80, 64 };
+	unsigned char data[80], expect[2][32], hash[32];
+	double generic[2], generic_d[2], fast[2];
+	const char *name;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = i * 7 + 3;
+
+	for (i = 0; i < 2; i++) {
+		twice(data, lens[i], expect[i]);
+		generic[i] = bench(twice, lens[i]);
+		generic_d[i] = bench(sha256d, lens[i]);
+	}
+
+	name = sha256_select();
+
+	/* the selected code has to agree with the generic code first */
+	for (i = 0; i < 2; i++) {
+		sha256d(data, lens[i], hash);
+		if (memcmp(expect[i], hash, sizeof(hash))) {
+			printf("%s sha256d differs for %u bytes\n", name, lens[i]);
+			return 1;
+		}
+	}
+
+	for (i = 0; i < 2; i++)
+		fast[i] = bench(sha256d, lens[i]);
+
+	printf("%-8s %14s %14s %14s %8s\n", "bytes", "sha256 x2 ns", "sha256d ns", name, "speedup");
+	for (i = 0; i < 2; i++)
+		printf("%-8u %14.1f %14.1f %14.1f %7.1fx\n", lens[i], generic[i],
+		       generic_d[i], fast[i], generic[i] / fast[i]);
+
+	return 0;
+}
@@ -0,0 +1,321 @@
+/*
+ * per message cost of handing pointers from producer threads to one consumer
+ * thread, as pool->stratum_q carries shares, through the thread_q as it was
+ * (a calloc()ed entry per message on a list behind a mutex and a condvar) and
+ * as it is now (a bounded ring claimed with compare and swap, the consumer
+ * sleeping on a futex only when empty). both are copies of what util.c had
+ * and has, except that tq_push() fails on a full ring where the producers
+ * here sleep until there is room, so that no message is lost. build with
+ * "make tqbench", run as "tqbench [messages]".
+ */
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "elist.h"
+
+#define TQ_SIZE 1024
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* the list based thread_q */
+struct tq_ent {
+	void *data;
+	struct list_head q_node;
+};
+
+struct list_q {
+	struct list_head q;
+	bool frozen;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+static void lq_init(struct list_q *tq)
+{
+	INIT_LIST_HEAD(&tq->q);
+	tq->frozen = false;
+	pthread_mutex_init(&tq->mutex, NULL);
+	pthread_cond_init(&tq->cond, NULL);
+}
+
+static bool lq_push(struct list_q *tq, void *data)
+{
+	struct tq_ent *ent;
+	bool rc = true;
+
+	ent = calloc(1, sizeof(*ent));
+	if (!ent)
+		return false;
+
+	ent->data = data;
+	INIT_LIST_HEAD(&ent->q_node);
+
+	pthread_mutex_lock(&tq->mutex);
+	if (!tq->frozen) {
+		list_add_tail(&ent->q_node, &tq->q);
+	} else {
+		free(ent);
+		rc = false;
+	}
+	pthread_cond_signal(&tq->cond);
+	pthread_mutex_unlock(&tq->mutex);
+
+	return rc;
+}
+
+static void *lq_pop(struct list_q *tq)
+{
+	struct tq_ent *ent;
+	void *rval = NULL;
+
+	pthread_mutex_lock(&tq->mutex);
+	if (!list_empty(&tq->q))
+		goto pop;
+
+	if (pthread_cond_wait(&tq->cond, &tq->mutex))
+		goto out;
+	if (list_empty(&tq->q))
+		goto out;
+pop:
+	ent = list_entry(tq->q.next, struct tq_ent, q_node);
+	rval = ent->data;
+
+	list_del(&ent->q_node);
+	free(ent);
+out:
+	pthread_mutex_unlock(&tq->mutex);
+
+	return rval;
+}
+
+/* the ring based thread_q, without the timeouts and freezing */
+struct tq_slot {
+	unsigned int seq;
+	void *data;
+};
+
+struct ring_q {
+	struct tq_slot *ring;
+	unsigned int mask;
+	int pop_wake, push_wake, pop_waiters, push_waiters;
+	char pad_head[64];
+	unsigned int head;
+	char pad_tail[64];
+	unsigned int tail;
+	char pad_end[64];
+};
+
+static void rq_init(struct ring_q *tq)
+{
+	unsigned int i;
+
+	memset(tq, 0, sizeof(*tq));
+	tq->ring = calloc(TQ_SIZE, sizeof(*tq->ring));
+	if (!tq->ring)
+		exit(1);
+	tq->mask = TQ_SIZE - 1;
+	for (i = 0; i < TQ_SIZE; i++)
+		tq->ring[i].seq = i;
+}
+
+static bool rq_enqueue(struct ring_q *tq, void *data)
+{
+	unsigned int pos = __atomic_load_n(&tq->tail, __ATOMIC_RELAXED);
+	struct tq_slot *slot;
+
+	while (42) {
+		int dif;
+
+		slot = &tq->ring[pos & tq->mask];
+		dif = (int)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+		if (!dif) {
+			if (__atomic_compare_exchange_n(&tq->tail, &pos, pos + 1, true,
+							__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (dif < 0)
+			return false;
+		else
+			pos = __atomic_load_n(&tq->tail, __ATOMIC_RELAXED);
+	}
+	slot->data = data;
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+static bool rq_dequeue(struct ring_q *tq, void **data)
+{
+	unsigned int pos = __atomic_load_n(&tq->head, __ATOMIC_RELAXED);
+	struct tq_slot *slot;
+
+	while (42) {
+		int dif;
+
+		slot = &tq->ring[pos & tq->mask];
+		dif = (int)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+		if (!dif) {
+			if (__atomic_compare_exchange_n(&tq->head, &pos, pos + 1, true,
+							__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (dif < 0)
+			return false;
+		else
+			pos = __atomic_load_n(&tq->head, __ATOMIC_RELAXED);
+	}
+	*data = slot->data;
+	__atomic_store_n(&slot->seq, pos + tq->mask + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+static void rq_sleep(int *word, int ev)
+{
+	syscall(SYS_futex, word, FUTEX_WAIT_BITSET_PRIVATE | FUTEX_CLOCK_REALTIME, ev,
+		NULL, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+static void rq_wakeup(int *word)
+{
+	__atomic_add_fetch(word, 1, __ATOMIC_SEQ_CST);
+	syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+static void rq_wait_in(int *waiters)
+{
+	__atomic_add_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static void rq_wake_waiters(int *word, int *waiters)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(waiters, __ATOMIC_RELAXED) && __atomic_exchange_n(waiters, 0, __ATOMIC_SEQ_CST))
+		rq_wakeup(word);
+}
+
+static void rq_push(struct ring_q *tq, void *data)
+{
+	int ev;
+
+	while (!rq_enqueue(tq, data)) {
+		ev = __atomic_load_n(&tq->push_wake, __ATOMIC_SEQ_CST);
+		rq_wait_in(&tq->push_waiters);
+		if (rq_enqueue(tq, data))
+			break;
+		rq_sleep(&tq->push_wake, ev);
+	}
+
+	rq_wake_waiters(&tq->pop_wake, &tq->pop_waiters);
+}
+
+static void *rq_pop(struct ring_q *tq)
+{
+	void *data;
+	int ev;
+
+	while (!rq_dequeue(tq, &data)) {
+		ev = __atomic_load_n(&tq->pop_wake, __ATOMIC_SEQ_CST);
+		rq_wait_in(&tq->pop_waiters);
+		if (rq_dequeue(tq, &data))
+			break;
+		rq_sleep(&tq->pop_wake, ev);
+	}
+
+	if (__atomic_load_n(&tq->tail, __ATOMIC_SEQ_CST) - __atomic_load_n(&tq->head, __ATOMIC_SEQ_CST) <= TQ_SIZE / 2)
+		rq_wake_waiters(&tq->push_wake, &tq->push_waiters);
+	return data;
+}
+
+static struct list_q lq;
+static struct ring_q rq;
+static int ring, per_producer;
+
+static void *producer(void *arg)
+{
+	long base = (long)arg * per_producer;
+	int i;
+
+	for (i = 0; i < per_producer; i++) {
+		void *data = (void *)(base + i + 1);
+
+		if (ring)
+			rq_push(&rq, data);
+		else
+			lq_push(&lq, data);
+	}
+	return NULL;
+}
+
+/* ns per message from the first push to the last pop, checking nothing got
+ * lost on the way */
+static double bench(int use_ring, int producers)
+{
+	pthread_t threads[64];
+	long long start, total = (long long)producers * per_producer, got = 0;
+	unsigned long long sum = 0, want = (unsigned long long)total * (total + 1) / 2;
+	long i;
+
+	ring = use_ring;
+	if (ring)
+		rq_init(&rq);
+	else
+		lq_init(&lq);
+
+	start = now_ns();
+	for (i = 0; i < producers; i++)
+		pthread_create(&threads[i], NULL, producer, (void *)i);
+	while (got < total) {
+		void *data = ring ? rq_pop(&rq) : lq_pop(&lq);
+
+		if (!data)
+			continue;
+		sum += (unsigned long)data;
+		got++;
+	}
+	for (i = 0; i < producers; i++)
+		pthread_join(threads[i], NULL);
+	if (sum != want) {
+		fprintf(stderr, "%s queue lost messages\n", ring ? "ring" : "list");
+		exit(1);
+	}
+	if (ring)
+		free(rq.ring);
+
+	return (double)(now_ns() - start) / total;
+}
+
+int main(int argc, char **argv)
+{
+	static const int producers[] = { 1, 4, 16 };
+	int messages = argc > 1 ? atoi(argv[1]) : 4000000;
+	unsigned int i;
+
+	if (messages < 16) {
+		fprintf(stderr, "usage: %s [messages]\n", argv[0]);
+		return 1;
+	}
+
+	printf("%-10s %10s %12s %12s\n", "producers", "messages", "list ns", "ring ns");
+	for (i = 0; i < sizeof(producers) / sizeof(producers[0]); i++) {
+		per_producer = messages / producers[i];
+		printf("%-10d %10d %12.1f %12.1f\n", producers[i], per_producer * producers[i],
+		       bench(0, producers[i]), bench(1, producers[i]));
+	}
+
+	return 0;
+}
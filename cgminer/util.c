@@ -27,6 +27,9 @@
 #include <fcntl.h>
 # ifdef __linux
 #  include <sys/prctl.h>
+#  include <sys/syscall.h>
+#  include <linux/futex.h>
+#  include <limits.h>
 # endif
 # include <sys/socket.h>
 # include <netinet/in.h>
@@ -78,11 +81,6 @@ static void keep_sockalive(SOCKETTYPE fd)
 
 }
 
-struct tq_ent {
-	void			*data;
-	struct list_head	q_node;
-};
-
 #ifdef HAVE_LIBCURL
 struct timeval nettime;
 
@@ -669,6 +667,58 @@ char *bin2hex(const unsigned char *p, size_t len)
 	return s;
 }
 
+/* Reference counted strings, for the strings every work of a pool job shares.
+ * The count sits in front of the characters so they still read as a plain
+ * char *, but they must only be released with refstr_put() and never be
+ * modified once shared. */
+struct refstr {
+	int refs;
+	char s[];
+};
+
+#define refstr_of(S) ((struct refstr *)((S) - offsetof(struct refstr, s)))
+
+static char *refstr_alloc(size_t len)
+{
+	struct refstr *ref = malloc(sizeof(*ref) + len + 1);
+
+	if (unlikely(!ref))
+		quithere(1, "Failed to malloc refstr");
+	ref->refs = 1;
+	return ref->s;
+}
+
+char *refstr_new(const char *str)
+{
+	size_t len = strlen(str);
+	char *s = refstr_alloc(len);
+
+	memcpy(s, str, len + 1);
+	return s;
+}
+
+/* bin2hex() into a refstr */
+char *refstr_bin2hex(const unsigned char *p, size_t len)
+{
+	char *s = refstr_alloc(len * 2);
+
+	__bin2hex(s, p, len);
+	return s;
+}
+
+char *refstr_get(char *s)
+{
+	if (s)
+		__sync_add_and_fetch(&refstr_of(s)->refs, 1);
+	return s;
+}
+
+void refstr_put(char *s)
+{
+	if (s && !__sync_sub_and_fetch(&refstr_of(s)->refs, 1))
+		free(refstr_of(s));
+}
+
 static const int hex2bin_tbl[256] = {
 	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
 	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
@@ -865,15 +915,26 @@ bool fulltest(const unsigned char *hash, const unsigned char *target)
 	return rc;
 }
 
+/* Entries a thread_q holds before pushes fail, a power of two */
+#define TQ_SIZE 1024
+
 struct thread_q *tq_new(void)
 {
 	struct thread_q *tq;
+	unsigned int i;
 
 	tq = calloc(1, sizeof(*tq));
 	if (!tq)
 		return NULL;
+	tq->ring = calloc(TQ_SIZE, sizeof(*tq->ring));
+	if (!tq->ring) {
+		free(tq);
+		return NULL;
+	}
 
-	INIT_LIST_HEAD(&tq->q);
+	tq->mask = TQ_SIZE - 1;
+	for (i = 0; i < TQ_SIZE; i++)
+		tq->ring[i].seq = i;
 	pthread_mutex_init(&tq->mutex, NULL);
 	pthread_cond_init(&tq->cond, NULL);
 
@@ -882,29 +943,131 @@ struct thread_q *tq_new(void)
 
 void tq_free(struct thread_q *tq)
 {
-	struct tq_ent *ent, *iter;
-
 	if (!tq)
 		return;
 
-	list_for_each_entry_safe(ent, iter, &tq->q, q_node) {
-		list_del(&ent->q_node);
-		free(ent);
-	}
-
 	pthread_cond_destroy(&tq->cond);
 	pthread_mutex_destroy(&tq->mutex);
 
+	free(tq->ring);
 	memset(tq, 0, sizeof(*tq));	/* poison */
 	free(tq);
 }
 
-static void tq_freezethaw(struct thread_q *tq, bool frozen)
+/* The ring is a bounded multi producer multi consumer queue where every slot
+ * carries a sequence number. A slot is free for the push of position pos when
+ * its seq is pos, and full for the pop of position pos when its seq is pos + 1.
+ * Pushers and poppers each claim a position with a compare and swap of tail
+ * or head, so neither ever takes a lock or allocates. */
+static bool __tq_enqueue(struct thread_q *tq, void *data)
+{
+	unsigned int pos = __atomic_load_n(&tq->tail, __ATOMIC_RELAXED);
+	struct tq_slot *slot;
+
+	while (42) {
+		int dif;
+
+		slot = &tq->ring[pos & tq->mask];
+		dif = (int)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+		if (!dif) {
+			if (__atomic_compare_exchange_n(&tq->tail, &pos, pos + 1, true,
+							__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (dif < 0)
+			return false;
+		else
+			pos = __atomic_load_n(&tq->tail, __ATOMIC_RELAXED);
+	}
+	slot->data = data;
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+static bool __tq_dequeue(struct thread_q *tq, void **data)
+{
+	unsigned int pos = __atomic_load_n(&tq->head, __ATOMIC_RELAXED);
+	struct tq_slot *slot;
+
+	while (42) {
+		int dif;
+
+		slot = &tq->ring[pos & tq->mask];
+		dif = (int)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+		if (!dif) {
+			if (__atomic_compare_exchange_n(&tq->head, &pos, pos + 1, true,
+							__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (dif < 0)
+			return false;
+		else
+			pos = __atomic_load_n(&tq->head, __ATOMIC_RELAXED);
+	}
+	*data = slot->data;
+	__atomic_store_n(&slot->seq, pos + tq->mask + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+/* Sleeps while *word is still ev, returning false once abstime has passed.
+ * Only an empty queue to pop gets here. */
+static bool tq_sleep(struct thread_q *tq, int *word, int ev, const struct timespec *abstime)
 {
+#ifdef __linux
+	(void)tq;
+	if (syscall(SYS_futex, word, FUTEX_WAIT_BITSET_PRIVATE | FUTEX_CLOCK_REALTIME, ev,
+		    abstime, NULL, FUTEX_BITSET_MATCH_ANY) && errno == ETIMEDOUT)
+		return false;
+	return true;
+#else
+	int rc = 0;
+
 	mutex_lock(&tq->mutex);
-	tq->frozen = frozen;
-	pthread_cond_signal(&tq->cond);
+	while (!rc && __atomic_load_n(word, __ATOMIC_SEQ_CST) == ev) {
+		if (abstime)
+			rc = pthread_cond_timedwait(&tq->cond, &tq->mutex, abstime);
+		else
+			rc = pthread_cond_wait(&tq->cond, &tq->mutex);
+	}
 	mutex_unlock(&tq->mutex);
+	return rc != ETIMEDOUT;
+#endif
+}
+
+static void tq_wakeup(struct thread_q *tq, int *word)
+{
+#ifdef __linux
+	(void)tq;
+	__atomic_add_fetch(word, 1, __ATOMIC_SEQ_CST);
+	syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#else
+	mutex_lock(&tq->mutex);
+	__atomic_add_fetch(word, 1, __ATOMIC_SEQ_CST);
+	pthread_cond_broadcast(&tq->cond);
+	mutex_unlock(&tq->mutex);
+#endif
+}
+
+/* Waiters count themselves in before looking at the ring a last time, and
+ * wakers look for them after changing it, with a full barrier between on
+ * either side, so a wakeup is never missed. The first waker to find them
+ * clears the count and wakes them all, so the rest don't make the syscall
+ * again before they have even run. */
+static void tq_wait_in(int *waiters)
+{
+	__atomic_add_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static void tq_wake_waiters(struct thread_q *tq, int *word, int *waiters)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(waiters, __ATOMIC_RELAXED) && __atomic_exchange_n(waiters, 0, __ATOMIC_SEQ_CST))
+		tq_wakeup(tq, word);
+}
+
+static void tq_freezethaw(struct thread_q *tq, bool frozen)
+{
+	__atomic_store_n(&tq->frozen, frozen, __ATOMIC_SEQ_CST);
+	tq_wakeup(tq, &tq->pop_wake);
 }
 
 void tq_freeze(struct thread_q *tq)
@@ -917,59 +1080,53 @@ void tq_thaw(struct thread_q *tq)
 	tq_freezethaw(tq, false);
 }
 
+/* Never waits: returns false, leaving data to the caller, when the queue is
+ * frozen or full. The device threads pushing found shares must not stop
+ * hashing behind a consumer that is stuck. */
 bool tq_push(struct thread_q *tq, void *data)
 {
-	struct tq_ent *ent;
-	bool rc = true;
-
-	ent = calloc(1, sizeof(*ent));
-	if (!ent)
+	if (unlikely(__atomic_load_n(&tq->frozen, __ATOMIC_SEQ_CST)))
+		return false;
+	if (unlikely(!__tq_enqueue(tq, data)))
 		return false;
 
-	ent->data = data;
-	INIT_LIST_HEAD(&ent->q_node);
+	tq_wake_waiters(tq, &tq->pop_wake, &tq->pop_waiters);
+	return true;
+}
 
-	mutex_lock(&tq->mutex);
-	if (!tq->frozen) {
-		list_add_tail(&ent->q_node, &tq->q);
-	} else {
-		free(ent);
-		rc = false;
+/* Takes up to max entries into data at once, all that are queued by the time
+ * there is one. Returns how many were taken, 0 if abstime passed or the queue
+ * was frozen while empty. */
+int tq_pop_batch(struct thread_q *tq, void **data, int max, const struct timespec *abstime)
+{
+	int n = 1, ev;
+
+	while (!__tq_dequeue(tq, &data[0])) {
+		/* Read the wake word before registering: a push that takes our
+		 * registration before we read it would otherwise leave us asleep
+		 * on an already bumped word with nobody left to wake us */
+		ev = __atomic_load_n(&tq->pop_wake, __ATOMIC_SEQ_CST);
+		tq_wait_in(&tq->pop_waiters);
+		if (__tq_dequeue(tq, &data[0]))
+			break;
+		if (__atomic_load_n(&tq->frozen, __ATOMIC_SEQ_CST) ||
+		    !tq_sleep(tq, &tq->pop_wake, ev, abstime))
+			return 0;
 	}
-	pthread_cond_signal(&tq->cond);
-	mutex_unlock(&tq->mutex);
 
-	return rc;
+	while (n < max && __tq_dequeue(tq, &data[n]))
+		n++;
+
+	return n;
 }
 
 void *tq_pop(struct thread_q *tq, const struct timespec *abstime)
 {
-	struct tq_ent *ent;
-	void *rval = NULL;
-	int rc;
-
-	mutex_lock(&tq->mutex);
-	if (!list_empty(&tq->q))
-		goto pop;
-
-	if (abstime)
-		rc = pthread_cond_timedwait(&tq->cond, &tq->mutex, abstime);
-	else
-		rc = pthread_cond_wait(&tq->cond, &tq->mutex);
-	if (rc)
-		goto out;
-	if (list_empty(&tq->q))
-		goto out;
-pop:
-	ent = list_entry(tq->q.next, struct tq_ent, q_node);
-	rval = ent->data;
-
-	list_del(&ent->q_node);
-	free(ent);
-out:
-	mutex_unlock(&tq->mutex);
+	void *data;
 
-	return rval;
+	if (!tq_pop_batch(tq, &data, 1, abstime))
+		return NULL;
+	return data;
 }
 
 int thr_info_create(struct thr_info *thr, pthread_attr_t *attr, void *(*start) (void *), void *arg)
@@ -1400,39 +1557,42 @@ enum send_ret {
 	SEND_INACTIVE
 };
 
-/* Send a single command across a socket, appending \n to it. This should all
- * be done under stratum lock except when first establishing the socket */
-static enum send_ret __stratum_send(struct pool *pool, char *s, ssize_t len)
+/* Send whole lines across a socket. The socket is blocking once connected so
+ * each send is made non-blocking, and when the socket won't take any more we
+ * wait in select for up to a second at a time. Windows has no per call flag
+ * and still blocks in send. This should all be done under stratum lock except
+ * when first establishing the socket */
+static enum send_ret __stratum_write(struct pool *pool, const char *s, ssize_t len)
 {
 	SOCKETTYPE sock = pool->sock;
 	ssize_t ssent = 0;
 
-	strcat(s, "\n");
-	len++;
-
 	while (len > 0 ) {
 		struct timeval timeout = {1, 0};
 		ssize_t sent;
 		fd_set wd;
-retry:
-		FD_ZERO(&wd);
-		FD_SET(sock, &wd);
-		if (select(sock + 1, NULL, &wd, NULL, &timeout) < 1) {
-			if (interrupted())
-				goto retry;
-			return SEND_SELECTFAIL;
-		}
+
+		pool->cgminer_pool_stats.send_syscalls++;
 #ifdef __APPLE__
-		sent = send(pool->sock, s + ssent, len, SO_NOSIGPIPE);
+		sent = send(pool->sock, s + ssent, len, SO_NOSIGPIPE | MSG_DONTWAIT);
 #elif WIN32
 		sent = send(pool->sock, s + ssent, len, 0);
 #else
-		sent = send(pool->sock, s + ssent, len, MSG_NOSIGNAL);
+		sent = send(pool->sock, s + ssent, len, MSG_NOSIGNAL | MSG_DONTWAIT);
 #endif
 		if (sent < 0) {
 			if (!sock_blocks())
 				return SEND_SENDFAIL;
-			sent = 0;
+retry:
+			FD_ZERO(&wd);
+			FD_SET(sock, &wd);
+			pool->cgminer_pool_stats.send_syscalls++;
+			if (select(sock + 1, NULL, &wd, NULL, &timeout) < 1) {
+				if (interrupted())
+					goto retry;
+				return SEND_SELECTFAIL;
+			}
+			continue;
 		}
 		ssent += sent;
 		len -= sent;
@@ -1444,18 +1604,15 @@ retry:
 	return SEND_OK;
 }
 
-bool stratum_send(struct pool *pool, char *s, ssize_t len)
+/* Send a single command across a socket, appending \n to it */
+static enum send_ret __stratum_send(struct pool *pool, char *s, ssize_t len)
 {
-	enum send_ret ret = SEND_INACTIVE;
-
-	if (opt_protocol)
-		applog(LOG_DEBUG, "SEND: %s", s);
-
-	mutex_lock(&pool->stratum_lock);
-	if (pool->stratum_active)
-		ret = __stratum_send(pool, s, len);
-	mutex_unlock(&pool->stratum_lock);
+	strcat(s, "\n");
+	return __stratum_write(pool, s, len + 1);
+}
 
+static bool stratum_send_ret(struct pool *pool, enum send_ret ret)
+{
 	/* This is to avoid doing applog under stratum_lock */
 	switch (ret) {
 		default:
@@ -1476,6 +1633,47 @@ bool stratum_send(struct pool *pool, char *s, ssize_t len)
 	return (ret == SEND_OK);
 }
 
+bool stratum_send(struct pool *pool, char *s, ssize_t len)
+{
+	enum send_ret ret = SEND_INACTIVE;
+
+	if (opt_protocol)
+		applog(LOG_DEBUG, "SEND: %s", s);
+
+	mutex_lock(&pool->stratum_lock);
+	if (pool->stratum_active)
+		ret = __stratum_send(pool, s, len);
+	mutex_unlock(&pool->stratum_lock);
+
+	return stratum_send_ret(pool, ret);
+}
+
+/* Send a batch of shares already serialised as \n terminated lines in one
+ * write, counting the syscalls it took against them */
+bool stratum_send_shares(struct pool *pool, const char *s, ssize_t len, int shares)
+{
+	struct cgminer_pool_stats *pool_stats = &pool->cgminer_pool_stats;
+	enum send_ret ret = SEND_INACTIVE;
+
+	if (opt_protocol)
+		applog(LOG_DEBUG, "SEND: %.*s", (int)len - 1, s);
+
+	mutex_lock(&pool->stratum_lock);
+	if (pool->stratum_active) {
+		uint64_t syscalls = pool_stats->send_syscalls;
+
+		ret = __stratum_write(pool, s, len);
+		pool_stats->share_syscalls += pool_stats->send_syscalls - syscalls;
+		if (ret == SEND_OK) {
+			pool_stats->share_sends++;
+			pool_stats->shares_sent += shares;
+		}
+	}
+	mutex_unlock(&pool->stratum_lock);
+
+	return stratum_send_ret(pool, ret);
+}
+
 static bool socket_full(struct pool *pool, int wait)
 {
 	SOCKETTYPE sock = pool->sock;
@@ -1496,7 +1694,7 @@ static bool socket_full(struct pool *pool, int wait)
 /* Check to see if Santa's been good to you */
 bool sock_full(struct pool *pool)
 {
-	if (strlen(pool->sockbuf))
+	if (pool->sockbuf_len)
 		return true;
 
 	return (socket_full(pool, 0));
@@ -1504,7 +1702,7 @@ bool sock_full(struct pool *pool)
 
 static void clear_sockbuf(struct pool *pool)
 {
-	strcpy(pool->sockbuf, "");
+	pool->sockbuf_start = pool->sockbuf_len = pool->sockbuf_scan = 0;
 }
 
 static void clear_sock(struct pool *pool)
@@ -1535,36 +1733,63 @@ void _recalloc(void **ptr, size_t old, size_t new, const char *file, const char
 		memset(*ptr + old, 0, new - old);
 }
 
-/* Make sure the pool sockbuf is large enough to cope with any coinbase size
- * by reallocing it to a large enough size rounded up to a multiple of RBUFSIZE
- * and zeroing the new memory */
-static void recalloc_sock(struct pool *pool, size_t len)
+/* Makes room for len more bytes after what is unread in the pool sockbuf.
+ * The unread bytes only move to the front once the room behind them runs
+ * out, and the buffer only grows, in multiples of RBUFSIZE, once that isn't
+ * enough either, to cope with any coinbase size. */
+static void sockbuf_reserve(struct pool *pool, size_t len)
 {
-	size_t old, new;
+	size_t new;
 
-	old = strlen(pool->sockbuf);
-	new = old + len + 1;
-	if (new < pool->sockbuf_size)
+	if (pool->sockbuf_start + pool->sockbuf_len + len < pool->sockbuf_size)
 		return;
+	if (pool->sockbuf_start) {
+		memmove(pool->sockbuf, pool->sockbuf + pool->sockbuf_start, pool->sockbuf_len);
+		pool->sockbuf_start = 0;
+		if (pool->sockbuf_len + len < pool->sockbuf_size)
+			return;
+	}
+	new = pool->sockbuf_len + len + 1;
 	new = new + (RBUFSIZE - (new % RBUFSIZE));
 	// Avoid potentially recursive locking
 	// applog(LOG_DEBUG, "Recallocing pool sockbuf to %d", new);
 	pool->sockbuf = realloc(pool->sockbuf, new);
 	if (!pool->sockbuf)
 		quithere(1, "Failed to realloc pool sockbuf");
-	memset(pool->sockbuf + old, 0, new - old);
 	pool->sockbuf_size = new;
 }
 
-/* Peeks at a socket to find the first end of line and then reads just that
- * from the socket and returns that as a malloced char */
+/* Finds the end of the first line in the pool sockbuf, skipping empty lines,
+ * and only searching what wasn't searched on an earlier call. */
+static char *sockbuf_eol(struct pool *pool)
+{
+	char *buf, *eol;
+
+	while (pool->sockbuf_len && pool->sockbuf[pool->sockbuf_start] == '\n') {
+		pool->sockbuf_start++;
+		pool->sockbuf_len--;
+		pool->sockbuf_scan = 0;
+	}
+	buf = pool->sockbuf + pool->sockbuf_start;
+	eol = memchr(buf + pool->sockbuf_scan, '\n', pool->sockbuf_len - pool->sockbuf_scan);
+	if (!eol)
+		pool->sockbuf_scan = pool->sockbuf_len;
+	return eol;
+}
+
+/* Waits for a whole line from the pool's socket, receiving straight into the
+ * pool sockbuf, and returns it \0 terminated in place. The line is only
+ * valid until the next recv_line or clear of the pool's socket and must not
+ * be freed. Nothing handed the line may reconnect, which is why
+ * parse_method() only flags a client.reconnect in pool->stratum_reconnect. */
 char *recv_line(struct pool *pool)
 {
-	char *tok, *sret = NULL;
-	ssize_t len, buflen;
+	char *eol, *sret = NULL;
+	ssize_t len;
 	int waited = 0;
 
-	if (!strstr(pool->sockbuf, "\n")) {
+	eol = sockbuf_eol(pool);
+	if (!eol) {
 		struct timeval rstart, now;
 
 		cgtime(&rstart);
@@ -1574,12 +1799,11 @@ char *recv_line(struct pool *pool)
 		}
 
 		do {
-			char s[RBUFSIZE];
-			size_t slen;
 			ssize_t n;
 
-			memset(s, 0, RBUFSIZE);
-			n = recv(pool->sock, s, RECVSIZE, 0);
+			sockbuf_reserve(pool, RECVSIZE);
+			n = recv(pool->sock, pool->sockbuf + pool->sockbuf_start + pool->sockbuf_len,
+				 RECVSIZE, 0);
 			if (!n) {
 				applog(LOG_DEBUG, "Socket closed waiting in recv_line");
 				suspend_stratum(pool);
@@ -1594,28 +1818,24 @@ char *recv_line(struct pool *pool)
 					break;
 				}
 			} else {
-				slen = strlen(s);
-				recalloc_sock(pool, slen);
-				strcat(pool->sockbuf, s);
+				pool->sockbuf_len += n;
+				eol = sockbuf_eol(pool);
 			}
-		} while (waited < DEFAULT_SOCKWAIT && !strstr(pool->sockbuf, "\n"));
+		} while (waited < DEFAULT_SOCKWAIT && !eol);
 	}
 
-	buflen = strlen(pool->sockbuf);
-	tok = strtok(pool->sockbuf, "\n");
-	if (!tok) {
+	if (!eol) {
 		applog(LOG_DEBUG, "Failed to parse a \\n terminated string in recv_line");
 		goto out;
 	}
-	sret = strdup(tok);
-	len = strlen(sret);
+	sret = pool->sockbuf + pool->sockbuf_start;
+	*eol = '\0';
+	len = eol - sret;
 
-	/* Copy what's left in the buffer after the \n, including the
-	 * terminating \0 */
-	if (buflen > len + 1)
-		memmove(pool->sockbuf, pool->sockbuf + len + 1, buflen - len + 1);
-	else
-		strcpy(pool->sockbuf, "");
+	/* What's left after the \n stays where it is for the next line */
+	pool->sockbuf_start += len + 1;
+	pool->sockbuf_len -= len + 1;
+	pool->sockbuf_scan = 0;
 
 	pool->cgminer_pool_stats.times_received++;
 	pool->cgminer_pool_stats.bytes_received += len;
@@ -1889,8 +2109,9 @@ static bool parse_reconnect(struct pool *pool, json_t *val)
 
 	clear_pool_work(pool);
 
+	/* The socket is left alone, the caller is still reading the line this
+	 * came in and restart_stratum() suspends it first anyway */
 	mutex_lock(&pool->stratum_lock);
-	__suspend_stratum(pool);
 	tmp = pool->sockaddr_url;
 	pool->sockaddr_url = sockaddr_url;
 	pool->stratum_url = pool->sockaddr_url;
@@ -1898,11 +2119,9 @@ static bool parse_reconnect(struct pool *pool, json_t *val)
 	tmp = pool->stratum_port;
 	pool->stratum_port = stratum_port;
 	free(tmp);
+	pool->stratum_reconnect = true;
 	mutex_unlock(&pool->stratum_lock);
 
-	if (!restart_stratum(pool))
-		return false;
-
 	return true;
 }
 
@@ -2024,14 +2243,14 @@ bool auth_stratum(struct pool *pool)
 		sret = recv_line(pool);
 		if (!sret)
 			return ret;
-		if (parse_method(pool, sret))
-			free(sret);
-		else
+		if (!parse_method(pool, sret))
 			break;
+		/* Sent straight to another server, this connection is done */
+		if (pool->stratum_reconnect)
+			return ret;
 	}
 
 	val = JSON_LOADS(sret, &err);
-	free(sret);
 	res_val = json_object_get(val, "result");
 	err_val = json_object_get(val, "error");
 
@@ -2520,7 +2739,6 @@ resend:
 	recvd = true;
 
 	val = JSON_LOADS(sret, &err);
-	free(sret);
 	if (!val) {
 		applog(LOG_INFO, "JSON decode failed(%d): %s", err.line, err.text);
 		goto out;
@@ -2615,12 +2833,23 @@ out:
 
 bool restart_stratum(struct pool *pool)
 {
-	if (pool->stratum_active)
+	bool retried = false;
+
+retry:
+	if (pool->stratum_active || pool->stratum_reconnect)
 		suspend_stratum(pool);
+	pool->stratum_reconnect = false;
 	if (!initiate_stratum(pool))
 		return false;
-	if (!auth_stratum(pool))
+	if (!auth_stratum(pool)) {
+		/* A client.reconnect received while authorising, follow it once
+		 * to the new url rather than treating the pool as dead */
+		if (pool->stratum_reconnect && !retried) {
+			retried = true;
+			goto retry;
+		}
 		return false;
+	}
 	return true;
 }
 
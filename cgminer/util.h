@@ -136,6 +136,7 @@ double us_tdiff(struct timeval *end, struct timeval *start);
 int ms_tdiff(struct timeval *end, struct timeval *start);
 double tdiff(struct timeval *end, struct timeval *start);
 bool stratum_send(struct pool *pool, char *s, ssize_t len);
+bool stratum_send_shares(struct pool *pool, const char *s, ssize_t len, int shares);
 bool sock_full(struct pool *pool);
 void _recalloc(void **ptr, size_t old, size_t new, const char *file, const char *func, const int line);
 #define recalloc(ptr, old, new) _recalloc((void *)&(ptr), old, new, __FILE__, __func__, __LINE__)
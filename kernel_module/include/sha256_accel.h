@@ -7,7 +7,13 @@
 #	define CLASS_NAME "sha256"
 #	define DEVICE_NAME CLASS_NAME
 
-#	define SHA256_ACCEL_DEVICE "/dev/" DEVICE_NAME
+/* one device per accelerator core, numbered from 0 */
+#	define SHA256_ACCEL_MAX_DEVICES 16
+#	define SHA256_ACCEL_DEVICE_FMT "/dev/" DEVICE_NAME "%d"
+#	define SHA256_ACCEL_DEVICE "/dev/" DEVICE_NAME "0"
+
+/* device tree binding of the sha256_accel_axi core */
+#	define SHA256_ACCEL_COMPATIBLE "afflux,sha256-accel-axi-1.0"
 
 #	define SHA256_ACCEL_MAGIC 'S'
 
@@ -29,11 +35,73 @@
 
 #	define SHA256_ACCEL_STEP _IO(SHA256_ACCEL_MAGIC, 13)
 
-#	define SHA256_ACCEL_NUM_REGS 50
+#	define SHA256_ACCEL_SET_JOB_ID _IOW(SHA256_ACCEL_MAGIC, 14, const __u32)
+#	define SHA256_ACCEL_QUEUE_JOB _IOW(SHA256_ACCEL_MAGIC, 15, const struct sha256_accel_job_s *)
+#	define SHA256_ACCEL_GET_JOB_ID _IOR(SHA256_ACCEL_MAGIC, 16, __u32 *)
+#	define SHA256_ACCEL_GET_OVERFLOWS _IOR(SHA256_ACCEL_MAGIC, 17, __u32 *)
+
+#	define SHA256_ACCEL_NUM_REGS 76
+
+/* number of results the driver buffers between interrupt and read(), a power of two */
+#	define SHA256_ACCEL_RING_SIZE 256
+
+/* mmap() offsets, in pages: the result ring (read-write) and the register file (read-only) */
+#	define SHA256_ACCEL_MMAP_RING 0
+#	define SHA256_ACCEL_MMAP_REGS 1
+
+/* register indices that may be polled through the SHA256_ACCEL_MMAP_REGS window */
+#	define SHA256_ACCEL_REG_NONCE_CANDIDATE 19
+#	define SHA256_ACCEL_REG_NONCE_CURRENT 20
+#	define SHA256_ACCEL_REG_STATUS 23
+#	define SHA256_ACCEL_REG_JOB_ID 73
+
+/* set in the status register while a queued job waits for the running one to finish */
+#	define SHA256_ACCEL_STATUS_NEXT_ARMED 0x100
+/* set while the candidate fifo holds a nonce, in continue mode the core keeps
+ * running and each candidate is popped with SHA256_ACCEL_CONTROL_POP */
+#	define SHA256_ACCEL_STATUS_CANDIDATE 0x200
+/* a candidate was dropped because the fifo was full, sticky until reset */
+#	define SHA256_ACCEL_STATUS_FIFO_OVERFLOW 0x400
+#	define SHA256_ACCEL_STATUS_FIFO_COUNT(status) (((status) >> 16) & 0x1f)
+
+#	define SHA256_ACCEL_FIFO_DEPTH 16
+
+/* SHA256_ACCEL_SET_CONTROL bits, each write is a one-cycle pulse */
+#	define SHA256_ACCEL_CONTROL_RESET 0x1
+#	define SHA256_ACCEL_CONTROL_START 0x2
+#	define SHA256_ACCEL_CONTROL_ARM_NEXT 0x4
+#	define SHA256_ACCEL_CONTROL_POP 0x8
+/* report candidates without stopping the range, until the next reset */
+#	define SHA256_ACCEL_CONTROL_CONTINUE 0x10
 
 struct sha256_accel_msg_s {
 	__u32 status;
 	__u32 nonce_candidate;
+	/* the job the candidate belongs to, or the one running at interrupt time */
+	__u32 job_id;
+};
+
+/* a job for the shadow register bank, started the cycle after the running range is exhausted */
+struct sha256_accel_job_s {
+	unsigned char state_in[32];
+	unsigned char prefix[12];
+	unsigned char difficulty_mask[32];
+	__u32 nonce_first;
+	__u32 nonce_last;
+	__u32 job_id;
+};
+
+/* the page shared through SHA256_ACCEL_MMAP_RING. head is only written by the
+ * driver, tail only by the consumer; both are free-running and index msgs
+ * modulo SHA256_ACCEL_RING_SIZE. read() consumes from the same ring, so a
+ * process should use one or the other. */
+struct sha256_accel_ring_s {
+	__u32 head;
+	__u32 tail;
+	/* results dropped because the ring was full */
+	__u32 overflows;
+	__u32 reserved;
+	struct sha256_accel_msg_s msgs[SHA256_ACCEL_RING_SIZE];
 };
 
 #endif
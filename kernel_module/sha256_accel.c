@@ -5,9 +5,13 @@
 #include <linux/device.h>
 #include <linux/poll.h>
 #include <linux/sched.h>
-#include <linux/list.h>
-#include <linux/slab.h>
 #include <linux/interrupt.h>
+#include <linux/mm.h>
+#include <linux/of.h>
+#include <linux/platform_device.h>
+#include <linux/idr.h>
+#include <linux/kref.h>
+#include <linux/slab.h>
 #include <asm/uaccess.h>
 #include <asm/io.h>
 
@@ -28,24 +32,35 @@
 #define SLCR_UNLOCK_KEY 0xdf0d
 #define SLCR_LOCK_KEY 0x767b
 
-/* sha256 Accelerator Control Registers */
-#define SHA256_ACCEL_ADDR_BASE 0x43c00000
+/* sha256 Accelerator Control Registers, relative to the base of each instance */
 #define SHA256_ACCEL_ADDR_LEN (SHA256_ACCEL_NUM_REGS * sizeof(__u32))
 
 #define REG_STATE_IN 0
 #define REG_PREFIX 8
 #define REG_DIFFICULTY_MASK 11
-#define REG_NONCE_CANDIDATE 19
-#define REG_NONCE_CURRENT 20
+#define REG_NONCE_CANDIDATE SHA256_ACCEL_REG_NONCE_CANDIDATE
+#define REG_NONCE_CURRENT SHA256_ACCEL_REG_NONCE_CURRENT
 #define REG_NONCE_FIRST 21
 #define REG_NONCE_LAST 22
-#define REG_STATUS 23
+#define REG_STATUS SHA256_ACCEL_REG_STATUS
 #define REG_CONTROL 24
 #define REG_IRQ_MASK 25
 #define REG_STEP 26
 #define REG_DEBUG 27
-
-#define SHA256_ACCEL_IRQ 61
+#define REG_NEXT_STATE_IN 52
+#define REG_NEXT_PREFIX 60
+#define REG_NEXT_DIFFICULTY_MASK 63
+#define REG_NEXT_NONCE_FIRST 71
+#define REG_NEXT_NONCE_LAST 72
+#define REG_JOB_ID SHA256_ACCEL_REG_JOB_ID
+#define REG_NEXT_JOB_ID 74
+#define REG_CANDIDATE_JOB_ID 75
+
+#define CONTROL_ARM_NEXT SHA256_ACCEL_CONTROL_ARM_NEXT
+#define CONTROL_POP SHA256_ACCEL_CONTROL_POP
+#define STATUS_BUSY 0x2
+#define STATUS_FIN 0x4
+#define STATUS_FOUND 0x10
 
 
 MODULE_LICENSE("GPL");
@@ -53,97 +68,136 @@ MODULE_AUTHOR("Kjell Braden <afflux@pentabarf.de>, Martin Keßler <martin@moegge
 MODULE_DESCRIPTION("make the sha256 accelerator usable in user space programs");
 MODULE_SUPPORTED_DEVICE(DEVICE_NAME);
 
-struct sha256_accel_msg_list_s {
-	struct list_head list;
-	struct sha256_accel_msg_s payload;
+/* one per accelerator core found in the device tree, /dev/sha256<id>. an open
+ * file and every mapping of the ring hold a reference, so an instance unbound
+ * while in use goes away with the last of them rather than in remove() */
+struct sha256_accel_dev_s {
+	struct kref kref;
+	int id;
+	struct device *device;
+	int irq;
+	/* set by remove(), wakes and fails readers */
+	bool removed;
+
+	/* physical base of the register file, for mmap() */
+	resource_size_t mem_base;
+	struct resource *region;
+	__u32 __iomem *mem;
+
+	/* held while the device is open, only one process may drive a core */
+	struct mutex device_mutex;
+	wait_queue_head_t queue;
+
+	/* results are passed from the interrupt handler (the only producer) to read()
+	 * or an mmap()ing process (the only consumer) through a ring in a page of its
+	 * own. the producer only writes head, the consumer only writes tail. */
+	struct sha256_accel_ring_s *ring;
+	/* serializes readers, the interrupt handler never takes it */
+	struct mutex read_mutex;
+
+	/* job running at the last interrupt, only touched by the handler */
+	__u32 last_job_id;
 };
 
 static int sha256_accel_major;
 static struct class* sha256_accel_class = NULL;
-static struct device* sha256_accel_device = NULL;
 
-static DEFINE_MUTEX(sha256_accel_device_mutex);
-static DECLARE_WAIT_QUEUE_HEAD(sha256_accel_queue);
-static LIST_HEAD(sha256_accel_msg_list);
-static DEFINE_MUTEX(sha256_accel_msg_mutex);
-static struct sha256_accel_msg_list_s *sha256_accel_msg = NULL;
-static __u32 *slcr_mem, *sha256_accel_mem;
+/* minor number -> instance, protected by sha256_accel_devs_mutex */
+static struct sha256_accel_dev_s *sha256_accel_devs[SHA256_ACCEL_MAX_DEVICES];
+static DEFINE_MUTEX(sha256_accel_devs_mutex);
+static DEFINE_IDA(sha256_accel_ida);
 
-static bool sha256_accel_msg_dequeue(void) {
-	struct list_head *ptr;
+/* the fabric clock is shared by all instances */
+static __u32 *slcr_mem;
 
-	if (sha256_accel_msg)
-		kfree(sha256_accel_msg);
+/* also undoes a probe() that got only partway */
+static void sha256_accel_free(struct kref *kref) {
+	struct sha256_accel_dev_s *dev = container_of(kref, struct sha256_accel_dev_s, kref);
 
-	if (mutex_lock_interruptible(&sha256_accel_msg_mutex)) {
-		/* we failed to acquire the lock, but still have to clear the message pointers */
-		sha256_accel_msg = NULL;
-		return false;
-	} else if (list_empty(&sha256_accel_msg_list)) {
-		/* there are no messages left in the list, so we just clear the message pointers */
-		mutex_unlock(&sha256_accel_msg_mutex);
-		sha256_accel_msg = NULL;
-		return false;
-	} else {
-		/* there are messages available, so we fetch the next one from the list */
-		ptr = sha256_accel_msg_list.next;
-		/* remove it from the list */
-		list_del(ptr);
-		/* give back the lock (we are now not working on the list anymore) */
-		mutex_unlock(&sha256_accel_msg_mutex);
-		/* retrieve the underlying structure */
-		sha256_accel_msg = list_entry(ptr, struct sha256_accel_msg_list_s, list);
-		return true;
+	if (dev->ring != NULL) {
+		ClearPageReserved(virt_to_page(dev->ring));
+		free_page((unsigned long) dev->ring);
 	}
+	if (dev->mem != NULL)
+		iounmap(dev->mem);
+	if (dev->region != NULL)
+		release_mem_region(dev->region->start, resource_size(dev->region));
+	kfree(dev);
 }
 
-static size_t sha256_accel_msg_avail(void) {
-	if (sha256_accel_msg)
-		/* if there is data in the current message, return that */
-		return sizeof(sha256_accel_msg->payload);
-	else if (sha256_accel_msg_dequeue())
-		/* otherwise try to dequeue the next message and do a tail-recursive call */
-		return sha256_accel_msg_avail();
-	else
-		/* if that fails too, we have nothing left that could be processed */
-		return 0;
+/* the tail may have been written by user space through the mmap()ed ring, so
+ * the caller reads it once and anything above SHA256_ACCEL_RING_SIZE is bogus */
+static size_t sha256_accel_msg_avail(struct sha256_accel_dev_s *dev, __u32 tail) {
+	/* pairs with the barrier in the interrupt handler: the entries are
+	 * visible before the head that publishes them */
+	__u32 head = ACCESS_ONCE(dev->ring->head);
+	smp_rmb();
+	return head - tail;
 }
 
 static ssize_t sha256_accel_read(struct file *file_ptr, char __user *buffer, size_t length, loff_t *offset) {
-	size_t avail, copy, copied;
-	ssize_t ret;
+	struct sha256_accel_dev_s *dev = file_ptr->private_data;
+	struct sha256_accel_ring_s *ring = dev->ring;
+	size_t avail, count, first;
+	__u32 tail;
 
-	/* if there is no space where we could copy data, we can return immediately */
-	if (length == 0)
-		return 0;
+	/* only whole messages are handed out */
+	if (length < sizeof(struct sha256_accel_msg_s))
+		return -EINVAL;
+
+	if (mutex_lock_interruptible(&dev->read_mutex))
+		return -ERESTARTSYS;
 
-	/* determine the amount of data that can be read and that would fit in the buffer provided by the user */
 	while (true) {
-		avail = sha256_accel_msg_avail();
+		tail = ACCESS_ONCE(ring->tail);
+		avail = sha256_accel_msg_avail(dev, tail);
 
 		if (avail > 0)
 			/* we have data available, so everything is fine */
 			break;
+
+		mutex_unlock(&dev->read_mutex);
+
 		/* if we have no data to copy, the action depends on the policy of the file */
-		else if (file_ptr->f_flags & O_NONBLOCK)
+		if (file_ptr->f_flags & O_NONBLOCK)
 			/* we are asynchroneous, so we can return immediately */
 			return -EAGAIN;
 		/* we have to wait for incoming data and put ourselves to sleep */
-		else if (wait_event_interruptible(sha256_accel_queue, sha256_accel_msg_avail() > 0))
+		else if (wait_event_interruptible(dev->queue, ACCESS_ONCE(dev->removed)
+					|| sha256_accel_msg_avail(dev, ACCESS_ONCE(ring->tail)) > 0))
+			return -ERESTARTSYS;
+		if (ACCESS_ONCE(dev->removed))
+			return -ENODEV;
+
+		if (mutex_lock_interruptible(&dev->read_mutex))
 			return -ERESTARTSYS;
 	}
 
-	/* if we have more data than the user can accept, we have to limit ourselves */
-	copy = (avail >= length) ? length : avail;
+	/* a tail the mapping left behind the head by more than the ring holds
+	 * would have the copies below run past the ring's page */
+	if (avail > SHA256_ACCEL_RING_SIZE) {
+		mutex_unlock(&dev->read_mutex);
+		return -EIO;
+	}
+
+	/* hand out as many messages as fit in the buffer in one go */
+	count = min(avail, length / sizeof(struct sha256_accel_msg_s));
+	first = min(count, (size_t) (SHA256_ACCEL_RING_SIZE - tail % SHA256_ACCEL_RING_SIZE));
+
+	if (copy_to_user(buffer, &ring->msgs[tail % SHA256_ACCEL_RING_SIZE], first * sizeof(struct sha256_accel_msg_s))
+			|| copy_to_user(buffer + first * sizeof(struct sha256_accel_msg_s), ring->msgs,
+				(count - first) * sizeof(struct sha256_accel_msg_s))) {
+		mutex_unlock(&dev->read_mutex);
+		return -EFAULT;
+	}
 
-	/* copy the data over to the user and derive the amount of data that was copied */
-	copied = copy_to_user(buffer, &sha256_accel_msg->payload, copy);
-	ret = (copied == 0) ? copy : copied;
+	/* the entries must be read before the producer may overwrite them */
+	smp_mb();
+	ACCESS_ONCE(ring->tail) = tail + count;
 
-	/* we have copied data, so this message is done and we can try to dequeue the next one. */
-	sha256_accel_msg_dequeue();
+	mutex_unlock(&dev->read_mutex);
 
-	return ret;
+	return count * sizeof(struct sha256_accel_msg_s);
 }
 
 static ssize_t sha256_accel_write(struct file *file_ptr, const char __user *buffer, size_t length, loff_t *offset) {
@@ -152,21 +206,26 @@ static ssize_t sha256_accel_write(struct file *file_ptr, const char __user *buff
 }
 
 static unsigned int sha256_accel_poll(struct file *file_ptr, struct poll_table_struct *poll_table) {
+	struct sha256_accel_dev_s *dev = file_ptr->private_data;
+
 	/* register this process on the message queue that could give us new data */
-	poll_wait(file_ptr, &sha256_accel_queue, poll_table);
+	poll_wait(file_ptr, &dev->queue, poll_table);
 
 	/* determine if we have anything left that could be passed to the user.
 	 * if yes, modify the mask to signal that data is available */
-	if (sha256_accel_msg_avail() > 0)
+	if (sha256_accel_msg_avail(dev, ACCESS_ONCE(dev->ring->tail)) > 0)
 		return POLLIN | POLLRDNORM;
 	else
 		return 0;
 }
 
 static long sha256_accel_ioctl(struct file *file_ptr, unsigned int command, unsigned long param) {
+	struct sha256_accel_dev_s *dev = file_ptr->private_data;
+	__u32 __iomem *mem = dev->mem;
 	void *addr;
 	const void *caddr;
 	unsigned char buf[4*SHA256_ACCEL_NUM_REGS];
+	struct sha256_accel_job_s job;
 	__u32 val, lock;
 
 	if (_IOC_TYPE(command) != SHA256_ACCEL_MAGIC)
@@ -174,11 +233,11 @@ static long sha256_accel_ioctl(struct file *file_ptr, unsigned int command, unsi
 
 	switch(command) {
 	case SHA256_ACCEL_RESET:
-		iowrite8(0x1, &sha256_accel_mem[REG_CONTROL]);
+		iowrite8(0x1, &mem[REG_CONTROL]);
 		break;
 
 	case SHA256_ACCEL_START:
-		iowrite8(0x2, &sha256_accel_mem[REG_CONTROL]);
+		iowrite8(0x2, &mem[REG_CONTROL]);
 		break;
 
 	case SHA256_ACCEL_SET_STATE_IN:
@@ -188,7 +247,7 @@ static long sha256_accel_ioctl(struct file *file_ptr, unsigned int command, unsi
 			return -EFAULT;
 
 		copy_from_user(buf, caddr, 32);
-		memcpy_toio(&sha256_accel_mem[REG_STATE_IN], buf, 32);
+		memcpy_toio(&mem[REG_STATE_IN], buf, 32);
 		break;
 
 	case SHA256_ACCEL_SET_PREFIX:
@@ -198,7 +257,7 @@ static long sha256_accel_ioctl(struct file *file_ptr, unsigned int command, unsi
 			return -EFAULT;
 
 		copy_from_user(buf, caddr, 12);
-		memcpy_toio(&sha256_accel_mem[REG_PREFIX], buf, 12);
+		memcpy_toio(&mem[REG_PREFIX], buf, 12);
 		break;
 
 	case SHA256_ACCEL_SET_DIFFICULTY_MASK:
@@ -208,19 +267,19 @@ static long sha256_accel_ioctl(struct file *file_ptr, unsigned int command, unsi
 			return -EFAULT;
 
 		copy_from_user(buf, caddr, 32);
-		memcpy_toio(&sha256_accel_mem[REG_DIFFICULTY_MASK], buf, 32);
+		memcpy_toio(&mem[REG_DIFFICULTY_MASK], buf, 32);
 		break;
 
 	case SHA256_ACCEL_SET_CONTROL:
-		iowrite32((const __u32) param, &sha256_accel_mem[REG_CONTROL]);
+		iowrite32((const __u32) param, &mem[REG_CONTROL]);
 		break;
 
 	case SHA256_ACCEL_SET_NONCE_FIRST:
-		iowrite32((const __u32) param, &sha256_accel_mem[REG_NONCE_FIRST]);
+		iowrite32((const __u32) param, &mem[REG_NONCE_FIRST]);
 		break;
 
 	case SHA256_ACCEL_SET_NONCE_LAST:
-		iowrite32((const __u32) param, &sha256_accel_mem[REG_NONCE_LAST]);
+		iowrite32((const __u32) param, &mem[REG_NONCE_LAST]);
 		break;
 
 	case SHA256_ACCEL_SET_CLOCK_SPEED:
@@ -260,17 +319,27 @@ static long sha256_accel_ioctl(struct file *file_ptr, unsigned int command, unsi
 		break;
 
 	case SHA256_ACCEL_GET_NONCE_CURRENT:
-		if (IS_ERR_VALUE(put_user(ioread32(&sha256_accel_mem[REG_NONCE_CURRENT]), (__u32 __user *) param)))
+		if (IS_ERR_VALUE(put_user(ioread32(&mem[REG_NONCE_CURRENT]), (__u32 __user *) param)))
 			 return -EFAULT;
 		break;
 
 	case SHA256_ACCEL_GET_NONCE_CANDIDATE:
-		if (IS_ERR_VALUE(put_user(ioread32(&sha256_accel_mem[REG_NONCE_CANDIDATE]), (__u32 __user *) param)))
+		if (IS_ERR_VALUE(put_user(ioread32(&mem[REG_NONCE_CANDIDATE]), (__u32 __user *) param)))
 			 return -EFAULT;
 		break;
 
 	case SHA256_ACCEL_GET_STATUS:
-		if (IS_ERR_VALUE(put_user(ioread32(&sha256_accel_mem[REG_STATUS]), (__u32 __user *) param)))
+		if (IS_ERR_VALUE(put_user(ioread32(&mem[REG_STATUS]), (__u32 __user *) param)))
+			 return -EFAULT;
+		break;
+
+	case SHA256_ACCEL_GET_JOB_ID:
+		if (IS_ERR_VALUE(put_user(ioread32(&mem[REG_JOB_ID]), (__u32 __user *) param)))
+			 return -EFAULT;
+		break;
+
+	case SHA256_ACCEL_GET_OVERFLOWS:
+		if (IS_ERR_VALUE(put_user(ACCESS_ONCE(dev->ring->overflows), (__u32 __user *) param)))
 			 return -EFAULT;
 		break;
 
@@ -280,14 +349,37 @@ static long sha256_accel_ioctl(struct file *file_ptr, unsigned int command, unsi
 		if (!access_ok(VERIFY_WRITE, addr, 4*SHA256_ACCEL_NUM_REGS))
 			return -EFAULT;
 
-		memcpy_fromio(buf, sha256_accel_mem, 4*SHA256_ACCEL_NUM_REGS);
+		memcpy_fromio(buf, mem, 4*SHA256_ACCEL_NUM_REGS);
 		copy_to_user(addr, buf, 4*SHA256_ACCEL_NUM_REGS);
 
 		break;
 
 	case SHA256_ACCEL_STEP:
-		iowrite32(0x1, &sha256_accel_mem[REG_STEP]);
+		iowrite32(0x1, &mem[REG_STEP]);
+
+		break;
+
+	case SHA256_ACCEL_SET_JOB_ID:
+		iowrite32((const __u32) param, &mem[REG_JOB_ID]);
+		break;
+
+	case SHA256_ACCEL_QUEUE_JOB:
+		caddr = (const void __user *) param;
+
+		if (copy_from_user(&job, caddr, sizeof(job)))
+			return -EFAULT;
 
+		/* the shadow bank must not change while the core may take it over */
+		if (ioread32(&mem[REG_STATUS]) & SHA256_ACCEL_STATUS_NEXT_ARMED)
+			return -EBUSY;
+
+		memcpy_toio(&mem[REG_NEXT_STATE_IN], job.state_in, sizeof(job.state_in));
+		memcpy_toio(&mem[REG_NEXT_PREFIX], job.prefix, sizeof(job.prefix));
+		memcpy_toio(&mem[REG_NEXT_DIFFICULTY_MASK], job.difficulty_mask, sizeof(job.difficulty_mask));
+		iowrite32(job.nonce_first, &mem[REG_NEXT_NONCE_FIRST]);
+		iowrite32(job.nonce_last, &mem[REG_NEXT_NONCE_LAST]);
+		iowrite32(job.job_id, &mem[REG_NEXT_JOB_ID]);
+		iowrite8(CONTROL_ARM_NEXT, &mem[REG_CONTROL]);
 		break;
 
 	default:
@@ -297,20 +389,93 @@ static long sha256_accel_ioctl(struct file *file_ptr, unsigned int command, unsi
 	return 0;
 }
 
+static void sha256_accel_ring_vm_open(struct vm_area_struct *vma) {
+	struct sha256_accel_dev_s *dev = vma->vm_private_data;
+
+	kref_get(&dev->kref);
+}
+
+static void sha256_accel_ring_vm_close(struct vm_area_struct *vma) {
+	struct sha256_accel_dev_s *dev = vma->vm_private_data;
+
+	kref_put(&dev->kref, sha256_accel_free);
+}
+
+/* the ring page must stay allocated as long as it is mapped anywhere */
+static const struct vm_operations_struct sha256_accel_ring_vm_ops = {
+	.open = sha256_accel_ring_vm_open,
+	.close = sha256_accel_ring_vm_close,
+};
+
+static int sha256_accel_mmap(struct file *file_ptr, struct vm_area_struct *vma) {
+	struct sha256_accel_dev_s *dev = file_ptr->private_data;
+	unsigned long size = vma->vm_end - vma->vm_start;
+	int retval;
+
+	if (size != PAGE_SIZE)
+		return -EINVAL;
+
+	switch (vma->vm_pgoff) {
+	case SHA256_ACCEL_MMAP_RING:
+		/* the consumer has to advance the tail, so this one is writable */
+		retval = remap_pfn_range(vma, vma->vm_start, virt_to_phys(dev->ring) >> PAGE_SHIFT,
+				size, vma->vm_page_prot);
+		if (retval)
+			return retval;
+
+		vma->vm_ops = &sha256_accel_ring_vm_ops;
+		vma->vm_private_data = dev;
+		sha256_accel_ring_vm_open(vma);
+		return 0;
+
+	case SHA256_ACCEL_MMAP_REGS:
+		/* polling status and progress must not be able to start or reset the core */
+		if (vma->vm_flags & VM_WRITE)
+			return -EPERM;
+		vma->vm_flags &= ~VM_MAYWRITE;
+
+		vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+		return io_remap_pfn_range(vma, vma->vm_start, dev->mem_base >> PAGE_SHIFT,
+				size, vma->vm_page_prot);
+
+	default:
+		return -EINVAL;
+	}
+}
+
 static int sha256_accel_open(struct inode *inode, struct file *file_ptr) {
+	struct sha256_accel_dev_s *dev = NULL;
+	unsigned int minor = iminor(inode);
+
+	mutex_lock(&sha256_accel_devs_mutex);
+	if (minor < SHA256_ACCEL_MAX_DEVICES)
+		dev = sha256_accel_devs[minor];
+
 	/* try to acquire the lock on the device. If we fail to do so, someone else has the device open. */
-	if (!mutex_trylock(&sha256_accel_device_mutex))
+	if (dev != NULL && !mutex_trylock(&dev->device_mutex)) {
+		mutex_unlock(&sha256_accel_devs_mutex);
 		return -EBUSY;
+	}
+	if (dev != NULL)
+		kref_get(&dev->kref);
+	mutex_unlock(&sha256_accel_devs_mutex);
+
+	if (dev == NULL)
+		return -ENODEV;
 
+	file_ptr->private_data = dev;
 	return 0;
 }
 
 static int sha256_accel_release(struct inode *inode, struct file *file_ptr) {
+	struct sha256_accel_dev_s *dev = file_ptr->private_data;
+
 	/* stop any running computation */
-	iowrite8(0x1, &sha256_accel_mem[REG_CONTROL]);
+	iowrite8(0x1, &dev->mem[REG_CONTROL]);
 
 	/* give back the lock */
-	mutex_unlock(&sha256_accel_device_mutex);
+	mutex_unlock(&dev->device_mutex);
+	kref_put(&dev->kref, sha256_accel_free);
 	return 0;
 }
 
@@ -320,30 +485,220 @@ static const struct file_operations sha256_accel_fops = {
 	.write = sha256_accel_write,
 	.poll = sha256_accel_poll,
 	.unlocked_ioctl = sha256_accel_ioctl,
+	.mmap = sha256_accel_mmap,
 	.open = sha256_accel_open,
 	.release = sha256_accel_release
 };
 
-static irqreturn_t sha256_accel_irq(int irqid, void *dev_id) {
-	struct sha256_accel_msg_list_s *msg;
+/* queues one result for read()/mmap(), false if the ring is full */
+static bool sha256_accel_push(struct sha256_accel_dev_s *dev, __u32 status, __u32 nonce, __u32 job_id) {
+	struct sha256_accel_ring_s *ring = dev->ring;
+	struct sha256_accel_msg_s *msg;
+	__u32 head = ring->head;
+
+	/* the tail may come from user space, so anything odd counts as full */
+	if (head - ACCESS_ONCE(ring->tail) >= SHA256_ACCEL_RING_SIZE) {
+		/* nobody is reading, drop the result rather than block in here */
+		ring->overflows++;
+		/* this runs in the interrupt handler for every dropped candidate,
+		 * ring->overflows has the count */
+		printk_ratelimited(KERN_WARNING CLASS_NAME ": %d: result ring full, dropping status=%08x\n",
+				dev->id, status);
+		return false;
+	}
 
-	msg = (struct sha256_accel_msg_list_s *) kmalloc(sizeof(*msg), GFP_KERNEL);
-	msg->payload.status = ioread32(&sha256_accel_mem[REG_STATUS]);
-	msg->payload.nonce_candidate = ioread32(&sha256_accel_mem[REG_NONCE_CANDIDATE]);
+	/* the consumer must have finished reading the entry before we reuse it */
+	smp_mb();
+
+	msg = &ring->msgs[head % SHA256_ACCEL_RING_SIZE];
+	msg->status = status;
+	msg->nonce_candidate = nonce;
+	msg->job_id = job_id;
+
+	pr_debug(CLASS_NAME ": %d: received interrupt: status=%08x nc=%08x\n", dev->id, msg->status,
+			msg->nonce_candidate);
+
+	/* publish the entry only after it has been written completely */
+	smp_wmb();
+	ACCESS_ONCE(ring->head) = head + 1;
+	return true;
+}
 
-	iowrite32(0x1, &sha256_accel_mem[REG_IRQ_MASK]);
+static irqreturn_t sha256_accel_irq(int irqid, void *dev_id) {
+	struct sha256_accel_dev_s *dev = dev_id;
+	__u32 __iomem *mem = dev->mem;
+	__u32 status, job_id;
+	unsigned int drained = 0;
+
+	/* acknowledge first: a candidate found while we drain raises a new interrupt */
+	iowrite32(0x1, &mem[REG_IRQ_MASK]);
+
+	status = ioread32(&mem[REG_STATUS]);
+
+	/* in continue mode the core keeps running and may have queued up several
+	 * candidates by now, hand out all of them. the bound only guards against
+	 * a core that does not pop. */
+	while (!(status & STATUS_FOUND) && (status & SHA256_ACCEL_STATUS_CANDIDATE)
+			&& drained < SHA256_ACCEL_FIFO_DEPTH) {
+		sha256_accel_push(dev, status, ioread32(&mem[REG_NONCE_CANDIDATE]),
+				ioread32(&mem[REG_CANDIDATE_JOB_ID]));
+		iowrite8(CONTROL_POP, &mem[REG_CONTROL]);
+		status = ioread32(&mem[REG_STATUS]);
+		drained++;
+	}
 
-	DBG(KERN_INFO, "received interrupt: status=%08x nc=%08x\n", msg->payload.status, msg->payload.nonce_candidate);
+	job_id = ioread32(&mem[REG_JOB_ID]);
 
-	mutex_lock(&sha256_accel_msg_mutex);
-	list_add_tail(&msg->list, &sha256_accel_msg_list);
-	mutex_unlock(&sha256_accel_msg_mutex);
+	if (status & STATUS_FOUND) {
+		/* stopped on a candidate, SHA256_ACCEL_START pops it and resumes */
+		sha256_accel_push(dev, status, ioread32(&mem[REG_NONCE_CANDIDATE]),
+				ioread32(&mem[REG_CANDIDATE_JOB_ID]));
+	} else if (!drained || job_id != dev->last_job_id || !(status & (STATUS_BUSY | STATUS_FIN))) {
+		/* a state change: idle, or the queued job has been taken over. an
+		 * interrupt for candidates alone needs no status message. */
+		sha256_accel_push(dev, status, ioread32(&mem[REG_NONCE_CANDIDATE]), job_id);
+	}
+	dev->last_job_id = job_id;
 
-	wake_up(&sha256_accel_queue);
+	wake_up(&dev->queue);
 
 	return IRQ_HANDLED;
 }
 
+static int sha256_accel_probe(struct platform_device *pdev) {
+	struct sha256_accel_dev_s *dev;
+	struct resource *res;
+	int retval;
+
+	/* not devm, it may outlive the binding */
+	dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+	if (dev == NULL)
+		return -ENOMEM;
+
+	kref_init(&dev->kref);
+	mutex_init(&dev->device_mutex);
+	mutex_init(&dev->read_mutex);
+	init_waitqueue_head(&dev->queue);
+
+	res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
+	if (res == NULL || resource_size(res) < SHA256_ACCEL_ADDR_LEN) {
+		dev_err(&pdev->dev, "missing or too small register region\n");
+		retval = -EINVAL;
+		goto error_alloc;
+	}
+	dev->mem_base = res->start;
+
+	dev->region = request_mem_region(res->start, resource_size(res), dev_name(&pdev->dev));
+	if (dev->region == NULL) {
+		retval = -EBUSY;
+		goto error_alloc;
+	}
+	dev->mem = ioremap_nocache(res->start, resource_size(res));
+	if (dev->mem == NULL) {
+		retval = -ENOMEM;
+		goto error_alloc;
+	}
+
+	dev->irq = platform_get_irq(pdev, 0);
+	if (dev->irq < 0) {
+		dev_err(&pdev->dev, "missing interrupt\n");
+		retval = dev->irq;
+		goto error_alloc;
+	}
+
+	/* a page of its own, so it can be handed to user space as a whole */
+	dev->ring = (struct sha256_accel_ring_s *) get_zeroed_page(GFP_KERNEL);
+	if (dev->ring == NULL) {
+		retval = -ENOMEM;
+		goto error_alloc;
+	}
+	SetPageReserved(virt_to_page(dev->ring));
+
+	dev->id = ida_simple_get(&sha256_accel_ida, 0, SHA256_ACCEL_MAX_DEVICES, GFP_KERNEL);
+	if (dev->id < 0) {
+		retval = dev->id;
+		goto error_alloc;
+	}
+
+	/* make sure the core does not raise anything before we are ready for it */
+	iowrite8(0x1, &dev->mem[REG_CONTROL]);
+
+	retval = devm_request_irq(&pdev->dev, dev->irq, sha256_accel_irq, 0, dev_name(&pdev->dev), dev);
+	if (IS_ERR_VALUE(retval))
+		goto error_irq;
+
+	mutex_lock(&sha256_accel_devs_mutex);
+	sha256_accel_devs[dev->id] = dev;
+	mutex_unlock(&sha256_accel_devs_mutex);
+
+	dev->device = device_create(sha256_accel_class, &pdev->dev, MKDEV(sha256_accel_major, dev->id), dev,
+			DEVICE_NAME "%d", dev->id);
+	if (IS_ERR(dev->device)) {
+		DBG(KERN_ALERT, "Failed to create device '" DEVICE_NAME "%d'\n", dev->id);
+		retval = PTR_ERR(dev->device);
+		goto error_device;
+	}
+
+	platform_set_drvdata(pdev, dev);
+
+	DBG(KERN_INFO, "Created " DEVICE_NAME "%d at %08llx, irq %d.\n", dev->id,
+			(unsigned long long) dev->mem_base, dev->irq);
+
+	return 0;
+
+	/* if anything goes wrong, free the allocated ressources in the reverse order */
+error_device:
+	mutex_lock(&sha256_accel_devs_mutex);
+	sha256_accel_devs[dev->id] = NULL;
+	mutex_unlock(&sha256_accel_devs_mutex);
+	devm_free_irq(&pdev->dev, dev->irq, dev);
+error_irq:
+	ida_simple_remove(&sha256_accel_ida, dev->id);
+error_alloc:
+	kref_put(&dev->kref, sha256_accel_free);
+	return retval;
+}
+
+static int sha256_accel_remove(struct platform_device *pdev) {
+	struct sha256_accel_dev_s *dev = platform_get_drvdata(pdev);
+
+	/* turn off the accelerator (so it doesn't generate interrupts anymore) */
+	iowrite8(0x1, &dev->mem[REG_CONTROL]);
+	devm_free_irq(&pdev->dev, dev->irq, dev);
+
+	mutex_lock(&sha256_accel_devs_mutex);
+	sha256_accel_devs[dev->id] = NULL;
+	mutex_unlock(&sha256_accel_devs_mutex);
+
+	device_destroy(sha256_accel_class, MKDEV(sha256_accel_major, dev->id));
+	ida_simple_remove(&sha256_accel_ida, dev->id);
+
+	/* readers waiting for results that won't come any more */
+	ACCESS_ONCE(dev->removed) = true;
+	wake_up(&dev->queue);
+
+	/* the registers and the ring stay until the last open file and mapping
+	 * of them are gone */
+	kref_put(&dev->kref, sha256_accel_free);
+	return 0;
+}
+
+static const struct of_device_id sha256_accel_of_match[] = {
+	{ .compatible = SHA256_ACCEL_COMPATIBLE },
+	{ }
+};
+MODULE_DEVICE_TABLE(of, sha256_accel_of_match);
+
+static struct platform_driver sha256_accel_driver = {
+	.probe = sha256_accel_probe,
+	.remove = sha256_accel_remove,
+	.driver = {
+		.name = DEVICE_NAME,
+		.owner = THIS_MODULE,
+		.of_match_table = sha256_accel_of_match,
+	},
+};
+
 static int __init sha256_accel_init(void) {
 	int retval;
 	struct resource *mem;
@@ -355,7 +710,7 @@ static int __init sha256_accel_init(void) {
 		goto error_register;
 	}
 
-	DBG(KERN_INFO, "Created %s device with major number %d.\n", DEVICE_NAME, sha256_accel_major);
+	DBG(KERN_INFO, "Registered %s devices with major number %d.\n", DEVICE_NAME, sha256_accel_major);
 
 	sha256_accel_class = class_create(THIS_MODULE, CLASS_NAME);
 	if (IS_ERR(sha256_accel_class)) {
@@ -364,13 +719,6 @@ static int __init sha256_accel_init(void) {
 		goto error_class;
 	}
 
-	sha256_accel_device = device_create(sha256_accel_class, NULL, MKDEV(sha256_accel_major, 0), NULL, DEVICE_NAME);
-	if (IS_ERR(sha256_accel_device)) {
-		DBG(KERN_ALERT, "Failed to create device '%s'\n", DEVICE_NAME);
-		retval = PTR_ERR(sha256_accel_device);
-		goto error_device;
-	}
-
 	mem = request_mem_region(SLCR_ADDR_BASE, SLCR_ADDR_LEN, DEVICE_NAME);
 	if (mem == NULL) {
 		DBG(KERN_ALERT, "Failed to request memory region of length %d starting %p.\n", SLCR_ADDR_LEN, (void *) SLCR_ADDR_BASE);
@@ -379,28 +727,18 @@ static int __init sha256_accel_init(void) {
 	}
 	slcr_mem = ioremap_nocache(SLCR_ADDR_BASE, SLCR_ADDR_LEN);
 
-	mem = request_mem_region(SHA256_ACCEL_ADDR_BASE, SHA256_ACCEL_ADDR_LEN, DEVICE_NAME);
-	if (mem == NULL) {
-		DBG(KERN_ALERT, "Failed to request memory region of length %d starting %p.\n", SHA256_ACCEL_ADDR_LEN, (void *) SHA256_ACCEL_ADDR_BASE);
-		retval = -1;
-		goto error_mem_region_sha256;
-	}
-	sha256_accel_mem = ioremap_nocache(SHA256_ACCEL_ADDR_BASE, SHA256_ACCEL_ADDR_LEN);
-
-	retval = request_irq(SHA256_ACCEL_IRQ, sha256_accel_irq, 0, DEVICE_NAME, NULL);
-	if (IS_ERR_VALUE(retval))
-		goto error_irq;
+	/* the instances themselves come from the device tree, one probe each */
+	retval = platform_driver_register(&sha256_accel_driver);
+	if (retval)
+		goto error_driver;
 
 	return 0;
 
 	/* if anything goes wrong, free the allocated ressources in the reverse order */
-error_irq:
-error_mem_region_sha256:
+error_driver:
 	iounmap(slcr_mem);
 	release_mem_region(SLCR_ADDR_BASE, SLCR_ADDR_LEN);
 error_mem_region_slcr:
-error_device:
-	class_unregister(sha256_accel_class);
 	class_destroy(sha256_accel_class);
 error_class:
 	unregister_chrdev(sha256_accel_major, DEVICE_NAME);
@@ -409,42 +747,11 @@ error_register:
 }
 
 static void __exit sha256_accel_exit(void) {
-	struct list_head *ptr;
-	struct sha256_accel_msg_list_s *msg_ptr;
-
-	/* if any messages are left, free them */
-	if (sha256_accel_msg)
-		kfree(sha256_accel_msg);
-
-	// turn off the accelerator (so it doesn't generate interrupts anymore
-	iowrite32(0x1, &sha256_accel_mem[REG_CONTROL]);
-
-	mutex_lock(&sha256_accel_msg_mutex);
-	while (!list_empty(&sha256_accel_msg_list)) {
-		/* there are messages available, so we fetch the next one from the list */
-		ptr = sha256_accel_msg_list.next;
-		/* remove it from the list */
-		list_del(ptr);
-
-		/* retrieve the underlying structure */
-		msg_ptr = list_entry(ptr, struct sha256_accel_msg_list_s, list);
-
-		/* the linked-list object is not needed anymore */
-		kfree(msg_ptr);
-	}
-
-	iounmap(sha256_accel_mem);
-	release_mem_region(SHA256_ACCEL_ADDR_BASE, SHA256_ACCEL_ADDR_LEN);
+	platform_driver_unregister(&sha256_accel_driver);
 
 	iounmap(slcr_mem);
 	release_mem_region(SLCR_ADDR_BASE, SLCR_ADDR_LEN);
 
-	free_irq(SHA256_ACCEL_IRQ, NULL);
-	mutex_unlock(&sha256_accel_msg_mutex);
-
-
-	device_destroy(sha256_accel_class, MKDEV(sha256_accel_major, 0));
-	class_unregister(sha256_accel_class);
 	class_destroy(sha256_accel_class);
 	unregister_chrdev(sha256_accel_major, DEVICE_NAME);
 }
@@ -10,7 +10,10 @@ use sha256_lib.sha256_pkg.all;
 
 entity org is
   generic(
-    instances: natural range 1 to 16
+    -- double-hash pipeline pairs. pairs share the 16 load slots of a hw
+    -- core round-robin; beyond 16 the pairs of one slot run as parallel
+    -- lanes and are fed consecutive nonces in the same cycle
+    NUM_CORES: natural range 1 to 128
   );
   port(
     clk: in std_ulogic;
@@ -21,9 +24,20 @@ entity org is
     ctrl: in std_ulogic_vector(31 downto 0);
     nonce_first: in w32;
     nonce_last: in w32;
+    job_id: in w32;
+
+    -- the queued job, taken over as soon as the active range is exhausted
+    next_state_in: in std_ulogic_vector(0 to 255);
+    next_prefix: in std_ulogic_vector(0 to 95);
+    next_mask: in std_ulogic_vector(0 to 255);
+    next_nonce_first: in w32;
+    next_nonce_last: in w32;
+    next_job_id: in w32;
 
     nonce_candidate: out w32;
     nonce_current: out w32;
+    job_id_current: out w32;
+    job_id_candidate: out w32;
     status: out std_ulogic_vector(31 downto 0);
     irq: out std_ulogic;
 
@@ -35,22 +49,73 @@ end entity;
 architecture arc of org is
   constant RST_IDX: natural := 0;
   constant RUN_IDX: natural := 1;
+  constant ARM_IDX: natural := 2;
+  -- drops the head of the candidate fifo
+  constant POP_IDX: natural := 3;
+  -- report candidates without stopping the range, cleared by reset
+  constant CONTINUE_IDX: natural := 4;
+  constant NEXT_ARMED_IDX: natural := 8;
+  constant CANDIDATE_IDX: natural := 9;
+  constant OVERFLOW_IDX: natural := 10;
+  -- status(COUNT_HIGH downto COUNT_LOW) holds the fifo fill level
+  constant COUNT_LOW: natural := 16;
+  constant COUNT_HIGH: natural := 20;
   constant PADDING_0: std_ulogic_vector(0 to 383) := (0=>'1', 374=>'1', 376=>'1', others=>'0');
   constant PADDING_1: std_ulogic_vector(0 to 255) := (0=>'1', 247=>'1', others=>'0');
+  -- a result sits at the end of the pipeline for the 16 cycles between two
+  -- shifts, but is only valid for the later part of it: it is checked
+  -- exactly once, this many cycles after it was shifted in
+  constant CHECK_OFFSET: natural := 8;
+  -- all lanes of a slot may hit in the same cycle, there are at most 8. in
+  -- continue mode the fifo also has to bridge the interrupt latency
+  constant FIFO_DEPTH: natural := 16;
+
+  type std_ulogic_vector_2d is array (0 to NUM_CORES - 1) of std_ulogic_vector(0 to 10);
+  type w32_vector_2d is array (0 to NUM_CORES - 1) of w32_vector(0 to 10);
+  type block256_2d is array (0 to NUM_CORES - 1) of block256;
+  constant PIPE_EMPTY: std_ulogic_vector_2d := (others=>(others=>'0'));
 
-  type std_ulogic_vector_2d is array (0 to instances - 1) of std_ulogic_vector(0 to 10);
-  type w32_vector_2d is array (0 to instances - 1) of w32_vector(0 to 10);
-  type block256_2d is array (0 to instances - 1) of block256;
+  type candidate_t is record
+    nonce: w32;
+    job_id: w32;
+  end record;
+  type candidate_fifo_t is array (0 to FIFO_DEPTH - 1) of candidate_t;
 
   signal stage_pipe: std_ulogic_vector_2d;
   signal nonce_pipe: w32_vector_2d;
+  -- job generation each nonce in the pipeline was fed with
+  signal gen_pipe: std_ulogic_vector_2d;
 
   type state_t is (RDY, BUSY, FIN, IDLE, FOUND, ERR);
   signal status_internal: state_t;
+  signal status_state: std_ulogic_vector(31 downto 0);
   signal nonce: w32;
-  signal nonce_candidate_internal: w32;
+  signal nonce_resume: w32;
+
+  -- the job the pipelines are fed with, latched on start and on handover.
+  -- results still in flight from the previous job are checked against its
+  -- mask; this requires every range to be longer than the pipeline.
+  signal active_state_in: std_ulogic_vector(0 to 255);
+  signal active_prefix: std_ulogic_vector(0 to 95);
+  signal active_mask: std_ulogic_vector(0 to 255);
+  signal active_nonce_first: w32;
+  signal active_nonce_last: w32;
+  signal active_job_id: w32;
+  signal prev_mask: std_ulogic_vector(0 to 255);
+  signal prev_job_id: w32;
+  signal gen: std_ulogic;
+  signal next_armed: std_ulogic;
   signal ctr: unsigned(7 downto 0);
 
+  -- candidates found in the same cycle are reported one after the other
+  signal fifo: candidate_fifo_t;
+  signal fifo_rd: natural range 0 to FIFO_DEPTH - 1;
+  signal fifo_wr: natural range 0 to FIFO_DEPTH - 1;
+  signal fifo_count: natural range 0 to FIFO_DEPTH;
+  -- a candidate was dropped because the fifo was full, cleared by reset
+  signal fifo_overflow: std_ulogic;
+  signal continue_mode: std_ulogic;
+
   signal result_0, result_1: block256_2d;
   signal result_candidate: block256;
 
@@ -83,6 +148,16 @@ architecture arc of org is
     return res;
   end function;
   
+  -- number of pairs that are fed in load slot s
+  function slot_cores(s: natural) return natural is
+  begin
+    if s >= NUM_CORES then
+      return 0;
+    else
+      return (NUM_CORES - s + 15) / 16;
+    end if;
+  end function slot_cores;
+
   function uand(a: boolean; b: std_ulogic) return std_ulogic is
   begin
     if a = false then
@@ -99,87 +174,206 @@ begin
     begin
       return (mask and c) = (0 to 255=>'0');
     end function;
+
+    variable hit, hit_i: boolean;
+    variable take_next: boolean;
+    variable job: w32;
+    variable slot: natural range 0 to 15;
+    variable fed: w32;
+    variable rd, wr: natural range 0 to FIFO_DEPTH - 1;
+    variable count: natural range 0 to FIFO_DEPTH;
   begin
     if rising_edge(clk) then
       -- the interrupt line is low by default and will only be hight for one clock cycle when an interrupt has to be signaled
       irq <= '0';
       if ctrl(RST_IDX) = '1' then
-        stage_pipe <= (others=>(others=>'0'));
+        stage_pipe <= PIPE_EMPTY;
         status_internal <= RDY;
         clk_counter <= to_unsigned(0, clk_counter'length);
         ctr <= to_unsigned(0, ctr'length);
+        gen <= '0';
+        next_armed <= '0';
+        fifo_rd <= 0;
+        fifo_wr <= 0;
+        fifo_count <= 0;
+        fifo_overflow <= '0';
+        continue_mode <= '0';
       elsif step = '1' then
         clk_counter <= clk_counter + 1;
+        hit := false;
+        take_next := false;
+        slot := to_integer(ctr mod 16);
+        rd := fifo_rd;
+        wr := fifo_wr;
+        count := fifo_count;
+
+        if ctrl(ARM_IDX) = '1' then
+          next_armed <= '1';
+        end if;
+
+        if ctrl(CONTINUE_IDX) = '1' then
+          continue_mode <= '1';
+        end if;
+
+        -- in continue mode the fifo is drained while the core keeps running
+        if ctrl(POP_IDX) = '1' and continue_mode = '1' and count > 0 then
+          rd := (rd + 1) mod FIFO_DEPTH;
+          count := count - 1;
+        end if;
 
         -- the pipelines have to keep mooving, independent from the current state (status_internal)
-        for i in 0 to instances - 1 loop
-          if ctr mod 16 = i then
+        for i in 0 to NUM_CORES - 1 loop
+          if slot = i mod 16 then
             nonce_pipe(i) <= to_unsigned(0, nonce_pipe(i)'length) & nonce_pipe(i)(nonce_pipe(i)'low to nonce_pipe(i)'high - 1);
             stage_pipe(i) <= '0' & stage_pipe(i)(stage_pipe(i)'low to stage_pipe(i)'high - 1);
+            gen_pipe(i) <= '0' & gen_pipe(i)(gen_pipe(i)'low to gen_pipe(i)'high - 1);
           end if;
         end loop;
         ctr <= ctr + 1;
 
+        if (status_internal = BUSY or status_internal = FIN) then
+          -- the lanes of one slot are checked together, in nonce order
+          for i in 0 to NUM_CORES - 1 loop
+            if slot = (i + CHECK_OFFSET) mod 16 and stage_pipe(i)(stage_pipe(i)'high) = '1' then
+              hit_i := false;
+              if gen_pipe(i)(gen_pipe(i)'high) = gen then
+                -- everything up to the last lane of this slot has been checked
+                nonce_resume <= nonce_pipe(i)(nonce_pipe(i)'high) + 1;
+                if is_candidate(active_mask, result_1(i)) then
+                  hit_i := true;
+                  job := active_job_id;
+                end if;
+              elsif is_candidate(prev_mask, result_1(i)) then
+                -- without continue mode the rest of the previous range is
+                -- lost, but the active one has not run for longer than the
+                -- pipeline is deep
+                hit_i := true;
+                job := prev_job_id;
+                nonce_resume <= active_nonce_first;
+              end if;
+
+              if hit_i then
+                hit := true;
+                result_candidate <= result_1(i);
+                if count < FIFO_DEPTH then
+                  fifo(wr) <= (nonce_pipe(i)(nonce_pipe(i)'high), job);
+                  wr := (wr + 1) mod FIFO_DEPTH;
+                  count := count + 1;
+                else
+                  fifo_overflow <= '1';
+                end if;
+              end if;
+            end if;
+          end loop;
+        end if;
+
         case status_internal is
-          when RDY =>
+          -- a finished range can be followed by the next one without a reset
+          when RDY | IDLE =>
             if ctrl(RUN_IDX) = '1' then
               status_internal <= BUSY;
               ctr <= to_unsigned(0, ctr'length);
               nonce <= nonce_first;
+              active_state_in <= state_in;
+              active_prefix <= prefix;
+              active_mask <= mask;
+              active_nonce_first <= nonce_first;
+              active_nonce_last <= nonce_last;
+              active_job_id <= job_id;
+            elsif status_internal = IDLE and next_armed = '1' then
+              take_next := true;
             end if;
 
           when BUSY =>
-            for i in 0 to instances - 1 loop
-              -- if the counter is a multiple of 16
-              if ctr mod 16 = i then
-                -- we can feed in the next value
-                stage_pipe(i)(0) <= '1';
-                nonce_pipe(i)(0) <= nonce;
-                -- and calculate the next nonce
-                nonce <= nonce + 1;
-              end if;
-            end loop;
+            -- the range is split among the pairs: every pair of the current
+            -- slot gets the next nonce, lane by lane. nonce_last is exclusive.
+            if slot_cores(slot) > 0 then
+              for i in 0 to NUM_CORES - 1 loop
+                if slot = i mod 16 then
+                  fed := nonce + i / 16;
+                  if active_nonce_last - nonce > i / 16 then
+                    stage_pipe(i)(0) <= '1';
+                  else
+                    stage_pipe(i)(0) <= '0';
+                  end if;
+                  nonce_pipe(i)(0) <= fed;
+                  gen_pipe(i)(0) <= gen;
+                end if;
+              end loop;
+              nonce <= nonce + slot_cores(slot);
 
-            if nonce = nonce_last then
-              ctr <= (ctr mod 16) + 1;
-              status_internal <= FIN;
+              if active_nonce_last - nonce <= slot_cores(slot) then
+                if next_armed = '1' then
+                  take_next := true;
+                else
+                  status_internal <= FIN;
+                end if;
+              end if;
             end if;
 
           when FIN =>
-            if ctr = stage_pipe(0)'high * 16 then
+            if next_armed = '1' then
+              take_next := true;
+            elsif stage_pipe = PIPE_EMPTY then
+              -- every nonce fed has been checked
               irq <= '1';
               status_internal <= IDLE;
             end if;
 
-          when IDLE =>
-
           when FOUND =>
-            if ctrl(RUN_IDX) = '1' then
-              status_internal <= BUSY;
-              ctr <= to_unsigned(0, ctr'length);
-              nonce <= nonce_candidate_internal + 1;
+            if ctrl(RUN_IDX) = '1' and count > 0 then
+              rd := (rd + 1) mod FIFO_DEPTH;
+              count := count - 1;
+              if count > 0 then
+                -- report the next candidate of the same batch
+                irq <= '1';
+              else
+                -- the slots keep rotating, the pipeline is empty anyway
+                status_internal <= BUSY;
+                nonce <= nonce_resume;
+                -- whatever is still in flight was fed after the candidate
+                -- and will be fed again
+                stage_pipe <= PIPE_EMPTY;
+              end if;
             end if;
 
           when others =>
             status_internal <= ERR;
         end case;
 
-        if (status_internal = BUSY or status_internal = FIN) then
-          for i in 0 to instances - 1 loop
-            if stage_pipe(i)(stage_pipe(i)'high) = '1' and is_candidate(mask, result_1(i)) then
-              nonce_candidate_internal <= nonce_pipe(i)(nonce_pipe(i)'high);
-              result_candidate <= result_1(i);
-              irq <= '1';
-              status_internal <= FOUND;
-            end if;
-          end loop;
+        fifo_rd <= rd;
+        fifo_wr <= wr;
+        fifo_count <= count;
+
+        if hit and continue_mode = '0' then
+          irq <= '1';
+          status_internal <= FOUND;
+        elsif take_next then
+          -- hand over to the queued job without leaving a pipeline slot
+          -- empty: the next nonce is fed in the very next free slot
+          status_internal <= BUSY;
+          nonce <= next_nonce_first;
+          active_state_in <= next_state_in;
+          active_prefix <= next_prefix;
+          active_mask <= next_mask;
+          active_nonce_first <= next_nonce_first;
+          active_nonce_last <= next_nonce_last;
+          active_job_id <= next_job_id;
+          prev_mask <= active_mask;
+          prev_job_id <= active_job_id;
+          gen <= not gen;
+          next_armed <= '0';
+          irq <= '1';
+        elsif hit then
+          -- continue mode: the range goes on, software drains the fifo
+          irq <= '1';
         end if;
       end if;
     end if;
   end process;
 
   with status_internal
-    select status <=
+    select status_state <=
       (0=>'1', others=>'0') when RDY,
       (1=>'1', others=>'0') when BUSY,
       (2=>'1', others=>'0') when FIN,
@@ -188,14 +382,25 @@ begin
       (5=>'1', others=>'0') when ERR,
       (6=>'1', others=>'0') when others;
 
-  sha_instances: for i in 0 to instances - 1 generate
+  process(status_state, next_armed, fifo_count, fifo_overflow)
+  begin
+    status <= status_state;
+    status(NEXT_ARMED_IDX) <= next_armed;
+    if fifo_count > 0 then
+      status(CANDIDATE_IDX) <= '1';
+    end if;
+    status(OVERFLOW_IDX) <= fifo_overflow;
+    status(COUNT_HIGH downto COUNT_LOW) <= std_ulogic_vector(to_unsigned(fifo_count, COUNT_HIGH - COUNT_LOW + 1));
+  end process;
+
+  sha_instances: for i in 0 to NUM_CORES - 1 generate
     sha_0: entity work.hw(arc)
     port map (
       clk,
       ctrl(RST_IDX), -- reset
-      uand(ctr mod 16 = i, stage_pipe(i)(0)), -- load
-      to_block256(state_in), -- initial state
-      to_block512(prefix & std_ulogic_vector(nonce_pipe(i)(0)) & PADDING_0), -- padded message
+      uand(ctr mod 16 = i mod 16, stage_pipe(i)(0)), -- load
+      to_block256(active_state_in), -- initial state
+      to_block512(active_prefix & std_ulogic_vector(nonce_pipe(i)(0)) & PADDING_0), -- padded message
       result_0(i),
       step
     );
@@ -204,7 +409,7 @@ begin
     port map (
       clk,
       ctrl(RST_IDX), -- reset
-      uand(ctr mod 16 = i, stage_pipe(i)(5)), -- load
+      uand(ctr mod 16 = i mod 16, stage_pipe(i)(5)), -- load
       H0, -- initial state
       to_block512(to_suv256(result_0(i)) & PADDING_1), -- padded message
       result_1(i),
@@ -213,10 +418,12 @@ begin
   end generate;
 
   nonce_current <= nonce;
-  nonce_candidate <= nonce_candidate_internal;
+  nonce_candidate <= fifo(fifo_rd).nonce;
+  job_id_current <= active_job_id;
+  job_id_candidate <= fifo(fifo_rd).job_id;
   dbg(0 to 7) <= result_candidate;
-  dbg(8 to 15) <= to_block256(mask);
-  dbg(16 to 23) <= to_block256(to_suv256(result_candidate) and mask);
+  dbg(8 to 15) <= to_block256(active_mask);
+  dbg(16 to 23) <= to_block256(to_suv256(result_candidate) and active_mask);
   dbg(24) <= clk_counter;
 
 end architecture;
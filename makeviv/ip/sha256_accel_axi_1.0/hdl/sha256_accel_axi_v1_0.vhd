@@ -8,6 +8,10 @@ library sha256_lib;
 use sha256_lib.sha256_pkg.all;
 
 entity sha256_accel_axi_v1_0 is
+	generic (
+		-- double-hash pipeline pairs, see org
+		NUM_CORES : natural range 1 to 128 := 1
+	);
 	port (
 		sha256_accel_irq : out std_logic;
 
@@ -101,6 +105,14 @@ architecture arch_imp of sha256_accel_axi_v1_0 is
 	constant REG_IRQ_MASK: integer := 25;
 	constant REG_STEP: integer := 26;
 	constant REG_DEBUG: integer := 27;
+	constant REG_NEXT_STATE_IN: integer := 52;
+	constant REG_NEXT_PREFIX: integer := 60;
+	constant REG_NEXT_DIFFICULTY_MASK: integer := 63;
+	constant REG_NEXT_NONCE_FIRST: integer := 71;
+	constant REG_NEXT_NONCE_LAST: integer := 72;
+	constant REG_JOB_ID: integer := 73;
+	constant REG_NEXT_JOB_ID: integer := 74;
+	constant REG_CANDIDATE_JOB_ID: integer := 75;
 
 	-- AXI4LITE signals
 	signal axi_awaddr: unsigned(9 downto 0);
@@ -129,6 +141,15 @@ architecture arch_imp of sha256_accel_axi_v1_0 is
 	signal sha256_accel_status: std_logic_vector(31 downto 0);
 	signal sha256_accel_control: std_logic_vector(31 downto 0);
 	signal sha256_accel_irq_mask: std_logic;
+	signal sha256_accel_job_id: w32;
+	signal sha256_accel_job_id_current: w32;
+	signal sha256_accel_job_id_candidate: w32;
+	signal sha256_accel_next_state_in: std_logic_vector(255 downto 0);
+	signal sha256_accel_next_prefix: std_logic_vector(95 downto 0);
+	signal sha256_accel_next_difficulty_mask: std_logic_vector(255 downto 0);
+	signal sha256_accel_next_nonce_first: w32;
+	signal sha256_accel_next_nonce_last: w32;
+	signal sha256_accel_next_job_id: w32;
 
 	signal internal_clk: std_ulogic;
 	signal internal_state_in: std_ulogic_vector(255 downto 0);
@@ -140,6 +161,15 @@ architecture arch_imp of sha256_accel_axi_v1_0 is
 	signal internal_nonce_last: w32;
 	signal internal_status: std_ulogic_vector(31 downto 0);
 	signal internal_control: std_ulogic_vector(31 downto 0);
+	signal internal_job_id: w32;
+	signal internal_job_id_current: w32;
+	signal internal_job_id_candidate: w32;
+	signal internal_next_state_in: std_ulogic_vector(255 downto 0);
+	signal internal_next_prefix: std_ulogic_vector(95 downto 0);
+	signal internal_next_difficulty_mask: std_ulogic_vector(255 downto 0);
+	signal internal_next_nonce_first: w32;
+	signal internal_next_nonce_last: w32;
+	signal internal_next_job_id: w32;
 
 	signal internal_irq: std_ulogic;
 	signal external_irq: std_logic;
@@ -241,6 +271,13 @@ begin
 				sha256_accel_difficulty_mask <= (others => '0');
 				sha256_accel_nonce_first <= (others => '0');
 				sha256_accel_nonce_last <= (others => '1');
+				sha256_accel_job_id <= (others => '0');
+				sha256_accel_next_state_in <= (others => '0');
+				sha256_accel_next_prefix <= (others => '0');
+				sha256_accel_next_difficulty_mask <= (others => '0');
+				sha256_accel_next_nonce_first <= (others => '0');
+				sha256_accel_next_nonce_last <= (others => '1');
+				sha256_accel_next_job_id <= (others => '0');
 			else
 				loc_addr := to_integer(axi_awaddr(9 downto 2));
 				if (slv_reg_wren = '1') then
@@ -303,6 +340,56 @@ begin
 --						end if;
 					when REG_DEBUG =>
 						-- debug is read only
+					when REG_NEXT_STATE_IN to REG_NEXT_STATE_IN + 7 =>
+						reg_addr := loc_addr - REG_NEXT_STATE_IN;
+						for byte_index in 0 to 3 loop
+							if (sha256_accel_axi_wstrb(byte_index) = '1') then
+								data_bit := reg_addr * 32 + byte_index * 8;
+								sha256_accel_next_state_in(255 - data_bit downto 255 - 7 - data_bit) <= sha256_accel_axi_wdata(byte_index * 8 + 7 downto byte_index * 8);
+							end if;
+						end loop;
+					when REG_NEXT_PREFIX to REG_NEXT_PREFIX + 2 =>
+						reg_addr := loc_addr - REG_NEXT_PREFIX;
+						for byte_index in 0 to 3 loop
+							if (sha256_accel_axi_wstrb(byte_index) = '1') then
+								data_bit := reg_addr * 32 + byte_index * 8;
+								sha256_accel_next_prefix(95 - data_bit downto 95 - 7 - data_bit) <= sha256_accel_axi_wdata(byte_index * 8 + 7 downto byte_index * 8);
+							end if;
+						end loop;
+					when REG_NEXT_DIFFICULTY_MASK to REG_NEXT_DIFFICULTY_MASK + 7 =>
+						reg_addr := loc_addr - REG_NEXT_DIFFICULTY_MASK;
+						for byte_index in 0 to 3 loop
+							if (sha256_accel_axi_wstrb(byte_index) = '1') then
+								data_bit := reg_addr * 32 + byte_index * 8;
+								sha256_accel_next_difficulty_mask(255 - data_bit downto 255 - 7 - data_bit) <= sha256_accel_axi_wdata(byte_index * 8 + 7 downto byte_index * 8);
+							end if;
+						end loop;
+					when REG_NEXT_NONCE_FIRST =>
+						for byte_index in 0 to 3 loop
+							if (sha256_accel_axi_wstrb(byte_index) = '1') then
+								sha256_accel_next_nonce_first(byte_index * 8 + 7 downto byte_index * 8) <= unsigned(sha256_accel_axi_wdata(byte_index * 8 + 7 downto byte_index * 8));
+							end if;
+						end loop;
+					when REG_NEXT_NONCE_LAST =>
+						for byte_index in 0 to 3 loop
+							if (sha256_accel_axi_wstrb(byte_index) = '1') then
+								sha256_accel_next_nonce_last(byte_index * 8 + 7 downto byte_index * 8) <= unsigned(sha256_accel_axi_wdata(byte_index * 8 + 7 downto byte_index * 8));
+							end if;
+						end loop;
+					when REG_JOB_ID =>
+						for byte_index in 0 to 3 loop
+							if (sha256_accel_axi_wstrb(byte_index) = '1') then
+								sha256_accel_job_id(byte_index * 8 + 7 downto byte_index * 8) <= unsigned(sha256_accel_axi_wdata(byte_index * 8 + 7 downto byte_index * 8));
+							end if;
+						end loop;
+					when REG_NEXT_JOB_ID =>
+						for byte_index in 0 to 3 loop
+							if (sha256_accel_axi_wstrb(byte_index) = '1') then
+								sha256_accel_next_job_id(byte_index * 8 + 7 downto byte_index * 8) <= unsigned(sha256_accel_axi_wdata(byte_index * 8 + 7 downto byte_index * 8));
+							end if;
+						end loop;
+					when REG_CANDIDATE_JOB_ID =>
+						-- sha256_accel_job_id_candidate is read only
 					when others =>
 					end case;
 				end if;
@@ -435,6 +522,35 @@ begin
 			when REG_DEBUG to REG_DEBUG + 24 =>
 --				reg_addr := loc_addr - REG_DEBUG;
 --				reg_data_out <= std_logic_vector(internal_dbg(reg_addr));
+			when REG_NEXT_STATE_IN to REG_NEXT_STATE_IN + 7 =>
+				reg_addr := loc_addr - REG_NEXT_STATE_IN;
+				for byte_index in 0 to 3 loop
+					data_bit := reg_addr * 32 + byte_index * 8;
+					reg_data_out(byte_index * 8 + 7 downto byte_index * 8) <= sha256_accel_next_state_in(255 - data_bit downto 255 - 7 - data_bit);
+				end loop;
+			when REG_NEXT_PREFIX to REG_NEXT_PREFIX + 2 =>
+				reg_addr := loc_addr - REG_NEXT_PREFIX;
+				for byte_index in 0 to 3 loop
+					data_bit := reg_addr * 32 + byte_index * 8;
+					reg_data_out(byte_index * 8 + 7 downto byte_index * 8) <= sha256_accel_next_prefix(95 - data_bit downto 95 - 7 - data_bit);
+				end loop;
+			when REG_NEXT_DIFFICULTY_MASK to REG_NEXT_DIFFICULTY_MASK + 7 =>
+				reg_addr := loc_addr - REG_NEXT_DIFFICULTY_MASK;
+				for byte_index in 0 to 3 loop
+					data_bit := reg_addr * 32 + byte_index * 8;
+					reg_data_out(byte_index * 8 + 7 downto byte_index * 8) <= sha256_accel_next_difficulty_mask(255 - data_bit downto 255 - 7 - data_bit);
+				end loop;
+			when REG_NEXT_NONCE_FIRST =>
+				reg_data_out <= std_logic_vector(sha256_accel_next_nonce_first);
+			when REG_NEXT_NONCE_LAST =>
+				reg_data_out <= std_logic_vector(sha256_accel_next_nonce_last);
+			when REG_JOB_ID =>
+				-- reads back the job the core is working on
+				reg_data_out <= std_logic_vector(sha256_accel_job_id_current);
+			when REG_NEXT_JOB_ID =>
+				reg_data_out <= std_logic_vector(sha256_accel_next_job_id);
+			when REG_CANDIDATE_JOB_ID =>
+				reg_data_out <= std_logic_vector(sha256_accel_job_id_candidate);
 			when others =>
 			end case;
 		end if;
@@ -480,12 +596,21 @@ begin
 	sha256_accel_nonce_current <= internal_nonce_current;
 	internal_nonce_first <= sha256_accel_nonce_first;
 	internal_nonce_last <= sha256_accel_nonce_last;
+	internal_job_id <= sha256_accel_job_id;
+	internal_next_state_in <= to_stdulogicvector(sha256_accel_next_state_in);
+	internal_next_prefix <= to_stdulogicvector(sha256_accel_next_prefix);
+	internal_next_difficulty_mask <= to_stdulogicvector(sha256_accel_next_difficulty_mask);
+	internal_next_nonce_first <= sha256_accel_next_nonce_first;
+	internal_next_nonce_last <= sha256_accel_next_nonce_last;
+	internal_next_job_id <= sha256_accel_next_job_id;
+	sha256_accel_job_id_current <= internal_job_id_current;
+	sha256_accel_job_id_candidate <= internal_job_id_candidate;
 	sha256_accel_status <= to_stdlogicvector(internal_status);
 	sha256_accel_irq <= external_irq;
 
 	inst: entity work.org(arc)
 	generic map (
-		1
+		NUM_CORES
 	)
 	port map (
 		internal_clk,
@@ -495,8 +620,17 @@ begin
 		internal_control,
 		internal_nonce_first,
 		internal_nonce_last,
+		internal_job_id,
+		internal_next_state_in,
+		internal_next_prefix,
+		internal_next_difficulty_mask,
+		internal_next_nonce_first,
+		internal_next_nonce_last,
+		internal_next_job_id,
 		internal_nonce_candidate,
 		internal_nonce_current,
+		internal_job_id_current,
+		internal_job_id_candidate,
 		internal_status,
 		internal_irq,
 		internal_dbg,
@@ -0,0 +1,297 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#	include <x86intrin.h>
+#endif
+
+#include "sha256.h"
+
+/*
+ * throughput of the library's hashing paths. every case is timed RUNS times
+ * after a warmup, each run long enough to dwarf the clock reads, and reported
+ * as one line per case:
+ *
+ *   name bytes runs min_ns median_ns mean_ns stddev_ns cycles_per_byte hashes_per_s
+ *
+ * ns and bytes are per call, a call of an n lane kernel counts as n hashes.
+ * cycles come from the tsc on x86 and from BENCH_GHZ (in GHz) elsewhere, -1
+ * when neither is there. lines starting with '#' are comments.
+ *
+ * with --baseline FILE (an earlier output) every case whose fastest run got
+ * slower by more than --tolerance percent (default 5) is reported and the exit
+ * status is 2. the fastest run is the one least disturbed by the rest of the
+ * machine, so it moves the least between two runs of the same code.
+ */
+
+#define RUNS 15
+#define RUN_NS 20000000LL
+#define STREAM_BYTES (1 << 20)
+#define MAX_CASES 32
+
+struct case_s {
+	char name[64];
+	size_t bytes;
+	int hashes;
+	double ns[RUNS];
+	double cycles;
+	double min, median, mean, stddev;
+};
+
+static struct case_s cases[MAX_CASES];
+static int num_cases;
+
+static uint8_t stream[STREAM_BYTES];
+static const uint8_t header[80] =
+	"\x01\x00\x00\x00"
+	"\x81\xcd\x02\xab\x7e\x56\x9e\x8b\xcd\x93\x17\xe2\xfe\x99\xf2\xde\x44\xd4\x9a\xb2\xb8\x85\x1b\xa4\xa3\x08\x00\x00\x00\x00\x00\x00"
+	"\xe3\x20\xb6\xc2\xff\xfc\x8d\x75\x04\x23\xdb\x8b\x1e\xb9\x42\xae\x71\x0e\x95\x1e\xd7\x97\xf7\xaf\xfc\x88\x92\xb0"
+	"\xc7\xf5\x03\x4e\x80\xda\x12\x1a\x0c\x34\x2a\x0f";
+
+/* whatever the cases produce ends up here, so the compiler can't drop them */
+static volatile uint32_t sink;
+
+static long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint64_t now_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+/* one call of a case, n is the call number so inputs differ between calls */
+typedef void (*case_fn)(uint32_t n, int lanes);
+
+static void run_transform(uint32_t n, int lanes) {
+	static uint32_t state[16][8];
+	static uint8_t blocks[16][64];
+	static const uint8_t *in[16];
+	int j;
+
+	if (!in[0])
+		for (j = 0; j < 16; ++j)
+			in[j] = blocks[j];
+
+	for (j = 0; j < lanes; ++j)
+		memcpy(&blocks[j][60], &n, sizeof(n));
+
+	if (lanes == 1)
+		sha256_transform(state[0], blocks[0]);
+	else
+		sha256_lanes_kernel(lanes)(state, in);
+	sink += state[0][0];
+}
+
+/* the hardware's split: midstate of the first block once, then the tail */
+static void run_midstate_tail(uint32_t n, int lanes) {
+	static sha256_context mid;
+	sha256_context ctx;
+	uint8_t tail[16], digest[32];
+
+	(void) lanes;
+	if (!mid.total) {
+		sha256_init(&mid);
+		sha256_update(&mid, header, 64);
+	}
+
+	memcpy(tail, header + 64, 12);
+	memcpy(tail + 12, &n, sizeof(n));
+	ctx = mid;
+	sha256_update(&ctx, tail, sizeof(tail));
+	sha256_finish(&ctx, digest);
+	sink += digest[0];
+}
+
+static void run_sha256d(uint32_t n, int lanes) {
+	sha256_context ctx;
+	uint8_t data[80], digest[32];
+
+	(void) lanes;
+	memcpy(data, header, 76);
+	memcpy(data + 76, &n, sizeof(n));
+	sha256_init(&ctx);
+	sha256_update(&ctx, data, sizeof(data));
+	sha256_finish(&ctx, digest);
+	sha256_init(&ctx);
+	sha256_update(&ctx, digest, sizeof(digest));
+	sha256_finish(&ctx, digest);
+	sink += digest[0];
+}
+
+/* nonces per call to sha256d_scan(), hashes counted per nonce */
+#define SCAN_NONCES 4096
+
+static void run_scan(uint32_t n, int nonces) {
+	static uint8_t midstate[32], target[32];
+	uint32_t out[4];
+	sha256_context ctx;
+
+	if (!midstate[0]) {
+		sha256_init(&ctx);
+		sha256_update(&ctx, header, 64);
+		sha256_nofinish(&ctx, midstate);
+		/* difficulty 1, a hit about once per 2^32 nonces */
+		memset(target, 0xff, 28);
+	}
+
+	sink += sha256d_scan(midstate, header + 64, target, n * nonces, n * nonces + nonces - 1, out, 4);
+}
+
+static void run_stream(uint32_t n, int lanes) {
+	sha256_context ctx;
+	uint8_t digest[32];
+
+	(void) lanes;
+	stream[0] = n;
+	sha256_init(&ctx);
+	sha256_update(&ctx, stream, sizeof(stream));
+	sha256_finish(&ctx, digest);
+	sink += digest[0];
+}
+
+static int compare_double(const void *a, const void *b) {
+	double x = *(const double *) a, y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+static void measure(const char *name, size_t bytes, case_fn fn, int lanes) {
+	struct case_s *c;
+	uint64_t calls = 1, i, cycles_start, cycles = 0;
+	long long start, elapsed = 0, total_ns = 0;
+	double sum = 0, var = 0, ghz;
+	uint32_t n = 0;
+	int run;
+
+	if (num_cases == MAX_CASES)
+		return;
+	c = &cases[num_cases++];
+	snprintf(c->name, sizeof(c->name), "%s", name);
+	c->bytes = bytes;
+	c->hashes = lanes;
+
+	/* warmup, doubling the calls until a run takes long enough */
+	while (elapsed < RUN_NS / 4) {
+		calls *= 2;
+		start = now_ns();
+		for (i = 0; i < calls; ++i)
+			fn(n++, lanes);
+		elapsed = now_ns() - start;
+	}
+	calls = calls * RUN_NS / (elapsed ? elapsed : 1) + 1;
+
+	for (run = 0; run < RUNS; ++run) {
+		cycles_start = now_cycles();
+		start = now_ns();
+		for (i = 0; i < calls; ++i)
+			fn(n++, lanes);
+		elapsed = now_ns() - start;
+		cycles += now_cycles() - cycles_start;
+		total_ns += elapsed;
+		c->ns[run] = (double) elapsed / calls;
+		sum += c->ns[run];
+	}
+
+	c->mean = sum / RUNS;
+	for (run = 0; run < RUNS; ++run)
+		var += (c->ns[run] - c->mean) * (c->ns[run] - c->mean);
+	c->stddev = sqrt(var / (RUNS - 1));
+
+	qsort(c->ns, RUNS, sizeof(c->ns[0]), compare_double);
+	c->min = c->ns[0];
+	c->median = c->ns[RUNS / 2];
+
+	if (cycles)
+		/* the tsc ticks at a fixed rate, scale it to the median run */
+		c->cycles = (double) cycles / total_ns * c->median / bytes;
+	else if (getenv("BENCH_GHZ") && (ghz = atof(getenv("BENCH_GHZ"))) > 0)
+		c->cycles = c->median * ghz / bytes;
+	else
+		c->cycles = -1;
+
+	printf("%-24s %8zu %4d %12.1f %12.1f %12.1f %10.1f %8.2f %14.0f\n", c->name, c->bytes, RUNS,
+			c->min, c->median, c->mean, c->stddev, c->cycles, c->hashes * 1e9 / c->median);
+	fflush(stdout);
+}
+
+/* compares the fastest runs against an earlier output, returns the regressions */
+static int check_baseline(const char *path, double tolerance) {
+	char line[256], name[64];
+	double min;
+	int i, regressions = 0;
+	FILE *f = fopen(path, "r");
+
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#' || sscanf(line, "%63s %*u %*d %lf", name, &min) != 2)
+			continue;
+
+		for (i = 0; i < num_cases; ++i) {
+			if (strcmp(cases[i].name, name))
+				continue;
+			if (cases[i].min > min * (1 + tolerance / 100)) {
+				printf("# regression %s: %.1f ns -> %.1f ns (+%.1f%%)\n", name, min,
+						cases[i].min, (cases[i].min / min - 1) * 100);
+				regressions++;
+			}
+		}
+	}
+
+	fclose(f);
+	return regressions;
+}
+
+int main(int argc, char *argv[]) {
+	const char *baseline = NULL;
+	double tolerance = 5;
+	char name[64];
+	int i, lanes, regressions;
+
+	for (i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "--baseline") && i + 1 < argc)
+			baseline = argv[++i];
+		else if (!strcmp(argv[i], "--tolerance") && i + 1 < argc)
+			tolerance = atof(argv[++i]);
+		else {
+			fprintf(stderr, "usage: %s [--baseline FILE] [--tolerance PERCENT]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	printf("# name bytes runs min_ns median_ns mean_ns stddev_ns cycles_per_byte hashes_per_s\n");
+
+	measure("transform/scalar", 64, run_transform, 1);
+	for (lanes = 4; lanes <= 16; lanes *= 2) {
+		if (!sha256_lanes_kernel(lanes))
+			continue;
+		snprintf(name, sizeof(name), "transform/%s", sha256_lanes_name(lanes));
+		measure(name, 64 * lanes, run_transform, lanes);
+	}
+	measure("midstate_tail", 16, run_midstate_tail, 1);
+	measure("sha256d_80", 80, run_sha256d, 1);
+	measure("sha256d_scan", 80 * SCAN_NONCES, run_scan, SCAN_NONCES);
+	measure("stream_1m", STREAM_BYTES, run_stream, 1);
+
+	if (!baseline)
+		return EXIT_SUCCESS;
+
+	regressions = check_baseline(baseline, tolerance);
+	if (regressions < 0)
+		return EXIT_FAILURE;
+	printf("# %d regression(s) beyond %.1f%%\n", regressions, tolerance);
+	return regressions ? 2 : EXIT_SUCCESS;
+}
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 
@@ -17,6 +18,143 @@ static const char *test_solutions[] = {
 	"\xcd\xc7\x6e\x5c\x99\x14\xfb\x92\x81\xa1\xc7\xe2\x84\xd7\x3e\x67\xf1\x80\x9a\x48\xa4\x97\x20\x0e\x04\x6d\x39\xcc\xc7\x11\x2c\xd0"
 };
 
+static const uint32_t initial_state[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+/* the padded message of vector i, returns the number of blocks */
+static size_t pad_vector(int i, uint8_t **out) {
+	size_t len = i < 2 ? strlen(test_vector[i]) : 1000000;
+	size_t blocks = (len + 8) / 64 + 1;
+	uint64_t bits = len * 8;
+	uint8_t *buf = calloc(blocks, 64);
+	int j;
+
+	if (!buf)
+		abort();
+
+	if (i < 2)
+		memcpy(buf, test_vector[i], len);
+	else
+		memset(buf, 'a', len);
+
+	buf[len] = 0x80;
+	for (j = 0; j < 8; ++j)
+		buf[blocks * 64 - 1 - j] = bits >> (8 * j);
+
+	*out = buf;
+	return blocks;
+}
+
+/*
+ * runs the three vectors side by side through every kernel the cpu supports,
+ * lane j hashing vector j % 3, so that lanes mixing up their data show up
+ */
+static int testlanes(int lanes) {
+	sha256_lanes_fn kernel = sha256_lanes_kernel(lanes);
+	uint8_t *msg[3], sha256sum[32];
+	size_t blocks[3], max = 0, step;
+	uint32_t state[16][8], result[16][8];
+	const uint8_t *in[16];
+	int i, j, failed = 0;
+
+	if (!kernel)
+		return 0;
+
+	for (i = 0; i < 3; ++i) {
+		blocks[i] = pad_vector(i, &msg[i]);
+		if (blocks[i] > max)
+			max = blocks[i];
+	}
+
+	for (j = 0; j < lanes; ++j)
+		memcpy(state[j], initial_state, sizeof(initial_state));
+
+	for (step = 0; step < max; ++step) {
+		/* lanes that are done rehash their first block, the result is kept */
+		for (j = 0; j < lanes; ++j)
+			in[j] = msg[j % 3] + 64 * (step < blocks[j % 3] ? step : 0);
+
+		kernel(state, in);
+
+		for (j = 0; j < lanes; ++j)
+			if (step + 1 == blocks[j % 3])
+				memcpy(result[j], state[j], sizeof(result[j]));
+	}
+
+	for (j = 0; j < lanes; ++j) {
+		for (i = 0; i < 8; ++i) {
+			sha256sum[4 * i + 0] = result[j][i] >> 24;
+			sha256sum[4 * i + 1] = result[j][i] >> 16;
+			sha256sum[4 * i + 2] = result[j][i] >> 8;
+			sha256sum[4 * i + 3] = result[j][i];
+		}
+
+		if (memcmp(sha256sum, test_solutions[j % 3], 32)) {
+			printf("selftest %d failed in lane %d of %s\n", j % 3 + 1, j, sha256_lanes_name(lanes));
+			failed = 1;
+		}
+	}
+
+	for (i = 0; i < 3; ++i)
+		free(msg[i]);
+
+	return failed;
+}
+
+/* block 125552, its nonce as the hardware counts it and the target of its bits */
+static const uint8_t scan_header[76] =
+	"\x01\x00\x00\x00"
+	"\x81\xcd\x02\xab\x7e\x56\x9e\x8b\xcd\x93\x17\xe2\xfe\x99\xf2\xde\x44\xd4\x9a\xb2\xb8\x85\x1b\xa4\xa3\x08\x00\x00\x00\x00\x00\x00"
+	"\xe3\x20\xb6\xc2\xff\xfc\x8d\x75\x04\x23\xdb\x8b\x1e\xb9\x42\xae\x71\x0e\x95\x1e\xd7\x97\xf7\xaf\xfc\x88\x92\xb0\xf1\xfc\x12\x2b"
+	"\xc7\xf5\xd7\x4d\xf2\xb9\x44\x1a";
+static const uint32_t scan_nonce = 0x42a14695;
+
+/*
+ * the known nonce at every offset of a 31 nonce range, so that it is found by
+ * each kernel the range is split into, and every nonce of a range with a
+ * target that takes them all, in order and stopping at max_out
+ */
+static int testscan(void) {
+	sha256_context ctx;
+	uint8_t midstate[32], target[32];
+	uint32_t out[40];
+	size_t n;
+	int i, failed = 0;
+
+	sha256_init(&ctx);
+	sha256_update(&ctx, scan_header, 64);
+	sha256_nofinish(&ctx, midstate);
+
+	/* 0x1a44b9f2: 0x44b9f2 shifted up by 0x1a - 3 bytes */
+	memset(target, 0, sizeof(target));
+	target[0x1a - 3] = 0xf2;
+	target[0x1a - 2] = 0xb9;
+	target[0x1a - 1] = 0x44;
+
+	for (i = 0; i < 31; ++i) {
+		n = sha256d_scan(midstate, scan_header + 64, target, scan_nonce - i, scan_nonce - i + 30, out, 40);
+		if (n != 1 || out[0] != scan_nonce) {
+			printf("selftest scan failed at offset %d\n", i);
+			failed = 1;
+		}
+	}
+
+	memset(target, 0xff, sizeof(target));
+	n = sha256d_scan(midstate, scan_header + 64, target, 0xffffffff - 38, 0xffffffff, out, 40);
+	for (i = 0; i < 39; ++i)
+		if (n != 39 || out[i] != 0xffffffff - 38 + i)
+			failed = 1;
+	n = sha256d_scan(midstate, scan_header + 64, target, 100, 200, out, 10);
+	for (i = 0; i < 10; ++i)
+		if (n != 10 || out[i] != 100 + i)
+			failed = 1;
+	if (failed)
+		printf("selftest scan failed\n");
+
+	return failed;
+}
+
 /* selftest is automatically executed on startup */
 void __attribute__ ((constructor)) testself() {
 	sha256_context ctx;
@@ -40,5 +178,12 @@ void __attribute__ ((constructor)) testself() {
 			printf("selftest %d failed\n", i + 1);
 	}
 
+	for (i = 4; i <= 16; i *= 2)
+		if (!testlanes(i) && sha256_lanes_kernel(i))
+			printf("selftest passed for %d lanes of %s\n", i, sha256_lanes_name(i));
+
+	if (!testscan())
+		printf("selftest passed for sha256d_scan on %d lanes\n", sha256_lanes());
+
 	printf("selftest passed\n");
 }
\ No newline at end of file
@@ -65,7 +65,7 @@ void sha256_init(sha256_context *ctx) {
 	ctx->state[7] = 0x5be0cd19;
 }
 
-static void sha256_process(sha256_context *ctx, const uint8_t data[64]) {
+void sha256_transform(uint32_t state[8], const uint8_t data[64]) {
 	int i;
 	uint32_t temp1, temp2, W[64];
 	uint32_t A, B, C, D, E, F, G, H;
@@ -81,14 +81,14 @@ static void sha256_process(sha256_context *ctx, const uint8_t data[64]) {
 			h = temp1 + temp2; \
 		}
 
-	A = ctx->state[0];
-	B = ctx->state[1];
-	C = ctx->state[2];
-	D = ctx->state[3];
-	E = ctx->state[4];
-	F = ctx->state[5];
-	G = ctx->state[6];
-	H = ctx->state[7];
+	A = state[0];
+	B = state[1];
+	C = state[2];
+	D = state[3];
+	E = state[4];
+	F = state[5];
+	G = state[6];
+	H = state[7];
 
 	P(A, B, C, D, E, F, G, H, W[ 0], 0x428a2f98);
 	P(H, A, B, C, D, E, F, G, W[ 1], 0x71374491);
@@ -155,14 +155,14 @@ static void sha256_process(sha256_context *ctx, const uint8_t data[64]) {
 	P(C, D, E, F, G, H, A, B, R(62), 0xbef9a3f7);
 	P(B, C, D, E, F, G, H, A, R(63), 0xc67178f2);
 
-	ctx->state[0] += A;
-	ctx->state[1] += B;
-	ctx->state[2] += C;
-	ctx->state[3] += D;
-	ctx->state[4] += E;
-	ctx->state[5] += F;
-	ctx->state[6] += G;
-	ctx->state[7] += H;
+	state[0] += A;
+	state[1] += B;
+	state[2] += C;
+	state[3] += D;
+	state[4] += E;
+	state[5] += F;
+	state[6] += G;
+	state[7] += H;
 }
 
 void sha256_update(sha256_context *ctx, const uint8_t *input, size_t length) {
@@ -178,14 +178,14 @@ void sha256_update(sha256_context *ctx, const uint8_t *input, size_t length) {
 
 	if (left && length >= fill) {
 		memcpy(&ctx->buffer[left], input, fill);
-		sha256_process(ctx, ctx->buffer);
+		sha256_transform(ctx->state, ctx->buffer);
 		length -= fill;
 		input += fill;
 		left = 0;
 	}
 
 	while (length >= 64) {
-		sha256_process(ctx, input);
+		sha256_transform(ctx->state, input);
 		length -= 64;
 		input += 64;
 	}
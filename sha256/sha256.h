@@ -1,6 +1,7 @@
 #ifndef _SHA256_H
 #	define _SHA256_H
 
+#	include <stddef.h>
 #	include <stdint.h>
 
 typedef struct {
@@ -14,4 +15,36 @@ void sha256_update(sha256_context *ctx, const uint8_t *input, size_t length);
 void sha256_nofinish(sha256_context *ctx, uint8_t digest[32]);
 void sha256_finish(sha256_context *ctx, uint8_t digest[32]);
 
+/* the compression function alone, on a raw state */
+void sha256_transform(uint32_t state[8], const uint8_t data[64]);
+
+/*
+ * multi-buffer compression: blocks[i] is compressed into state[i], the blocks
+ * are independent of each other. the kernel is picked on first use from what
+ * the cpu supports (sse4.1/avx2/avx-512 on x86, neon on arm).
+ */
+typedef void (*sha256_lanes_fn)(uint32_t state[][8], const uint8_t *const blocks[]);
+
+/* widest lane count the cpu supports, 1 if there is only the scalar code */
+int sha256_lanes(void);
+/* the kernel for exactly that many lanes, NULL if the cpu can't run it */
+sha256_lanes_fn sha256_lanes_kernel(int lanes);
+const char *sha256_lanes_name(int lanes);
+/* any number of blocks, in groups as wide as the cpu allows */
+void sha256_transform_many(uint32_t state[][8], const uint8_t *const blocks[], size_t n);
+
+/*
+ * double hashes the 80 byte headers of nonces first..last (inclusive) and
+ * stores the nonces whose hash is <= target in out_nonces, in ascending order.
+ * midstate is the state after the first 64 bytes (as from sha256_nofinish),
+ * tail12 the 12 bytes after them; the nonce goes into the last 4 bytes big
+ * endian, as the hardware does it. hash and target are compared as little
+ * endian 256 bit numbers, like bitcoin does. returns the number of nonces
+ * stored; when that is max_out the scan stopped there and can go on from
+ * out_nonces[max_out - 1] + 1. uses the multi-buffer kernels, keeps no state
+ * between calls and can run on any number of threads at once.
+ */
+size_t sha256d_scan(const uint8_t midstate[32], const uint8_t tail12[12], const uint8_t target[32],
+		uint32_t first, uint32_t last, uint32_t *out_nonces, size_t max_out);
+
 #endif
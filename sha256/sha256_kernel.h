@@ -0,0 +1,188 @@
+/*
+ * one set of multi-buffer kernels, included by sha256_lanes.c once per lane
+ * width with LANES and VEC defined, plus KERNEL and/or SCAN naming the
+ * functions to generate. lane j of every vector belongs to blocks[j] (or to
+ * nonce first + j), so the code is the plain scalar compression with vectors
+ * instead of words; the compiler turns it into whatever the target pragma
+ * around it allows.
+ */
+
+typedef uint32_t VEC __attribute__ ((vector_size(LANES * 4)));
+
+#define VSHR(x, n) ((x) >> (n))
+#define VROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define VS0(x) (VROTR(x, 7) ^ VROTR(x, 18) ^ VSHR(x, 3))
+#define VS1(x) (VROTR(x, 17) ^ VROTR(x, 19) ^ VSHR(x, 10))
+#define VS2(x) (VROTR(x, 2) ^ VROTR(x, 13) ^ VROTR(x, 22))
+#define VS3(x) (VROTR(x, 6) ^ VROTR(x, 11) ^ VROTR(x, 25))
+#define VF0(x, y, z) (((x) & (y)) | ((z) & ((x) | (y))))
+#define VF1(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+
+#define VP(a, b, c, d, e, f, g, h, w, t) { \
+			temp1 = h + VS3(e) + VF1(e, f, g) + K[t] + w[t]; \
+			temp2 = VS2(a) + VF0(a, b, c); \
+			d += temp1; \
+			h = temp1 + temp2; \
+		}
+
+#ifdef KERNEL
+static void KERNEL(uint32_t state[][8], const uint8_t *const blocks[]) {
+	VEC W[64], s[8], temp1, temp2;
+	VEC A, B, C, D, E, F, G, H;
+	int i, j;
+
+	for (i = 0; i < 16; ++i)
+		for (j = 0; j < LANES; ++j)
+			W[i][j] = extract_uint32_t(blocks[j], 4 * i);
+
+	for (i = 16; i < 64; ++i)
+		W[i] = VS1(W[i - 2]) + W[i - 7] + VS0(W[i - 15]) + W[i - 16];
+
+	for (i = 0; i < 8; ++i)
+		for (j = 0; j < LANES; ++j)
+			s[i][j] = state[j][i];
+
+	A = s[0];
+	B = s[1];
+	C = s[2];
+	D = s[3];
+	E = s[4];
+	F = s[5];
+	G = s[6];
+	H = s[7];
+
+	/* eight rounds per pass so the registers rotate by name, not by moves */
+	for (i = 0; i < 64; i += 8) {
+		VP(A, B, C, D, E, F, G, H, W, i + 0);
+		VP(H, A, B, C, D, E, F, G, W, i + 1);
+		VP(G, H, A, B, C, D, E, F, W, i + 2);
+		VP(F, G, H, A, B, C, D, E, W, i + 3);
+		VP(E, F, G, H, A, B, C, D, W, i + 4);
+		VP(D, E, F, G, H, A, B, C, W, i + 5);
+		VP(C, D, E, F, G, H, A, B, W, i + 6);
+		VP(B, C, D, E, F, G, H, A, W, i + 7);
+	}
+
+	s[0] += A;
+	s[1] += B;
+	s[2] += C;
+	s[3] += D;
+	s[4] += E;
+	s[5] += F;
+	s[6] += G;
+	s[7] += H;
+
+	for (i = 0; i < 8; ++i)
+		for (j = 0; j < LANES; ++j)
+			state[j][i] = s[i][j];
+}
+#endif /* KERNEL */
+
+#ifdef SCAN
+/* the same round, shifting the registers instead of renaming them */
+#define VR(w, t) { \
+			VP(A, B, C, D, E, F, G, H, w, t); \
+			temp1 = H; H = G; G = F; F = E; E = D; D = C; C = B; B = A; A = temp1; \
+		}
+
+/*
+ * double hashes groups of LANES consecutive nonces from first on, see
+ * sha256d_scan(). the hash is only finished in scan_check() for lanes whose
+ * last word, known after round 60 of the second hash, can still be in target
+ */
+static size_t SCAN(const struct scan_s *pre, uint32_t first, uint64_t groups,
+		uint32_t *out, size_t max_out) {
+	VEC W[64], X[64], n, temp1, temp2;
+	VEC A, B, C, D, E, F, G, H;
+	uint32_t h7;
+	size_t found = 0;
+	uint64_t g;
+	int i, j;
+
+	/* what doesn't depend on the nonce, W[3] and W[18..19] are redone below */
+	for (i = 0; i < 20; ++i)
+		W[i] = (VEC) {} + pre->w[i];
+	X[8] = (VEC) {} + 0x80000000;
+	for (i = 9; i < 15; ++i)
+		X[i] = (VEC) {};
+	X[15] = (VEC) {} + 32 * 8;
+	n = (VEC) {};
+
+	for (g = 0; g < groups; ++g, first += LANES) {
+		for (j = 0; j < LANES; ++j)
+			n[j] = first + j;
+
+		W[3] = n;
+		W[18] = pre->w[18] + VS0(n);
+		W[19] = pre->w[19] + n;
+		for (i = 20; i < 64; ++i)
+			W[i] = VS1(W[i - 2]) + W[i - 7] + VS0(W[i - 15]) + W[i - 16];
+
+		/* rounds 0-2 are in pre->state, round 3 only lacks the nonce */
+		A = (VEC) {} + pre->state[0];
+		B = (VEC) {} + pre->state[1];
+		C = (VEC) {} + pre->state[2];
+		D = (VEC) {} + pre->state[3] + pre->t1 + n;
+		E = (VEC) {} + pre->state[4];
+		F = (VEC) {} + pre->state[5];
+		G = (VEC) {} + pre->state[6];
+		H = (VEC) {} + pre->t1 + pre->t2 + n;
+		temp1 = H; H = G; G = F; F = E; E = D; D = C; C = B; B = A; A = temp1;
+
+		for (i = 4; i < 64; ++i)
+			VR(W, i);
+
+		X[0] = A + pre->mid[0];
+		X[1] = B + pre->mid[1];
+		X[2] = C + pre->mid[2];
+		X[3] = D + pre->mid[3];
+		X[4] = E + pre->mid[4];
+		X[5] = F + pre->mid[5];
+		X[6] = G + pre->mid[6];
+		X[7] = H + pre->mid[7];
+		for (i = 16; i < 61; ++i)
+			X[i] = VS1(X[i - 2]) + X[i - 7] + VS0(X[i - 15]) + X[i - 16];
+
+		A = (VEC) {} + 0x6a09e667;
+		B = (VEC) {} + 0xbb67ae85;
+		C = (VEC) {} + 0x3c6ef372;
+		D = (VEC) {} + 0xa54ff53a;
+		E = (VEC) {} + 0x510e527f;
+		F = (VEC) {} + 0x9b05688c;
+		G = (VEC) {} + 0x1f83d9ab;
+		H = (VEC) {} + 0x5be0cd19;
+		for (i = 0; i < 61; ++i)
+			VR(X, i);
+
+		/* e after round 60 is h after round 63 */
+		E += 0x5be0cd19;
+		for (j = 0; j < LANES; ++j) {
+			h7 = E[j];
+			if (__builtin_bswap32(h7) > pre->top || !scan_check(pre, first + j))
+				continue;
+			out[found++] = first + j;
+			if (found == max_out)
+				return found;
+		}
+	}
+
+	return found;
+}
+
+#undef VR
+#endif /* SCAN */
+
+#undef VP
+#undef VSHR
+#undef VROTR
+#undef VS0
+#undef VS1
+#undef VS2
+#undef VS3
+#undef VF0
+#undef VF1
+
+#undef LANES
+#undef VEC
+#undef KERNEL
+#undef SCAN
@@ -0,0 +1,334 @@
+#include <string.h>
+#include <stdint.h>
+#include <endian.h>
+
+#if defined(__arm__)
+#	include <sys/auxv.h>
+#endif
+
+#include "sha256.h"
+
+static const uint32_t K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t extract_uint32_t(const uint8_t *buffer, size_t position) {
+	uint32_t value;
+	memcpy(&value, &buffer[position], sizeof(value));
+	return be32toh(value);
+}
+
+/* what sha256d_scan() works out once per call */
+struct scan_s {
+	uint32_t mid[8];
+	/* schedule of the second block; W[3] is the nonce, W[18..19] lack it */
+	uint32_t w[20];
+	/* the working variables after round 2, and round 3 without the nonce */
+	uint32_t state[8];
+	uint32_t t1, t2;
+	/* the target's top word, as hash bytes 28..31 read little endian */
+	uint32_t top;
+	uint8_t tail[12];
+	uint8_t target[32];
+};
+
+typedef size_t (*scan_fn)(const struct scan_s *pre, uint32_t first, uint64_t groups,
+		uint32_t *out, size_t max_out);
+
+struct lanes_s {
+	int lanes;
+	const char *name;
+	sha256_lanes_fn kernel;
+	scan_fn scan;
+	int (*supported)(void);
+};
+
+static void insert_uint32_t(uint8_t *buffer, size_t position, uint32_t value) {
+	uint32_t be = htobe32(value);
+	memcpy(&buffer[position], &be, sizeof(be));
+}
+
+/* the full double hash of one nonce, compared against the whole target */
+static int scan_check(const struct scan_s *pre, uint32_t nonce) {
+	static const uint32_t initial[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+	uint32_t state[8];
+	uint8_t block[64], hash[32];
+	int i;
+
+	memset(block, 0, sizeof(block));
+	memcpy(block, pre->tail, sizeof(pre->tail));
+	insert_uint32_t(block, 12, nonce);
+	block[16] = 0x80;
+	insert_uint32_t(block, 60, 80 * 8);
+	memcpy(state, pre->mid, sizeof(state));
+	sha256_transform(state, block);
+
+	memset(block, 0, sizeof(block));
+	for (i = 0; i < 8; ++i)
+		insert_uint32_t(block, 4 * i, state[i]);
+	block[32] = 0x80;
+	insert_uint32_t(block, 60, 32 * 8);
+	memcpy(state, initial, sizeof(state));
+	sha256_transform(state, block);
+
+	for (i = 0; i < 8; ++i)
+		insert_uint32_t(hash, 4 * i, state[i]);
+
+	/* both are little endian 256 bit numbers */
+	for (i = 31; i >= 0; --i)
+		if (hash[i] != pre->target[i])
+			return hash[i] < pre->target[i];
+	return 1;
+}
+
+static void scalar_kernel(uint32_t state[][8], const uint8_t *const blocks[]) {
+	sha256_transform(state[0], blocks[0]);
+}
+
+#define LANES 1
+#define VEC vec_scalar
+#define SCAN scalar_scan
+#include "sha256_kernel.h"
+
+static int always(void) {
+	return 1;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#pragma GCC push_options
+#pragma GCC target("sse4.1")
+#define LANES 4
+#define VEC vec_sse4
+#define KERNEL sse4_kernel
+#define SCAN sse4_scan
+#include "sha256_kernel.h"
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#define LANES 8
+#define VEC vec_avx2
+#define KERNEL avx2_kernel
+#define SCAN avx2_scan
+#include "sha256_kernel.h"
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#define LANES 16
+#define VEC vec_avx512
+#define KERNEL avx512_kernel
+#define SCAN avx512_scan
+#include "sha256_kernel.h"
+#pragma GCC pop_options
+
+static int has_sse4(void) {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse4.1");
+}
+
+static int has_avx2(void) {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+static int has_avx512(void) {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx512f");
+}
+
+/* narrowest first */
+static const struct lanes_s kernels[] = {
+	{ 1, "scalar", scalar_kernel, scalar_scan, always },
+	{ 4, "sse4.1", sse4_kernel, sse4_scan, has_sse4 },
+	{ 8, "avx2", avx2_kernel, avx2_scan, has_avx2 },
+	{ 16, "avx512f", avx512_kernel, avx512_scan, has_avx512 },
+};
+
+#elif defined(__aarch64__) || defined(__arm__)
+
+#if defined(__arm__)
+/* the armhf toolchain defaults to vfpv3-d16, neon is an option of the zynq */
+#pragma GCC push_options
+#pragma GCC target("fpu=neon")
+#endif
+#define LANES 4
+#define VEC vec_neon
+#define KERNEL neon_kernel
+#define SCAN neon_scan
+#include "sha256_kernel.h"
+#if defined(__arm__)
+#pragma GCC pop_options
+#endif
+
+static int has_neon(void) {
+#if defined(__arm__)
+	return !!(getauxval(AT_HWCAP) & HWCAP_ARM_NEON);
+#else
+	/* mandatory on armv8 */
+	return 1;
+#endif
+}
+
+static const struct lanes_s kernels[] = {
+	{ 1, "scalar", scalar_kernel, scalar_scan, always },
+	{ 4, "neon", neon_kernel, neon_scan, has_neon },
+};
+
+#else
+
+static const struct lanes_s kernels[] = {
+	{ 1, "scalar", scalar_kernel, scalar_scan, always },
+};
+
+#endif
+
+#define NUM_KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+static const struct lanes_s *lookup(int lanes) {
+	size_t i;
+
+	for (i = 0; i < NUM_KERNELS; ++i)
+		if (kernels[i].lanes == lanes && kernels[i].supported())
+			return &kernels[i];
+
+	return NULL;
+}
+
+/* the widest usable kernel, looked up once. racing threads store the same value */
+static const struct lanes_s *widest(void) {
+	static const struct lanes_s *best;
+	int i;
+
+	if (!best)
+		for (i = NUM_KERNELS - 1; i >= 0 && !best; --i)
+			if (kernels[i].supported())
+				best = &kernels[i];
+
+	return best;
+}
+
+int sha256_lanes(void) {
+	return widest()->lanes;
+}
+
+sha256_lanes_fn sha256_lanes_kernel(int lanes) {
+	const struct lanes_s *k = lookup(lanes);
+	return k ? k->kernel : NULL;
+}
+
+const char *sha256_lanes_name(int lanes) {
+	const struct lanes_s *k = lookup(lanes);
+	return k ? k->name : NULL;
+}
+
+void sha256_transform_many(uint32_t state[][8], const uint8_t *const blocks[], size_t n) {
+	const struct lanes_s *k = widest();
+	size_t i = 0;
+	int j;
+
+	/* full groups on the widest kernel, the rest on narrower ones */
+	for (j = k - kernels; j >= 0; --j) {
+		if (!kernels[j].supported())
+			continue;
+		for ( ; n - i >= (size_t) kernels[j].lanes; i += kernels[j].lanes)
+			kernels[j].kernel(&state[i], &blocks[i]);
+	}
+}
+
+static void scan_precalc(struct scan_s *pre, const uint8_t midstate[32], const uint8_t tail12[12],
+		const uint8_t target[32]) {
+	uint32_t *w = pre->w, *s = pre->state, t1, t2;
+	int i;
+
+	for (i = 0; i < 8; ++i)
+		pre->mid[i] = extract_uint32_t(midstate, 4 * i);
+	memcpy(pre->tail, tail12, sizeof(pre->tail));
+	memcpy(pre->target, target, sizeof(pre->target));
+	pre->top = target[28] | target[29] << 8 | target[30] << 16 | (uint32_t) target[31] << 24;
+
+	memset(w, 0, sizeof(pre->w));
+	for (i = 0; i < 3; ++i)
+		w[i] = extract_uint32_t(tail12, 4 * i);
+	w[4] = 0x80000000;
+	w[15] = 80 * 8;
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define S0(x) (ROTR(x, 7) ^ ROTR(x, 18) ^ ((x) >> 3))
+#define S1(x) (ROTR(x, 17) ^ ROTR(x, 19) ^ ((x) >> 10))
+#define S2(x) (ROTR(x, 2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define S3(x) (ROTR(x, 6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define F0(x, y, z) (((x) & (y)) | ((z) & ((x) | (y))))
+#define F1(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+
+	w[16] = S0(w[1]) + w[0];
+	w[17] = S1(w[15]) + S0(w[2]) + w[1];
+	w[18] = S1(w[16]) + w[2];
+	w[19] = S1(w[17]) + S0(w[4]);
+
+	memcpy(s, pre->mid, sizeof(pre->state));
+	for (i = 0; i < 4; ++i) {
+		t1 = s[7] + S3(s[4]) + F1(s[4], s[5], s[6]) + K[i] + w[i];
+		t2 = S2(s[0]) + F0(s[0], s[1], s[2]);
+		if (i == 3)
+			break;
+		s[7] = s[6];
+		s[6] = s[5];
+		s[5] = s[4];
+		s[4] = s[3] + t1;
+		s[3] = s[2];
+		s[2] = s[1];
+		s[1] = s[0];
+		s[0] = t1 + t2;
+	}
+	/* w[3] is still zero, so this is round 3 without the nonce */
+	pre->t1 = t1;
+	pre->t2 = t2;
+
+#undef ROTR
+#undef S0
+#undef S1
+#undef S2
+#undef S3
+#undef F0
+#undef F1
+}
+
+size_t sha256d_scan(const uint8_t midstate[32], const uint8_t tail12[12], const uint8_t target[32],
+		uint32_t first, uint32_t last, uint32_t *out_nonces, size_t max_out) {
+	const struct lanes_s *k = widest();
+	struct scan_s pre;
+	uint64_t pos = first, end = (uint64_t) last + 1, groups;
+	size_t found = 0;
+	int j;
+
+	if (first > last || !max_out)
+		return 0;
+
+	scan_precalc(&pre, midstate, tail12, target);
+
+	/* as in sha256_transform_many(), the tail of the range on narrower kernels */
+	for (j = k - kernels; j >= 0 && pos < end; --j) {
+		if (!kernels[j].supported())
+			continue;
+		groups = (end - pos) / kernels[j].lanes;
+		if (!groups)
+			continue;
+		found += kernels[j].scan(&pre, pos, groups, out_nonces + found, max_out - found);
+		if (found == max_out)
+			break;
+		pos += groups * kernels[j].lanes;
+	}
+
+	return found;
+}
@@ -42,8 +42,9 @@ int main(int argc, char *argv[]) {
 	struct timeval timeout;
 	int ret, fd;
 	struct sha256_accel_msg_s msg;
-	uint32_t nonce_current, status = 0u;
-	unsigned char mask[32], state[32];
+	uint32_t nonce_current, hit, status = 0u;
+	unsigned char mask[32], target[32], state[32], midstate[32];
+	int i;
 
 	if (argc != 2) {
 		fprintf(stderr, "usage: runtest <nlz>\n");
@@ -92,10 +93,15 @@ int main(int argc, char *argv[]) {
 	sha256_update(&ctx, (uint8_t *) &sample, sizeof(sample) - sizeof(sample.Nonce));
 	sha256_nofinish(&ctx, (uint8_t *) state);
 	print_hex(&state, 32);
+	memcpy(midstate, state, sizeof(midstate));
 
 	generate_test_mask(atoi(argv[1]), mask);
 	print_hex(mask, 32);
 
+	/* the leading zero mask as a target: everything the mask lets through */
+	for (i = 0; i < 32; ++i)
+		target[i] = ~mask[i];
+
 	/********************************************************************************************************************************************************************************************
 	 *                         reg_addr   ---0---0---0---0   ---1---1---1---1   ---2---2---2---2   ---3---3---3---3   ---4---4---4---4   ---5---5---5---5   ---6---6---6---6   ---7---7---7---7 *
 	 *                       byte_index   ---0---1---2---3   ---0---1---2---3   ---0---1---2---3   ---0---1---2---3   ---0---1---2---3   ---0---1---2---3   ---0---1---2---3   ---0---1---2---3 *
@@ -160,6 +166,12 @@ int main(int argc, char *argv[]) {
 					sha256_update(&ctx, state, sizeof(state));
 					sha256_finish(&ctx, state);
 					print_hex(&state, 32);
+
+					if (sha256d_scan(midstate, &((uint8_t *) &sample)[64], target,
+								msg.nonce_candidate, msg.nonce_candidate, &hit, 1))
+						printf("[+] nonce candidate verified\n");
+					else
+						fprintf(stderr, "[-] nonce candidate does not meet the mask\n");
 					break;
 				default:
 					fprintf(stderr, "[-] status: %08x, unexpected status\n", msg.status);
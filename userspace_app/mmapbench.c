@@ -0,0 +1,206 @@
+/*
+ * compares polling the accelerator through syscalls (one ioctl per register,
+ * one read per result) with polling the shared mappings of the driver.
+ *
+ * no hardware is needed: a simulator thread plays the core on a register
+ * block and result ring in an unlinked temporary file. the syscall variant
+ * reaches the registers with pread() and the results with read() on a pipe,
+ * which is what each ioctl/read on /dev/sha256 boils down to; the mmap
+ * variant uses the same layout as SHA256_ACCEL_MMAP_REGS/_RING.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include <sha256_accel.h>
+
+/* one result every this many simulated nonces */
+#define RESULT_INTERVAL 4096
+#define RUN_SECONDS 2
+
+struct sim_s {
+	int fd;
+	int pipe[2];
+	long pagesize;
+	volatile uint32_t *regs;
+	struct sha256_accel_ring_s *ring;
+	volatile bool stop;
+	bool use_mmap;
+};
+
+struct result_s {
+	const char *name;
+	uint64_t polls;
+	uint64_t results;
+	uint64_t syscalls;
+	double seconds;
+};
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *simulate(void *arg) {
+	struct sim_s *sim = (struct sim_s *) arg;
+	struct sha256_accel_msg_s msg;
+	uint32_t nonce = 0, head;
+
+	while (!sim->stop) {
+		sim->regs[SHA256_ACCEL_REG_NONCE_CURRENT] = ++nonce;
+
+		if (nonce % RESULT_INTERVAL)
+			continue;
+
+		msg.status = 0x10;
+		msg.nonce_candidate = nonce;
+		msg.job_id = 1;
+
+		if (!sim->use_mmap) {
+			/* a full pipe drops the result, like a full ring */
+			if (write(sim->pipe[1], &msg, sizeof(msg)) != sizeof(msg))
+				sim->ring->overflows++;
+			continue;
+		}
+
+		head = sim->ring->head;
+		if (head - *(volatile uint32_t *) &sim->ring->tail >= SHA256_ACCEL_RING_SIZE) {
+			sim->ring->overflows++;
+			continue;
+		}
+		sim->ring->msgs[head % SHA256_ACCEL_RING_SIZE] = msg;
+		__sync_synchronize();
+		*(volatile uint32_t *) &sim->ring->head = head + 1;
+	}
+
+	return NULL;
+}
+
+static void poll_syscalls(struct sim_s *sim, struct result_s *res) {
+	uint32_t status, nonce;
+	struct sha256_accel_msg_s msgs[16];
+	off_t regs = SHA256_ACCEL_MMAP_REGS * sim->pagesize;
+	ssize_t ret;
+
+	/* what edc does per scan without the mappings: two ioctls and a read */
+	if (pread(sim->fd, &status, sizeof(status), regs + SHA256_ACCEL_REG_STATUS * sizeof(__u32)) != sizeof(status)
+			|| pread(sim->fd, &nonce, sizeof(nonce), regs + SHA256_ACCEL_REG_NONCE_CURRENT * sizeof(__u32)) != sizeof(nonce))
+		abort();
+	res->syscalls += 2;
+
+	ret = read(sim->pipe[0], msgs, sizeof(msgs));
+	res->syscalls++;
+	if (ret > 0)
+		res->results += ret / sizeof(msgs[0]);
+}
+
+static void poll_mmap(struct sim_s *sim, struct result_s *res) {
+	volatile uint32_t status, nonce;
+	struct sha256_accel_ring_s *ring = sim->ring;
+	uint32_t head, tail;
+
+	status = sim->regs[SHA256_ACCEL_REG_STATUS];
+	nonce = sim->regs[SHA256_ACCEL_REG_NONCE_CURRENT];
+	(void) status;
+	(void) nonce;
+
+	head = *(volatile uint32_t *) &ring->head;
+	tail = ring->tail;
+	__sync_synchronize();
+	if (head != tail) {
+		res->results += head - tail;
+		__sync_synchronize();
+		*(volatile uint32_t *) &ring->tail = head;
+	}
+}
+
+static int run(struct sim_s *sim, bool use_mmap, struct result_s *res) {
+	pthread_t thread;
+	double start;
+
+	memset(res, 0, sizeof(*res));
+	res->name = use_mmap ? "mmap" : "syscall";
+
+	sim->use_mmap = use_mmap;
+	sim->stop = false;
+	memset(sim->ring, 0, sizeof(*sim->ring));
+
+	if (pthread_create(&thread, NULL, simulate, sim))
+		return -1;
+
+	start = now();
+	do {
+		if (use_mmap)
+			poll_mmap(sim, res);
+		else
+			poll_syscalls(sim, res);
+		res->polls++;
+	} while ((res->polls & 0x3ff) || now() - start < RUN_SECONDS);
+	res->seconds = now() - start;
+
+	sim->stop = true;
+	pthread_join(thread, NULL);
+	return 0;
+}
+
+static void report(const struct result_s *res) {
+	printf("%-8s polls/s=%.0f results/s=%.0f syscalls/s=%.0f\n", res->name,
+			res->polls / res->seconds, res->results / res->seconds, res->syscalls / res->seconds);
+}
+
+int main(int argc, char *argv[]) {
+	struct sim_s sim;
+	struct result_s syscall_res, mmap_res;
+	char path[] = "/tmp/sha256_accel_sim.XXXXXX";
+
+	memset(&sim, 0, sizeof(sim));
+	sim.pagesize = sysconf(_SC_PAGESIZE);
+
+	/* the simulated register window and ring, one page each like the driver's */
+	sim.fd = mkstemp(path);
+	if (sim.fd == -1) {
+		perror("mkstemp");
+		return EXIT_FAILURE;
+	}
+	unlink(path);
+
+	if (ftruncate(sim.fd, 2 * sim.pagesize)) {
+		perror("ftruncate");
+		return EXIT_FAILURE;
+	}
+
+	sim.ring = mmap(NULL, sim.pagesize, PROT_READ | PROT_WRITE, MAP_SHARED, sim.fd,
+			SHA256_ACCEL_MMAP_RING * sim.pagesize);
+	sim.regs = mmap(NULL, sim.pagesize, PROT_READ | PROT_WRITE, MAP_SHARED, sim.fd,
+			SHA256_ACCEL_MMAP_REGS * sim.pagesize);
+	if (sim.ring == MAP_FAILED || sim.regs == MAP_FAILED) {
+		perror("mmap");
+		return EXIT_FAILURE;
+	}
+	if (pipe2(sim.pipe, O_NONBLOCK)) {
+		perror("pipe2");
+		return EXIT_FAILURE;
+	}
+
+	sim.regs[SHA256_ACCEL_REG_STATUS] = 0x02;
+
+	if (run(&sim, false, &syscall_res) || run(&sim, true, &mmap_res)) {
+		perror("pthread_create");
+		return EXIT_FAILURE;
+	}
+
+	report(&syscall_res);
+	report(&mmap_res);
+	printf("saved    syscalls/s=%.0f\n", syscall_res.syscalls / syscall_res.seconds);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,942 @@
+/*
+ * software model of the sha256_accel cores and their driver, for running
+ * edc (or any other user of sha256_accel.h) on a machine without the fpga:
+ *
+ *   LD_PRELOAD=./libsha256emu.so ./cgminer ...
+ *
+ * open/stat/ioctl/read/mmap/select/poll on /dev/sha256N are served from
+ * here, everything else goes to libc. every emulated core gets a hashing
+ * thread of its own. the register file, the candidate fifo, continue mode,
+ * the shadow job bank and the interrupt handler behave like org.vhd and
+ * sha256_accel.c; only the timing differs, ranges are hashed in chunks
+ * instead of through a pipeline.
+ *
+ * the hash is the one the core computes: state_in is the midstate of the
+ * first 64 bytes of the header, the second block is the 12 byte prefix and
+ * the nonce in big endian. a nonce is a candidate if no bit set in the
+ * difficulty mask is set in the double hash.
+ *
+ * environment:
+ *   SHA256_EMU_CORES     number of devices, /dev/sha2560 upwards (1)
+ *   SHA256_EMU_HASHRATE  nonces per second and core, 0 is unlimited (0)
+ *   SHA256_EMU_TRACE     file to log register accesses and interrupts
+ *                        to, "-" for stderr
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include <sha256_accel.h>
+#include <sha256.h>
+
+/* register indices, as in sha256_accel.c */
+#define REG_STATE_IN 0
+#define REG_PREFIX 8
+#define REG_DIFFICULTY_MASK 11
+#define REG_NONCE_CANDIDATE SHA256_ACCEL_REG_NONCE_CANDIDATE
+#define REG_NONCE_CURRENT SHA256_ACCEL_REG_NONCE_CURRENT
+#define REG_NONCE_FIRST 21
+#define REG_NONCE_LAST 22
+#define REG_STATUS SHA256_ACCEL_REG_STATUS
+#define REG_CONTROL 24
+#define REG_IRQ_MASK 25
+#define REG_STEP 26
+#define REG_DEBUG 27
+#define REG_NEXT_STATE_IN 52
+#define REG_NEXT_PREFIX 60
+#define REG_NEXT_DIFFICULTY_MASK 63
+#define REG_NEXT_NONCE_FIRST 71
+#define REG_NEXT_NONCE_LAST 72
+#define REG_JOB_ID SHA256_ACCEL_REG_JOB_ID
+#define REG_NEXT_JOB_ID 74
+#define REG_CANDIDATE_JOB_ID 75
+
+/* status_internal of org.vhd */
+#define STATUS_RDY 0x01
+#define STATUS_BUSY 0x02
+#define STATUS_FIN 0x04
+#define STATUS_IDLE 0x08
+#define STATUS_FOUND 0x10
+
+/* nonces hashed between two looks at the control state */
+#define EMU_CHUNK 4096
+
+struct bank_s {
+	uint8_t state_in[32];
+	uint8_t prefix[12];
+	uint8_t mask[32];
+	uint32_t nonce_first;
+	uint32_t nonce_last;
+	uint32_t job_id;
+};
+
+struct candidate_s {
+	uint32_t nonce;
+	uint32_t job_id;
+};
+
+struct core_s {
+	int id;
+	/* the eventfd handed out as the device, -1 while closed */
+	int fd;
+	int flags;
+
+	pthread_mutex_t lock;
+	/* signalled on every change of the control state */
+	pthread_cond_t control;
+	/* signalled when a result has been queued */
+	pthread_cond_t results;
+	pthread_t thread;
+
+	/* backing of the two mmap() pages, mapped read-write for us */
+	int regs_fd;
+	int ring_fd;
+	volatile uint32_t *regs;
+	struct sha256_accel_ring_s *ring;
+
+	/* what org.vhd keeps in flip-flops */
+	uint32_t state;
+	/* written to REG_JOB_ID, which reads back the running job instead */
+	uint32_t job_id_in;
+	struct bank_s active;
+	bool next_armed;
+	bool continue_mode;
+	bool fifo_overflow;
+	struct candidate_s fifo[SHA256_ACCEL_FIFO_DEPTH];
+	unsigned int fifo_rd;
+	unsigned int fifo_count;
+	uint32_t nonce;
+	/* bumped whenever the hashing thread has to drop what it is working on */
+	uint32_t epoch;
+
+	/* what the interrupt handler keeps, see sha256_accel_irq() */
+	uint32_t last_job_id;
+};
+
+static struct core_s cores[SHA256_ACCEL_MAX_DEVICES];
+static int num_cores;
+static uint64_t hashrate;
+static long pagesize;
+static FILE *trace;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+static int (*real_open)(const char *, int, ...);
+static int (*real_close)(int);
+static int (*real_ioctl)(int, unsigned long, ...);
+static ssize_t (*real_read)(int, void *, size_t);
+static void *(*real_mmap)(void *, size_t, int, int, int, off_t);
+static int (*real_stat)(const char *, struct stat *);
+static int (*real_xstat)(int, const char *, struct stat *);
+static int (*real_select)(int, fd_set *, fd_set *, fd_set *, struct timeval *);
+static int (*real_poll)(struct pollfd *, nfds_t, int);
+
+static void emu_trace(struct core_s *core, const char *fmt, ...) {
+	va_list ap;
+
+	if (!trace)
+		return;
+
+	pthread_mutex_lock(&trace_lock);
+	fprintf(trace, "sha256%d ", core->id);
+	va_start(ap, fmt);
+	vfprintf(trace, fmt, ap);
+	va_end(ap);
+	fputc('\n', trace);
+	pthread_mutex_unlock(&trace_lock);
+}
+
+/******************************************************************************
+ * the core
+ */
+
+static uint32_t emu_status(struct core_s *core) {
+	uint32_t status = core->state;
+
+	if (core->next_armed)
+		status |= SHA256_ACCEL_STATUS_NEXT_ARMED;
+	if (core->fifo_count)
+		status |= SHA256_ACCEL_STATUS_CANDIDATE;
+	if (core->fifo_overflow)
+		status |= SHA256_ACCEL_STATUS_FIFO_OVERFLOW;
+	return status | core->fifo_count << 16;
+}
+
+/* mirror the internal state into the registers the core drives */
+static void emu_publish(struct core_s *core) {
+	const struct candidate_s *head = &core->fifo[core->fifo_rd];
+
+	core->regs[REG_STATUS] = emu_status(core);
+	core->regs[REG_NONCE_CURRENT] = core->nonce;
+	core->regs[REG_NONCE_CANDIDATE] = head->nonce;
+	core->regs[REG_CANDIDATE_JOB_ID] = head->job_id;
+	core->regs[REG_JOB_ID] = core->active.job_id;
+}
+
+static void emu_load_bank(struct core_s *core, struct bank_s *bank, unsigned int state_in,
+		unsigned int prefix, unsigned int mask, unsigned int first, unsigned int last, uint32_t job_id) {
+	memcpy(bank->state_in, (const void *) &core->regs[state_in], sizeof(bank->state_in));
+	memcpy(bank->prefix, (const void *) &core->regs[prefix], sizeof(bank->prefix));
+	memcpy(bank->mask, (const void *) &core->regs[mask], sizeof(bank->mask));
+	bank->nonce_first = core->regs[first];
+	bank->nonce_last = core->regs[last];
+	bank->job_id = job_id;
+}
+
+static void emu_push_candidate(struct core_s *core, uint32_t nonce, uint32_t job_id) {
+	struct candidate_s *c;
+
+	if (core->fifo_count == SHA256_ACCEL_FIFO_DEPTH) {
+		core->fifo_overflow = true;
+		return;
+	}
+	c = &core->fifo[(core->fifo_rd + core->fifo_count) % SHA256_ACCEL_FIFO_DEPTH];
+	c->nonce = nonce;
+	c->job_id = job_id;
+	core->fifo_count++;
+}
+
+static void emu_pop_candidate(struct core_s *core) {
+	core->fifo_rd = (core->fifo_rd + 1) % SHA256_ACCEL_FIFO_DEPTH;
+	core->fifo_count--;
+}
+
+/* queues one result for read()/mmap(), like sha256_accel_push() */
+static void emu_ring_push(struct core_s *core, uint32_t status, uint32_t nonce, uint32_t job_id) {
+	struct sha256_accel_ring_s *ring = core->ring;
+	struct sha256_accel_msg_s *msg;
+	uint32_t head = ring->head;
+	uint64_t one = 1;
+
+	if (head - *(volatile uint32_t *) &ring->tail >= SHA256_ACCEL_RING_SIZE) {
+		ring->overflows++;
+		return;
+	}
+	__sync_synchronize();
+
+	msg = &ring->msgs[head % SHA256_ACCEL_RING_SIZE];
+	msg->status = status;
+	msg->nonce_candidate = nonce;
+	msg->job_id = job_id;
+
+	__sync_synchronize();
+	*(volatile uint32_t *) &ring->head = head + 1;
+
+	if (write(core->fd, &one, sizeof(one)) != sizeof(one))
+		/* the counter is saturated, the fd is readable anyway */;
+	pthread_cond_broadcast(&core->results);
+}
+
+/* the interrupt handler of sha256_accel.c, run where the core raises the line */
+static void emu_irq(struct core_s *core) {
+	uint32_t status = emu_status(core), job_id;
+	unsigned int drained = 0;
+
+	emu_trace(core, "IRQ %08x %08x %08x", status, core->fifo[core->fifo_rd].nonce, core->active.job_id);
+
+	while (!(status & STATUS_FOUND) && (status & SHA256_ACCEL_STATUS_CANDIDATE)
+			&& drained < SHA256_ACCEL_FIFO_DEPTH) {
+		emu_ring_push(core, status, core->fifo[core->fifo_rd].nonce, core->fifo[core->fifo_rd].job_id);
+		emu_pop_candidate(core);
+		status = emu_status(core);
+		drained++;
+	}
+
+	job_id = core->active.job_id;
+
+	if (status & STATUS_FOUND)
+		emu_ring_push(core, status, core->fifo[core->fifo_rd].nonce, core->fifo[core->fifo_rd].job_id);
+	else if (!drained || job_id != core->last_job_id || !(status & (STATUS_BUSY | STATUS_FIN)))
+		emu_ring_push(core, status, core->fifo[core->fifo_rd].nonce, job_id);
+	core->last_job_id = job_id;
+
+	emu_publish(core);
+}
+
+static void emu_take_next(struct core_s *core) {
+	emu_load_bank(core, &core->active, REG_NEXT_STATE_IN, REG_NEXT_PREFIX, REG_NEXT_DIFFICULTY_MASK,
+			REG_NEXT_NONCE_FIRST, REG_NEXT_NONCE_LAST, core->regs[REG_NEXT_JOB_ID]);
+	core->nonce = core->active.nonce_first;
+	core->next_armed = false;
+	core->state = STATUS_BUSY;
+	core->epoch++;
+	emu_irq(core);
+}
+
+static void emu_reset(struct core_s *core) {
+	core->state = STATUS_RDY;
+	core->next_armed = false;
+	core->continue_mode = false;
+	core->fifo_overflow = false;
+	core->fifo_rd = 0;
+	core->fifo_count = 0;
+	core->nonce = 0;
+	core->epoch++;
+}
+
+/* a write to the control register, every bit is a one-cycle pulse */
+static void emu_control(struct core_s *core, uint32_t ctrl) {
+	if (ctrl & SHA256_ACCEL_CONTROL_RESET) {
+		emu_reset(core);
+		return;
+	}
+
+	if (ctrl & SHA256_ACCEL_CONTROL_ARM_NEXT)
+		core->next_armed = true;
+	if (ctrl & SHA256_ACCEL_CONTROL_CONTINUE)
+		core->continue_mode = true;
+	if ((ctrl & SHA256_ACCEL_CONTROL_POP) && core->continue_mode && core->fifo_count)
+		emu_pop_candidate(core);
+
+	switch (core->state) {
+	case STATUS_RDY:
+	case STATUS_IDLE:
+		if (ctrl & SHA256_ACCEL_CONTROL_START) {
+			emu_load_bank(core, &core->active, REG_STATE_IN, REG_PREFIX, REG_DIFFICULTY_MASK,
+					REG_NONCE_FIRST, REG_NONCE_LAST, core->job_id_in);
+			core->nonce = core->active.nonce_first;
+			core->state = STATUS_BUSY;
+			core->epoch++;
+		} else if (core->state == STATUS_IDLE && core->next_armed) {
+			emu_take_next(core);
+		}
+		break;
+
+	case STATUS_FOUND:
+		if ((ctrl & SHA256_ACCEL_CONTROL_START) && core->fifo_count) {
+			emu_pop_candidate(core);
+			if (core->fifo_count)
+				/* report the next candidate of the same batch */
+				emu_irq(core);
+			else
+				core->state = STATUS_BUSY;
+		}
+		break;
+	}
+}
+
+static void emu_write(struct core_s *core, unsigned int reg, uint32_t val) {
+	emu_trace(core, "W %2u %08x", reg, val);
+
+	switch (reg) {
+	case REG_CONTROL:
+		emu_control(core, val);
+		break;
+
+	case REG_JOB_ID:
+		core->job_id_in = val;
+		return;
+
+	case REG_IRQ_MASK:
+	case REG_STEP:
+		/* the interrupt is delivered synchronously, the core never waits for a step */
+		break;
+
+	case REG_NONCE_CANDIDATE:
+	case REG_NONCE_CURRENT:
+	case REG_STATUS:
+	case REG_DEBUG:
+	case REG_CANDIDATE_JOB_ID:
+		/* driven by the core */
+		return;
+
+	default:
+		core->regs[reg] = val;
+		return;
+	}
+
+	emu_publish(core);
+	pthread_cond_broadcast(&core->control);
+}
+
+static void emu_write_bytes(struct core_s *core, unsigned int reg, const void *data, size_t len) {
+	uint32_t val;
+	size_t i;
+
+	for (i = 0; i < len; i += sizeof(val)) {
+		memcpy(&val, (const uint8_t *) data + i, sizeof(val));
+		emu_write(core, reg + i / sizeof(val), val);
+	}
+}
+
+static uint32_t emu_read(struct core_s *core, unsigned int reg) {
+	uint32_t val = core->regs[reg];
+
+	emu_trace(core, "R %2u %08x", reg, val);
+	return val;
+}
+
+static bool emu_is_candidate(const sha256_context *prefixed, const uint8_t mask[32], uint32_t nonce) {
+	sha256_context ctx = *prefixed;
+	uint32_t be = htobe32(nonce);
+	uint8_t hash[32];
+	int i;
+
+	sha256_update(&ctx, (const uint8_t *) &be, sizeof(be));
+	sha256_finish(&ctx, hash);
+
+	sha256_init(&ctx);
+	sha256_update(&ctx, hash, sizeof(hash));
+	sha256_finish(&ctx, hash);
+
+	for (i = 0; i < 32; ++i)
+		if (hash[i] & mask[i])
+			return false;
+	return true;
+}
+
+static void emu_prefix(const struct bank_s *bank, sha256_context *ctx) {
+	int i;
+
+	/* the state after the first block of the header */
+	ctx->total = 64;
+	for (i = 0; i < 8; ++i)
+		ctx->state[i] = be32toh(((const uint32_t *) bank->state_in)[i]);
+	sha256_update(ctx, bank->prefix, sizeof(bank->prefix));
+}
+
+static void emu_pace(const struct timespec *start, uint32_t done) {
+	struct timespec now, wait;
+	double ahead;
+
+	if (!hashrate)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ahead = (double) done / hashrate - ((now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9);
+	if (ahead <= 0)
+		return;
+
+	wait.tv_sec = ahead;
+	wait.tv_nsec = (ahead - wait.tv_sec) * 1e9;
+	nanosleep(&wait, NULL);
+}
+
+static void *emu_hash(void *arg) {
+	struct core_s *core = (struct core_s *) arg;
+	struct candidate_s hits[EMU_CHUNK];
+	struct bank_s bank;
+	struct timespec start;
+	sha256_context ctx;
+	uint32_t epoch, nonce, count, i, n_hits;
+
+	pthread_mutex_lock(&core->lock);
+	while (true) {
+		while (core->state != STATUS_BUSY)
+			pthread_cond_wait(&core->control, &core->lock);
+
+		bank = core->active;
+		epoch = core->epoch;
+		nonce = core->nonce;
+		/* nonce_last is exclusive */
+		count = bank.nonce_last - nonce;
+		if (count > EMU_CHUNK)
+			count = EMU_CHUNK;
+		pthread_mutex_unlock(&core->lock);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		emu_prefix(&bank, &ctx);
+		for (i = 0, n_hits = 0; i < count; ++i) {
+			if (emu_is_candidate(&ctx, bank.mask, nonce + i)) {
+				hits[n_hits].nonce = nonce + i;
+				hits[n_hits].job_id = bank.job_id;
+				n_hits++;
+			}
+		}
+		emu_pace(&start, count);
+
+		pthread_mutex_lock(&core->lock);
+		/* reset, restarted or taken over meanwhile */
+		if (core->epoch != epoch || core->state != STATUS_BUSY)
+			continue;
+
+		for (i = 0; i < n_hits; ++i) {
+			emu_trace(core, "HIT %08x %08x", hits[i].nonce, hits[i].job_id);
+			emu_push_candidate(core, hits[i].nonce, hits[i].job_id);
+			if (!core->continue_mode) {
+				/* the rest of the chunk is hashed again after the resume */
+				core->nonce = hits[i].nonce + 1;
+				core->state = STATUS_FOUND;
+				emu_irq(core);
+				break;
+			}
+			emu_irq(core);
+		}
+		if (core->state != STATUS_BUSY)
+			continue;
+
+		core->nonce = nonce + count;
+		if (core->nonce == bank.nonce_last) {
+			if (core->next_armed) {
+				emu_take_next(core);
+			} else {
+				core->state = STATUS_IDLE;
+				emu_irq(core);
+			}
+		}
+		emu_publish(core);
+	}
+
+	return NULL;
+}
+
+/******************************************************************************
+ * the driver
+ */
+
+static void emu_init(void) {
+	const char *env;
+	int i;
+
+	real_open = dlsym(RTLD_NEXT, "open");
+	real_close = dlsym(RTLD_NEXT, "close");
+	real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+	real_read = dlsym(RTLD_NEXT, "read");
+	real_mmap = dlsym(RTLD_NEXT, "mmap");
+	real_stat = dlsym(RTLD_NEXT, "stat");
+	real_xstat = dlsym(RTLD_NEXT, "__xstat");
+	real_select = dlsym(RTLD_NEXT, "select");
+	real_poll = dlsym(RTLD_NEXT, "poll");
+
+	pagesize = sysconf(_SC_PAGESIZE);
+
+	env = getenv("SHA256_EMU_CORES");
+	num_cores = env ? atoi(env) : 1;
+	if (num_cores < 0)
+		num_cores = 0;
+	if (num_cores > SHA256_ACCEL_MAX_DEVICES)
+		num_cores = SHA256_ACCEL_MAX_DEVICES;
+
+	env = getenv("SHA256_EMU_HASHRATE");
+	hashrate = env ? strtoull(env, NULL, 0) : 0;
+
+	env = getenv("SHA256_EMU_TRACE");
+	if (env && !strcmp(env, "-"))
+		trace = stderr;
+	else if (env)
+		trace = fopen(env, "w");
+	if (trace)
+		setvbuf(trace, NULL, _IOLBF, 0);
+
+	for (i = 0; i < num_cores; ++i) {
+		struct core_s *core = &cores[i];
+
+		core->id = i;
+		core->fd = -1;
+		pthread_mutex_init(&core->lock, NULL);
+		pthread_cond_init(&core->control, NULL);
+		pthread_cond_init(&core->results, NULL);
+
+		/* file backed, so that the pages handed out map the same memory */
+		core->regs_fd = memfd_create("sha256emu-regs", MFD_CLOEXEC);
+		core->ring_fd = memfd_create("sha256emu-ring", MFD_CLOEXEC);
+		if (core->regs_fd == -1 || core->ring_fd == -1
+				|| ftruncate(core->regs_fd, pagesize) || ftruncate(core->ring_fd, pagesize)) {
+			perror("sha256emu: memfd");
+			abort();
+		}
+		core->regs = real_mmap(NULL, pagesize, PROT_READ | PROT_WRITE, MAP_SHARED, core->regs_fd, 0);
+		core->ring = real_mmap(NULL, pagesize, PROT_READ | PROT_WRITE, MAP_SHARED, core->ring_fd, 0);
+		if (core->regs == MAP_FAILED || core->ring == MAP_FAILED) {
+			perror("sha256emu: mmap");
+			abort();
+		}
+
+		/* what the axi wrapper's aresetn leaves in the register file, the
+		 * control register's reset bit doesn't touch it */
+		core->regs[REG_NONCE_LAST] = 0xffffffff;
+		core->regs[REG_NEXT_NONCE_LAST] = 0xffffffff;
+
+		emu_reset(core);
+		emu_publish(core);
+		if (pthread_create(&core->thread, NULL, emu_hash, core)) {
+			perror("sha256emu: pthread_create");
+			abort();
+		}
+	}
+}
+
+static struct core_s *emu_by_path(const char *path) {
+	char *end;
+	long id;
+
+	pthread_once(&init_once, emu_init);
+	if (!path || strncmp(path, "/dev/" DEVICE_NAME, strlen("/dev/" DEVICE_NAME)))
+		return NULL;
+
+	path += strlen("/dev/" DEVICE_NAME);
+	if (!*path)
+		return NULL;
+	id = strtol(path, &end, 10);
+	if (*end || id < 0)
+		return NULL;
+
+	return id < num_cores ? &cores[id] : NULL;
+}
+
+static struct core_s *emu_by_fd(int fd) {
+	int i;
+
+	pthread_once(&init_once, emu_init);
+	if (fd < 0)
+		return NULL;
+
+	for (i = 0; i < num_cores; ++i)
+		if (cores[i].fd == fd)
+			return &cores[i];
+	return NULL;
+}
+
+static size_t emu_avail(struct core_s *core) {
+	uint32_t head = *(volatile uint32_t *) &core->ring->head;
+	__sync_synchronize();
+	return head - *(volatile uint32_t *) &core->ring->tail;
+}
+
+/* the eventfd has to be readable exactly while results are queued, the tail
+ * may have been moved through the mapping without us noticing */
+static void emu_sync_fd(struct core_s *core) {
+	uint64_t val = 1;
+
+	if (emu_avail(core)) {
+		if (write(core->fd, &val, sizeof(val)) != sizeof(val))
+			/* saturated, readable anyway */;
+	} else if (real_read(core->fd, &val, sizeof(val)) != sizeof(val)) {
+		/* already clear */
+	}
+}
+
+static void emu_fake_stat(struct core_s *core, struct stat *st) {
+	memset(st, 0, sizeof(*st));
+	st->st_mode = S_IFCHR | 0666;
+	st->st_rdev = makedev(240, core->id);
+	st->st_nlink = 1;
+}
+
+int open(const char *path, int flags, ...) {
+	struct core_s *core = emu_by_path(path);
+	mode_t mode = 0;
+	va_list ap;
+	int fd;
+
+	if (!core) {
+			va_start(ap, flags);
+		if (flags & (O_CREAT | O_TMPFILE))
+			mode = va_arg(ap, mode_t);
+		va_end(ap);
+		return real_open(path, flags, mode);
+	}
+
+	pthread_mutex_lock(&core->lock);
+	if (core->fd != -1) {
+		/* only one process may drive a core */
+		pthread_mutex_unlock(&core->lock);
+		errno = EBUSY;
+		return -1;
+	}
+
+	fd = eventfd(0, EFD_NONBLOCK | ((flags & O_CLOEXEC) ? EFD_CLOEXEC : 0));
+	if (fd != -1) {
+		core->fd = fd;
+		core->flags = flags;
+		emu_trace(core, "OPEN");
+	}
+	pthread_mutex_unlock(&core->lock);
+	return fd;
+}
+
+int open64(const char *path, int flags, ...) {
+	mode_t mode = 0;
+	va_list ap;
+
+	va_start(ap, flags);
+	if (flags & (O_CREAT | O_TMPFILE))
+		mode = va_arg(ap, mode_t);
+	va_end(ap);
+	return open(path, flags | O_LARGEFILE, mode);
+}
+
+int close(int fd) {
+	struct core_s *core = emu_by_fd(fd);
+
+	if (core) {
+		pthread_mutex_lock(&core->lock);
+		/* stop any running computation, like release() */
+		emu_write(core, REG_CONTROL, SHA256_ACCEL_CONTROL_RESET);
+		core->fd = -1;
+		emu_trace(core, "CLOSE");
+		pthread_mutex_unlock(&core->lock);
+	}
+
+	return real_close(fd);
+}
+
+int stat(const char *path, struct stat *st) {
+	struct core_s *core = emu_by_path(path);
+
+	if (core) {
+		emu_fake_stat(core, st);
+		return 0;
+	}
+	return real_stat(path, st);
+}
+
+/* glibc before 2.33 routes stat() through here */
+int __xstat(int ver, const char *path, struct stat *st) {
+	struct core_s *core = emu_by_path(path);
+
+	if (core) {
+		emu_fake_stat(core, st);
+		return 0;
+	}
+	return real_xstat(ver, path, st);
+}
+
+static int emu_ioctl(struct core_s *core, unsigned long command, unsigned long param) {
+	struct sha256_accel_job_s job;
+	uint32_t regs[SHA256_ACCEL_NUM_REGS];
+	int i;
+
+	if (_IOC_TYPE(command) != SHA256_ACCEL_MAGIC)
+		return -ENOTTY;
+
+	switch (command) {
+	case SHA256_ACCEL_RESET:
+		emu_write(core, REG_CONTROL, SHA256_ACCEL_CONTROL_RESET);
+		break;
+
+	case SHA256_ACCEL_START:
+		emu_write(core, REG_CONTROL, SHA256_ACCEL_CONTROL_START);
+		break;
+
+	case SHA256_ACCEL_SET_STATE_IN:
+		emu_write_bytes(core, REG_STATE_IN, (const void *) param, 32);
+		break;
+
+	case SHA256_ACCEL_SET_PREFIX:
+		emu_write_bytes(core, REG_PREFIX, (const void *) param, 12);
+		break;
+
+	case SHA256_ACCEL_SET_DIFFICULTY_MASK:
+		emu_write_bytes(core, REG_DIFFICULTY_MASK, (const void *) param, 32);
+		break;
+
+	case SHA256_ACCEL_SET_CONTROL:
+		emu_write(core, REG_CONTROL, param);
+		break;
+
+	case SHA256_ACCEL_SET_NONCE_FIRST:
+		emu_write(core, REG_NONCE_FIRST, param);
+		break;
+
+	case SHA256_ACCEL_SET_NONCE_LAST:
+		emu_write(core, REG_NONCE_LAST, param);
+		break;
+
+	case SHA256_ACCEL_SET_CLOCK_SPEED:
+		/* same bounds as the divisor of FPGA0_CLK_CTRL */
+		if (!param || 1000 / param == 0 || 1000 / param > 0x3f)
+			return -EINVAL;
+		emu_trace(core, "CLOCK %lu", param);
+		break;
+
+	case SHA256_ACCEL_GET_NONCE_CURRENT:
+		*(uint32_t *) param = emu_read(core, REG_NONCE_CURRENT);
+		break;
+
+	case SHA256_ACCEL_GET_NONCE_CANDIDATE:
+		*(uint32_t *) param = emu_read(core, REG_NONCE_CANDIDATE);
+		break;
+
+	case SHA256_ACCEL_GET_STATUS:
+		*(uint32_t *) param = emu_read(core, REG_STATUS);
+		break;
+
+	case SHA256_ACCEL_GET_JOB_ID:
+		*(uint32_t *) param = emu_read(core, REG_JOB_ID);
+		break;
+
+	case SHA256_ACCEL_GET_OVERFLOWS:
+		*(uint32_t *) param = core->ring->overflows;
+		break;
+
+	case SHA256_ACCEL_GET_DEBUG:
+		for (i = 0; i < SHA256_ACCEL_NUM_REGS; ++i)
+			regs[i] = core->regs[i];
+		memcpy((void *) param, regs, sizeof(regs));
+		break;
+
+	case SHA256_ACCEL_STEP:
+		emu_write(core, REG_STEP, 0x1);
+		break;
+
+	case SHA256_ACCEL_SET_JOB_ID:
+		emu_write(core, REG_JOB_ID, param);
+		break;
+
+	case SHA256_ACCEL_QUEUE_JOB:
+		memcpy(&job, (const void *) param, sizeof(job));
+
+		if (emu_read(core, REG_STATUS) & SHA256_ACCEL_STATUS_NEXT_ARMED)
+			return -EBUSY;
+
+		emu_write_bytes(core, REG_NEXT_STATE_IN, job.state_in, sizeof(job.state_in));
+		emu_write_bytes(core, REG_NEXT_PREFIX, job.prefix, sizeof(job.prefix));
+		emu_write_bytes(core, REG_NEXT_DIFFICULTY_MASK, job.difficulty_mask, sizeof(job.difficulty_mask));
+		emu_write(core, REG_NEXT_NONCE_FIRST, job.nonce_first);
+		emu_write(core, REG_NEXT_NONCE_LAST, job.nonce_last);
+		emu_write(core, REG_NEXT_JOB_ID, job.job_id);
+		emu_write(core, REG_CONTROL, SHA256_ACCEL_CONTROL_ARM_NEXT);
+		break;
+
+	default:
+		return -ENOTTY;
+	}
+
+	return 0;
+}
+
+int ioctl(int fd, unsigned long command, ...) {
+	struct core_s *core = emu_by_fd(fd);
+	unsigned long param;
+	va_list ap;
+	int ret;
+
+	va_start(ap, command);
+	param = va_arg(ap, unsigned long);
+	va_end(ap);
+
+	if (!core)
+		return real_ioctl(fd, command, param);
+
+	pthread_mutex_lock(&core->lock);
+	ret = emu_ioctl(core, command, param);
+	pthread_mutex_unlock(&core->lock);
+
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+	return ret;
+}
+
+ssize_t read(int fd, void *buffer, size_t length) {
+	struct core_s *core = emu_by_fd(fd);
+	struct sha256_accel_ring_s *ring;
+	size_t avail, count, i;
+	uint32_t tail;
+
+	if (!core)
+		return real_read(fd, buffer, length);
+
+	if (length < sizeof(struct sha256_accel_msg_s)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	ring = core->ring;
+	pthread_mutex_lock(&core->lock);
+	while (!(avail = emu_avail(core))) {
+		if (core->flags & O_NONBLOCK) {
+			emu_sync_fd(core);
+			pthread_mutex_unlock(&core->lock);
+			errno = EAGAIN;
+			return -1;
+		}
+		pthread_cond_wait(&core->results, &core->lock);
+	}
+
+	count = avail < length / sizeof(struct sha256_accel_msg_s) ? avail : length / sizeof(struct sha256_accel_msg_s);
+	tail = ring->tail;
+	for (i = 0; i < count; ++i)
+		((struct sha256_accel_msg_s *) buffer)[i] = ring->msgs[(tail + i) % SHA256_ACCEL_RING_SIZE];
+	__sync_synchronize();
+	*(volatile uint32_t *) &ring->tail = tail + count;
+
+	emu_sync_fd(core);
+	pthread_mutex_unlock(&core->lock);
+
+	return count * sizeof(struct sha256_accel_msg_s);
+}
+
+void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset) {
+	struct core_s *core = emu_by_fd(fd);
+
+	if (!core) {
+			return real_mmap(addr, length, prot, flags, fd, offset);
+	}
+
+	if (length != (size_t) pagesize) {
+		errno = EINVAL;
+		return MAP_FAILED;
+	}
+
+	switch (offset / pagesize) {
+	case SHA256_ACCEL_MMAP_RING:
+		return real_mmap(addr, length, prot, flags, core->ring_fd, 0);
+
+	case SHA256_ACCEL_MMAP_REGS:
+		/* polling status and progress must not be able to start or reset the core */
+		if (prot & PROT_WRITE) {
+			errno = EPERM;
+			return MAP_FAILED;
+		}
+		return real_mmap(addr, length, prot, flags, core->regs_fd, 0);
+
+	default:
+		errno = EINVAL;
+		return MAP_FAILED;
+	}
+}
+
+void *mmap64(void *addr, size_t length, int prot, int flags, int fd, off64_t offset) {
+	return mmap(addr, length, prot, flags, fd, offset);
+}
+
+int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout) {
+	int i;
+
+	pthread_once(&init_once, emu_init);
+	for (i = 0; readfds && i < num_cores; ++i) {
+		pthread_mutex_lock(&cores[i].lock);
+		if (cores[i].fd != -1 && cores[i].fd < nfds && FD_ISSET(cores[i].fd, readfds))
+			emu_sync_fd(&cores[i]);
+		pthread_mutex_unlock(&cores[i].lock);
+	}
+
+	return real_select(nfds, readfds, writefds, exceptfds, timeout);
+}
+
+int poll(struct pollfd *fds, nfds_t nfds, int timeout) {
+	struct core_s *core;
+	nfds_t i;
+
+	for (i = 0; i < nfds; ++i) {
+		core = emu_by_fd(fds[i].fd);
+		if (!core)
+			continue;
+		pthread_mutex_lock(&core->lock);
+		emu_sync_fd(core);
+		pthread_mutex_unlock(&core->lock);
+	}
+
+	return real_poll(fds, nfds, timeout);
+}
@@ -22,24 +22,80 @@ architecture arc of tborg is
   signal clk: std_ulogic := '0';
   signal state_in: std_ulogic_vector(255 downto 0);
   signal prefix: std_ulogic_vector(95 downto 0);
-  signal mask: std_ulogic_vector(255 downto 0) := (7 downto 4 => '1', others=>'0');
+  signal mask: std_ulogic_vector(255 downto 0) := (others=>'1');
   signal ctrl: std_ulogic_vector(31 downto 0) := (others=>'0');
-       
+
+  signal next_mask: std_ulogic_vector(255 downto 0) := (7 downto 4 => '1', others=>'0');
+
   signal nonce_candidate: w32;
   signal nonce_current: w32;
+  signal job_id_current: w32;
+  signal job_id_candidate: w32;
   signal status: std_ulogic_vector(31 downto 0);
   signal irq: std_ulogic;
 
   signal dbg: w32_vector(0 to 24);
-  constant n_0: w32 := (others=>'0');
-  constant n_1: w32 := (others=>'1');
+
+  -- the first job never produces a candidate, the queued one searches a
+  -- disjoint nonce range with the original mask
+  constant n_0: w32 := X"00000000";
+  constant n_1: w32 := X"00000020";
+  constant next_n_0: w32 := X"00000040";
+  constant next_n_1: w32 := X"00000080";
+  constant job_0: w32 := X"00000001";
+  constant job_1: w32 := X"00000002";
+
+  -- a second core with more pairs than load slots and a mask every hash
+  -- passes, so every nonce it feeds comes back as a candidate
+  constant COV_CORES: natural := 20;
+  constant cov_n_0: w32 := X"00000100";
+  constant cov_n_1: w32 := X"00000130";
+  constant COV_LEN: natural := to_integer(cov_n_1 - cov_n_0);
+  constant zero_mask: std_ulogic_vector(255 downto 0) := (others=>'0');
+
+  signal cov_ctrl: std_ulogic_vector(31 downto 0) := (others=>'0');
+  signal cov_nonce_candidate: w32;
+  signal cov_status: std_ulogic_vector(31 downto 0);
+  signal cov_irq: std_ulogic;
+
+  -- a third one in continue mode: it never stops on a candidate and the
+  -- fifo is drained with POP while it runs. few enough pairs that popping
+  -- every other cycle keeps up with a candidate per nonce.
+  constant CONT_CORES: natural := 6;
+  constant cont_n_0: w32 := X"00000200";
+  constant cont_n_1: w32 := X"00000240";
+  constant CONT_LEN: natural := to_integer(cont_n_1 - cont_n_0);
+
+  signal cont_ctrl: std_ulogic_vector(31 downto 0) := (others=>'0');
+  signal cont_nonce_candidate: w32;
+  signal cont_job_id_candidate: w32;
+  signal cont_status: std_ulogic_vector(31 downto 0);
 begin
 
-  sha: entity work.org(arc) port map(clk, state_in, prefix, mask, ctrl, n_0, n_1, nonce_candidate, nonce_current, status, irq, dbg, '1');
+  sha: entity work.org(arc)
+  generic map (1)
+  port map(clk, state_in, prefix, mask, ctrl, n_0, n_1, job_0,
+           state_in, prefix, next_mask, next_n_0, next_n_1, job_1,
+           nonce_candidate, nonce_current, job_id_current, job_id_candidate,
+           status, irq, dbg, '1');
+
+  cov: entity work.org(arc)
+  generic map (COV_CORES)
+  port map(clk, state_in, prefix, zero_mask, cov_ctrl, cov_n_0, cov_n_1, job_0,
+           state_in, prefix, zero_mask, cov_n_0, cov_n_1, job_1,
+           cov_nonce_candidate, open, open, open,
+           cov_status, cov_irq, open, '1');
+
+  cont: entity work.org(arc)
+  generic map (CONT_CORES)
+  port map(clk, state_in, prefix, zero_mask, cont_ctrl, cont_n_0, cont_n_1, job_0,
+           state_in, prefix, zero_mask, cont_n_0, cont_n_1, job_1,
+           cont_nonce_candidate, open, open, cont_job_id_candidate,
+           cont_status, open, open, '1');
 
   CLK_GEN: process
   begin
-    for i in -2 to 116 + 16*256*4 + 2 loop
+    for i in -2 to 16*1024 loop
       ctr <= i;
       clk <= '0';
       wait for 10 ns;
@@ -77,6 +133,13 @@ begin
           report "start low" severity note;
           ctrl <= (others=>'0');
 
+        when 2 =>
+          report "arm next job" severity note;
+          ctrl <= (2=>'1', others=>'0');
+
+        when 3 =>
+          ctrl <= (others=>'0');
+
         when others =>
       end case;
     end if;
@@ -85,8 +148,135 @@ begin
       report "result " severity note;
       hwrite(l, dbg);
       writeline(output, l);
+      write(l, string'("job "));
+      hwrite(l, std_ulogic_vector(job_id_current));
+      write(l, string'(" candidate job "));
+      hwrite(l, std_ulogic_vector(job_id_candidate));
+      write(l, string'(" nonce "));
+      hwrite(l, std_ulogic_vector(nonce_candidate));
+      writeline(output, l);
+    end if;
+
+  end process;
+
+  -- the core has to stay busy across the handover and feed the first nonce
+  -- of the queued job exactly one slot after the last one of the first job
+  HANDOVER_CHECK: process(clk)
+    variable last_nonce: w32 := (others=>'0');
+    variable last_inc: integer := 0;
+    variable switched, checked: boolean := false;
+  begin
+    if rising_edge(clk) and ctr > 3 and not checked then
+      assert status(1) = '1'
+        report "core left BUSY before the queued job was started" severity error;
+
+      if nonce_current /= last_nonce then
+        if switched then
+          assert ctr - last_inc = 16
+            report "handover left " & integer'image(ctr - last_inc - 16) & " cycles idle" severity error;
+          assert nonce_current = next_n_0 + 1
+            report "queued job did not start at its first nonce" severity error;
+          assert job_id_current = job_1
+            report "queued job id was not taken over" severity error;
+          report "handover checked" severity note;
+          checked := true;
+        elsif nonce_current = next_n_0 then
+          -- the last nonce of the first job (nonce_last is exclusive) was fed
+          assert last_nonce = n_1 - 1
+            report "first job was not run to its end" severity error;
+          assert status(8) = '0'
+            report "next job still armed after the handover" severity error;
+          switched := true;
+        end if;
+        last_inc := ctr;
+      end if;
+
+      last_nonce := nonce_current;
     end if;
+  end process;
+
+  -- every nonce of the range has to be hashed and reported exactly once,
+  -- across lanes, load slots and resumes after each candidate
+  COVERAGE_CHECK: process(clk)
+    type count_t is array (0 to COV_LEN - 1) of natural;
+    variable seen: count_t := (others=>0);
+    variable idx: integer;
+    variable done: boolean := false;
+  begin
+    if rising_edge(clk) then
+      cov_ctrl <= (others=>'0');
 
+      if ctr = -2 then
+        cov_ctrl <= (0=>'1', others=>'0');
+      elsif ctr = 0 then
+        cov_ctrl <= (1=>'1', others=>'0');
+      elsif cov_irq = '1' and not done then
+        if cov_status(4) = '1' then
+          idx := to_integer(cov_nonce_candidate - cov_n_0);
+          if idx < COV_LEN then
+            seen(idx) := seen(idx) + 1;
+          else
+            report "candidate outside of the range" severity error;
+          end if;
+          -- fetch the next candidate or resume
+          cov_ctrl <= (1=>'1', others=>'0');
+        elsif cov_status(3) = '1' then
+          for i in seen'range loop
+            assert seen(i) = 1
+              report "nonce " & integer'image(i) & " covered " & integer'image(seen(i)) & " times" severity error;
+          end loop;
+          report "coverage checked" severity note;
+          done := true;
+        end if;
+      end if;
+    end if;
+  end process;
+
+  -- in continue mode every share of the range has to be drained from the
+  -- fifo exactly once, without the core ever halting
+  CONTINUE_CHECK: process(clk)
+    type count_t is array (0 to CONT_LEN - 1) of natural;
+    variable seen: count_t := (others=>0);
+    variable idx: integer;
+    variable popped: boolean := false;
+    variable done: boolean := false;
+  begin
+    if rising_edge(clk) then
+      cont_ctrl <= (others=>'0');
+
+      if ctr = -2 then
+        cont_ctrl <= (0=>'1', others=>'0');
+      elsif ctr = -1 then
+        cont_ctrl <= (4=>'1', others=>'0');
+      elsif ctr = 0 then
+        cont_ctrl <= (1=>'1', others=>'0');
+      elsif not done then
+        assert cont_status(4) = '0' report "core halted in continue mode" severity error;
+        assert cont_status(10) = '0' report "candidate fifo overflowed" severity error;
+
+        if popped then
+          -- the head only moves the cycle after the pop was seen
+          popped := false;
+        elsif cont_status(9) = '1' then
+          assert cont_job_id_candidate = job_0 report "candidate with wrong job id" severity error;
+          idx := to_integer(cont_nonce_candidate - cont_n_0);
+          if idx < CONT_LEN then
+            seen(idx) := seen(idx) + 1;
+          else
+            report "candidate outside of the range" severity error;
+          end if;
+          cont_ctrl <= (3=>'1', others=>'0');
+          popped := true;
+        elsif cont_status(3) = '1' then
+          for i in seen'range loop
+            assert seen(i) = 1
+              report "nonce " & integer'image(i) & " reported " & integer'image(seen(i)) & " times" severity error;
+          end loop;
+          report "continue mode checked" severity note;
+          done := true;
+        end if;
+      end if;
+    end if;
   end process;
 
 end architecture;